@@ -0,0 +1,85 @@
+/**
+    Batched NBT Reader
+    @file batch.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <string_view>
+
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+/*
+    BufferStream reused across many small documents of similar shape.
+    It remembers the entry count of the n-th compound of the previous
+    document and reserves the n-th compound of the next one accordingly,
+    so decoding a run of item stacks or player files rarely rehashes.
+*/
+class BatchDecodeStream : public BufferStream {
+public:
+    static constexpr size_t MAX_SHAPE = 4096;
+
+    BatchDecodeStream() : BufferStream(nullptr, 0) {
+    }
+
+    /*
+        Returns the root Tag of the document in buffer
+    */
+    std::unique_ptr<Tag> read(std::string_view buffer) {
+        reset(buffer.data(), buffer.size());
+        next_ = 0;
+        return readDocument(*this);
+    }
+
+    size_t predictCompoundSize(size_t &slot) override {
+        slot = next_++;
+        return slot < shape_.size() ? shape_[slot] : 0;
+    }
+
+    void recordCompoundSize(size_t slot, size_t entries) override {
+        if (slot >= MAX_SHAPE) {
+            return;
+        }
+        if (slot >= shape_.size()) {
+            shape_.resize(slot + 1);
+        }
+        shape_[slot] = static_cast<uint32_t>(entries);
+    }
+
+private:
+    std::vector<uint32_t> shape_;
+    size_t next_ = 0;
+};
+
+/*
+    Returns the root Tags of many small documents, decoded on the pool.
+    Each task decodes a contiguous run of buffers with the stream of the
+    thread running it, so the shape learnt by a worker carries over from
+    one run, and one call, to the next.
+    @param buffers the documents
+    @param pool the pool running the decode tasks
+    @param tasksPerWorker number of runs handed out per worker
+    @return the unique pointers of Tag, in the order of buffers
+*/
+inline std::vector<std::unique_ptr<Tag>> readDocuments(
+    const std::vector<std::string_view> &buffers, ThreadPool &pool,
+    size_t tasksPerWorker = 4) {
+    std::vector<std::unique_ptr<Tag>> docs(buffers.size());
+    parallelFor(pool, buffers.size(), pool.size() * tasksPerWorker,
+                [&](size_t lo, size_t hi) {
+                    thread_local BatchDecodeStream stream;
+                    for (size_t i = lo; i < hi; ++i) {
+                        docs[i] = stream.read(buffers[i]);
+                    }
+                });
+    return docs;
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,366 @@
+/**
+    Bedrock world reader
+    @file bedrock.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+
+#include "concat.hpp"
+#include "leveldb.hpp"
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Record tags of Bedrock chunk keys
+*/
+enum class BedrockTag : uint8_t {
+    DATA_3D = 0x2b,
+    VERSION = 0x2c,
+    DATA_2D = 0x2d,
+    DATA_2D_LEGACY = 0x2e,
+    SUB_CHUNK_PREFIX = 0x2f,
+    LEGACY_TERRAIN = 0x30,
+    BLOCK_ENTITY = 0x31,
+    ENTITY = 0x32,
+    PENDING_TICKS = 0x33,
+    LEGACY_BLOCK_EXTRA_DATA = 0x34,
+    BIOME_STATE = 0x35,
+    FINALIZED_STATE = 0x36,
+    CONVERSION_DATA = 0x37,
+    BORDER_BLOCKS = 0x38,
+    HARDCODED_SPAWNERS = 0x39,
+    RANDOM_TICKS = 0x3a,
+    CHECKSUMS = 0x3b,
+    GENERATION_SEED = 0x3c,
+    GENERATED_PRE_CAVES_AND_CLIFFS_BLENDING = 0x3d,
+    BLENDING_BIOME_HEIGHT = 0x3e,
+    META_DATA_HASH = 0x3f,
+    BLENDING_DATA = 0x40,
+    ACTOR_DIGEST_VERSION = 0x41,
+    LEGACY_VERSION = 0x76,
+};
+
+/*
+    Decoded key of a Bedrock LevelDB entry. Chunk records are keyed by
+    x, z, an optional dimension, a record tag and, for sub-chunks, a
+    vertical index; every other key is a plain string such as
+    "~local_player" or "actorprefix...".
+*/
+struct BedrockKey {
+    bool chunk = false;
+    int32_t x = 0;
+    int32_t z = 0;
+    // 0 overworld, 1 nether, 2 end
+    int32_t dimension = 0;
+    BedrockTag tag{};
+    // Sub-chunk index of SUB_CHUNK_PREFIX records, otherwise -1
+    int32_t subChunk = -1;
+    std::string_view name;
+
+    /*
+        Returns true if the value holds little endian NBT
+    */
+    bool isNbt() const {
+        if (chunk) {
+            return tag == BedrockTag::BLOCK_ENTITY ||
+                   tag == BedrockTag::ENTITY ||
+                   tag == BedrockTag::PENDING_TICKS ||
+                   tag == BedrockTag::RANDOM_TICKS;
+        }
+        static const std::string_view prefixes[] = {
+            "~local_player", "player_", "actorprefix", "portals",
+            "scoreboard",    "mobevents", "BiomeData", "AutonomousEntities",
+            "Overworld",     "Nether",  "TheEnd",    "map_",
+            "schedulerWT",   "structuretemplate", "tickingarea",
+            "VILLAGE_",
+        };
+        for (auto prefix : prefixes) {
+            if (name.substr(0, prefix.size()) == prefix) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/*
+    Returns the decoded form of a Bedrock LevelDB key
+*/
+inline BedrockKey decodeBedrockKey(std::string_view key) {
+    BedrockKey out;
+    out.name = key;
+    const size_t size = key.size();
+    if (size != 9 && size != 10 && size != 13 && size != 14) {
+        return out;
+    }
+    const bool hasDimension = size >= 13;
+    const auto tag = static_cast<uint8_t>(key[hasDimension ? 12 : 8]);
+    const bool known = (tag >= 0x2b && tag <= 0x41) || tag == 0x76;
+    const bool subChunk =
+        tag == static_cast<uint8_t>(BedrockTag::SUB_CHUNK_PREFIX);
+    if (!known || subChunk != (size == 10 || size == 14)) {
+        return out;
+    }
+    const int32_t dimension =
+        hasDimension ? leveldb::readLittle<int32_t>(key.data() + 8) : 0;
+    if (dimension < 0 || dimension > 2) {
+        return out;
+    }
+    out.chunk = true;
+    out.x = leveldb::readLittle<int32_t>(key.data());
+    out.z = leveldb::readLittle<int32_t>(key.data() + 4);
+    out.dimension = dimension;
+    out.tag = static_cast<BedrockTag>(tag);
+    if (subChunk) {
+        out.subChunk = static_cast<int8_t>(key[size - 1]);
+    }
+    return out;
+}
+
+/*
+    Returns the big endian form of little endian NBT, so that the regular
+    decoder can read it. The input may hold several root tags in a row,
+    as Bedrock block entity and entity records do.
+*/
+inline std::string littleToBigEndian(const char *data, size_t size) {
+    std::string out(data, size);
+    char *const begin = out.data();
+    char *const end = begin + size;
+    auto need = [&](char *p, size_t n) {
+        if (static_cast<size_t>(end - p) < n) {
+            throw std::runtime_error(
+                "littleToBigEndian: unexpected end of buffer");
+        }
+    };
+    auto swap = [&](char *p, size_t n) {
+        need(p, n);
+        std::reverse(p, p + n);
+        return p + n;
+    };
+    auto count = [&](char *p) {
+        swap(p, 4);
+        return readBuffer<int32_t>(p);
+    };
+    auto string = [&](char *p) {
+        swap(p, 2);
+        auto len = readBuffer<uint16_t>(p);
+        need(p + 2, len);
+        return p + 2 + len;
+    };
+
+    auto payload = [&](auto &self, TagType type, char *p) -> char * {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            need(p, 1);
+            return p + 1;
+        case TagType::TAG_SHORT:
+            return swap(p, 2);
+        case TagType::TAG_INT:
+        case TagType::TAG_FLOAT:
+            return swap(p, 4);
+        case TagType::TAG_LONG:
+        case TagType::TAG_DOUBLE:
+            return swap(p, 8);
+        case TagType::TAG_STRING:
+            return string(p);
+        case TagType::TAG_BYTE_ARRAY: {
+            auto len = std::max(count(p), 0);
+            need(p + 4, static_cast<size_t>(len));
+            return p + 4 + len;
+        }
+        case TagType::TAG_INT_ARRAY:
+        case TagType::TAG_LONG_ARRAY: {
+            const size_t width = type == TagType::TAG_INT_ARRAY ? 4 : 8;
+            auto len = static_cast<size_t>(std::max(count(p), 0));
+            p += 4;
+            need(p, len * width);
+            for (size_t i = 0; i < len; ++i) {
+                p = swap(p, width);
+            }
+            return p;
+        }
+        case TagType::TAG_LIST: {
+            need(p, 1);
+            auto elemType = static_cast<TagType>(*p);
+            auto len = count(p + 1);
+            p += 5;
+            for (int32_t i = 0; i < len; ++i) {
+                p = self(self, elemType, p);
+            }
+            return p;
+        }
+        case TagType::TAG_COMPOUND:
+            while (true) {
+                need(p, 1);
+                auto entryType = static_cast<TagType>(*p++);
+                if (entryType == TagType::TAG_END) {
+                    return p;
+                }
+                p = self(self, entryType, string(p));
+            }
+        default:
+            throw std::runtime_error("littleToBigEndian: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    };
+
+    char *p = begin;
+    while (p != end) {
+        auto type = static_cast<TagType>(*p);
+        p = payload(payload, type, string(p + 1));
+    }
+    return out;
+}
+
+/*
+    Returns the root Tags of a little endian NBT value
+*/
+inline std::vector<std::unique_ptr<Tag>> readLittleEndianDocuments(
+    const char *data, size_t size) {
+    auto big = littleToBigEndian(data, size);
+    std::vector<std::unique_ptr<Tag>> docs;
+    DocumentReader reader(big);
+    reader.nextBatch(docs, SIZE_MAX);
+    return docs;
+}
+
+/*
+    Reader of a Bedrock world folder, the LevelDB database in its db
+    directory. Scans decode the NBT records of every table and log in
+    parallel on a thread pool.
+*/
+class BedrockWorld {
+public:
+    /*
+        @param path the world folder, or its db directory
+    */
+    explicit BedrockWorld(const std::string &path)
+        : db_(std::filesystem::exists(std::filesystem::path(path) / "db")
+                  ? (std::filesystem::path(path) / "db").string()
+                  : path) {
+    }
+
+    const leveldb::Database &database() const {
+        return db_;
+    }
+
+    /*
+        Calls fn(const BedrockKey &, std::string_view value) for the live
+        value of every key
+    */
+    template <typename Fn>
+    void forEachRecord(Fn fn) const {
+        db_.forEach([&](std::string_view key, std::string_view value) {
+            fn(decodeBedrockKey(key), value);
+        });
+    }
+
+    using ErrorHandler =
+        std::function<void(const BedrockKey &, const std::exception &)>;
+
+    /*
+        Decodes every live NBT record on the pool. Versions are resolved
+        with one task per source first, then each source is decoded by a
+        task that folds its records into a partial State, so every source
+        is read twice as in Database::forEach. A record that fails to
+        decode is skipped, the scan goes on.
+        @param pool the pool running the tasks
+        @param visit called as visit(State &, const BedrockKey &,
+               const Tag &) for every root Tag of a record
+        @param merge called as merge(State &total, State &&partial)
+        @param priority the queue of the tasks
+        @param onError called with the key and the error of every skipped
+               record, concurrently from several tasks
+        @return the merged State
+    */
+    template <typename State, typename Visit, typename Merge>
+    State scan(ThreadPool &pool, Visit visit, Merge merge,
+               Priority priority = Priority::BACKGROUND,
+               const ErrorHandler &onError = nullptr) const {
+        const size_t sources = db_.sources().size();
+        std::vector<leveldb::Database::Versions> versions(sources);
+        parallelFor(
+            pool, sources, sources,
+            [&](size_t lo, size_t hi) {
+                for (size_t s = lo; s < hi; ++s) {
+                    versions[s] = db_.versionsIn(s);
+                }
+            },
+            priority);
+        leveldb::Database::Versions latest;
+        for (auto &v : versions) {
+            leveldb::Database::mergeVersions(latest, std::move(v));
+        }
+
+        std::vector<std::future<State>> futures;
+        for (size_t s = 0; s < sources; ++s) {
+            futures.push_back(pool.submit(
+                [&, s] {
+                    State partial{};
+                    db_.forEachIn(s, [&](std::string_view key, uint64_t seq,
+                                         leveldb::ValueType type,
+                                         std::string_view value) {
+                        if (type != leveldb::ValueType::VALUE) {
+                            return;
+                        }
+                        auto decoded = decodeBedrockKey(key);
+                        if (!decoded.isNbt() ||
+                            !leveldb::Database::isLatest(latest, key, s,
+                                                         seq)) {
+                            return;
+                        }
+                        std::vector<std::unique_ptr<Tag>> docs;
+                        try {
+                            docs = readLittleEndianDocuments(value.data(),
+                                                             value.size());
+                        } catch (const std::exception &e) {
+                            if (onError) {
+                                onError(decoded, e);
+                            }
+                            return;
+                        }
+                        for (const auto &doc : docs) {
+                            visit(partial, decoded, *doc);
+                        }
+                        pool.preempt();
+                    });
+                    return partial;
+                },
+                priority));
+        }
+
+        State total{};
+        std::exception_ptr error;
+        for (auto &fut : futures) {
+            try {
+                merge(total, pool.wait(fut));
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return total;
+    }
+
+private:
+    leveldb::Database db_;
+};
+
+
+}  // namespace nbt
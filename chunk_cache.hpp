@@ -0,0 +1,429 @@
+/**
+    Two-tier document cache
+    @file chunk_cache.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+
+#include "compression.hpp"
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Returns an estimate of the heap and object memory held by a decoded
+    Tag and its subtree
+*/
+inline size_t decodedSize(const Tag &tag) {
+    // Object, name and the allocation header of the unique_ptr target
+    size_t size = 64;
+    switch (tag.getTagType()) {
+    case TagType::TAG_STRING: {
+        const auto &val = static_cast<const TagString &>(tag).getValue();
+        return size + (val.size() > 15 ? val.capacity() + 1 : 0);
+    }
+    case TagType::TAG_BYTE_ARRAY:
+        return size +
+               static_cast<const TagByteArray &>(tag).getValue().capacity();
+    case TagType::TAG_INT_ARRAY:
+        return size +
+               static_cast<const TagIntArray &>(tag).getValue().capacity() *
+                   4;
+    case TagType::TAG_LONG_ARRAY:
+        return size +
+               static_cast<const TagLongArray &>(tag).getValue().capacity() *
+                   8;
+    case TagType::TAG_LIST: {
+        const auto &val = static_cast<const TagList &>(tag).getValue();
+        size += val.capacity() * sizeof(void *);
+        for (const auto &elem : val) {
+            size += decodedSize(*elem);
+        }
+        return size;
+    }
+    case TagType::TAG_COMPOUND: {
+        const auto &val = static_cast<const TagCompound &>(tag).getValue();
+        size += val.bucket_count() * sizeof(void *);
+        for (const auto &it : val) {
+            // Hash node holding the key and the pointer
+            size += 64 + (it.first.size() > 15 ? it.first.capacity() + 1 : 0);
+            size += decodedSize(*it.second);
+        }
+        return size;
+    }
+    default:
+        return size;
+    }
+}
+
+struct CacheTierStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t budget = 0;
+
+    double hitRatio() const {
+        const auto lookups = hits + misses;
+        return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+    }
+};
+
+struct ChunkCacheStats {
+    CacheTierStats hot;
+    CacheTierStats cold;
+    // Cold entries decoded back into the hot tier
+    uint64_t promotions = 0;
+    // Hot entries encoded into the cold tier
+    uint64_t demotions = 0;
+    // Cold entries dropped
+    uint64_t evictions = 0;
+};
+
+/*
+    Cache of documents in two tiers. Hot entries are decoded Tags, cold
+    entries are their NBT bytes compressed with LZ4, several times smaller
+    again. Entries beyond the hot budget are demoted to the cold tier,
+    least recently used first, and cold entries beyond the cold budget are
+    dropped. A cold hit decodes the entry and promotes it back.
+
+    Documents are shared with callers, so a demoted or evicted document
+    stays valid for whoever still holds it. Encoding, compression and
+    decoding run outside the lock, and a document being demoted is still
+    found until it reaches the cold tier; the cache is safe to use from
+    several threads.
+*/
+template <typename Key, typename Hash = std::hash<Key>>
+class ChunkCache {
+public:
+    using Document = std::shared_ptr<const Tag>;
+
+    ChunkCache(size_t hotBudget, size_t coldBudget) {
+        stats_.hot.budget = hotBudget;
+        stats_.cold.budget = coldBudget;
+    }
+
+    ChunkCache(const ChunkCache &) = delete;
+    ChunkCache &operator=(const ChunkCache &) = delete;
+
+    /*
+        Returns the document of a key, nullptr if neither tier holds it
+    */
+    Document get(const Key &key) {
+        Cold cold;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = hot_.find(key);
+            if (it != hot_.end()) {
+                ++stats_.hot.hits;
+                hotOrder_.splice(hotOrder_.begin(), hotOrder_, it->second.pos);
+                return it->second.doc;
+            }
+            auto d = demoting_.find(key);
+            if (d != demoting_.end()) {
+                // Still decoded while being encoded for the cold tier: the
+                // demotion is called off and the entry goes back to hot
+                ++stats_.hot.hits;
+                Document doc = std::move(d->second.doc);
+                const size_t size = d->second.size;
+                demoting_.erase(d);
+                std::vector<Victim> victims;
+                insertHot(key, doc, size, victims);
+                lock.unlock();
+                demote(std::move(victims));
+                return doc;
+            }
+            ++stats_.hot.misses;
+            auto c = cold_.find(key);
+            if (c == cold_.end()) {
+                ++stats_.cold.misses;
+                return nullptr;
+            }
+            ++stats_.cold.hits;
+            cold = c->second;
+        }
+        auto raw = lz4Uncompress(cold.data->data(), cold.data->size(),
+                                 cold.rawSize);
+        BufferStream stream(raw.data(), raw.size());
+        Document doc = readDocument(stream);
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = hot_.find(key);
+            if (it != hot_.end()) {
+                // Another thread promoted it first
+                return it->second.doc;
+            }
+            auto c = cold_.find(key);
+            if (c == cold_.end() || c->second.data != cold.data) {
+                // Replaced, erased or evicted while decoding
+                return doc;
+            }
+            eraseCold(c);
+            ++stats_.promotions;
+            insertHot(key, doc, decodedSize(*doc), victims);
+        }
+        demote(std::move(victims));
+        return doc;
+    }
+
+    /*
+        Returns the document of a key, loading it on a miss
+        @param load called as load() -> std::unique_ptr<Tag> on a miss,
+               outside the lock
+    */
+    template <typename Load>
+    Document getOrLoad(const Key &key, Load load) {
+        if (auto doc = get(key)) {
+            return doc;
+        }
+        Document doc = load();
+        if (doc) {
+            put(key, doc);
+        }
+        return doc;
+    }
+
+    /*
+        Inserts or replaces the document of a key in the hot tier
+    */
+    void put(const Key &key, Document doc) {
+        const size_t size = decodedSize(*doc);
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            eraseLocked(key);
+            insertHot(key, std::move(doc), size, victims);
+        }
+        demote(std::move(victims));
+    }
+
+    /*
+        Inserts or replaces the document of a key in the cold tier from its
+        NBT bytes, without decoding it
+    */
+    void putEncoded(const Key &key, std::string_view document) {
+        Cold cold{std::make_shared<const std::string>(
+                      lz4Compress(document.data(), document.size())),
+                  document.size(),
+                  {}};
+        std::lock_guard<std::mutex> lock(mutex_);
+        eraseLocked(key);
+        insertCold(key, std::move(cold));
+    }
+
+    void erase(const Key &key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        eraseLocked(key);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hot_.clear();
+        hotOrder_.clear();
+        cold_.clear();
+        coldOrder_.clear();
+        demoting_.clear();
+        stats_.hot.entries = stats_.hot.bytes = 0;
+        stats_.cold.entries = stats_.cold.bytes = 0;
+    }
+
+    /*
+        Sets the budgets in bytes and enforces them
+    */
+    void setBudgets(size_t hotBudget, size_t coldBudget) {
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.hot.budget = hotBudget;
+            stats_.cold.budget = coldBudget;
+            evictHot(victims, hotBudget);
+            evictCold(coldBudget);
+        }
+        demote(std::move(victims));
+    }
+
+    /*
+        Gives back a fraction of the memory held by each tier, demoting hot
+        entries and dropping cold ones, least recently used first. The
+        budgets are unchanged.
+        @param fraction between 0 and 1
+    */
+    void shrink(double fraction) {
+        fraction = std::min(std::max(fraction, 0.0), 1.0);
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto keep = [fraction](size_t bytes) {
+                return bytes - static_cast<size_t>(bytes * fraction);
+            };
+            evictCold(keep(stats_.cold.bytes));
+            evictHot(victims, keep(stats_.hot.bytes));
+        }
+        demote(std::move(victims));
+    }
+
+    ChunkCacheStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Hot {
+        Document doc;
+        size_t size;
+        typename std::list<Key>::iterator pos;
+    };
+
+    struct Cold {
+        std::shared_ptr<const std::string> data;
+        size_t rawSize = 0;
+        typename std::list<Key>::iterator pos;
+    };
+
+    struct Victim {
+        Key key;
+        Document doc;
+        uint64_t token;
+    };
+
+    struct Demoting {
+        uint64_t token;
+        Document doc;
+        size_t size;
+    };
+
+    using ColdMap = std::unordered_map<Key, Cold, Hash>;
+
+    void insertHot(const Key &key, Document doc, size_t size,
+                   std::vector<Victim> &victims) {
+        hotOrder_.push_front(key);
+        hot_[key] = Hot{std::move(doc), size, hotOrder_.begin()};
+        ++stats_.hot.entries;
+        stats_.hot.bytes += size;
+        evictHot(victims, stats_.hot.budget);
+    }
+
+    /*
+        Moves the least recently used hot entries over limit bytes to
+        victims, to be encoded into the cold tier
+    */
+    void evictHot(std::vector<Victim> &victims, size_t limit) {
+        while (stats_.hot.bytes > limit && !hotOrder_.empty()) {
+            auto it = hot_.find(hotOrder_.back());
+            const uint64_t token = ++lastToken_;
+            demoting_[it->first] =
+                Demoting{token, it->second.doc, it->second.size};
+            victims.push_back(Victim{it->first, std::move(it->second.doc),
+                                     token});
+            stats_.hot.bytes -= it->second.size;
+            --stats_.hot.entries;
+            hotOrder_.pop_back();
+            hot_.erase(it);
+        }
+    }
+
+    void insertCold(const Key &key, Cold cold) {
+        coldOrder_.push_front(key);
+        cold.pos = coldOrder_.begin();
+        stats_.cold.bytes += cold.data->size();
+        ++stats_.cold.entries;
+        cold_[key] = std::move(cold);
+        evictCold(stats_.cold.budget);
+    }
+
+    void evictCold(size_t limit) {
+        while (stats_.cold.bytes > limit && !coldOrder_.empty()) {
+            eraseCold(cold_.find(coldOrder_.back()));
+            ++stats_.evictions;
+        }
+    }
+
+    void eraseCold(typename ColdMap::iterator it) {
+        stats_.cold.bytes -= it->second.data->size();
+        --stats_.cold.entries;
+        coldOrder_.erase(it->second.pos);
+        cold_.erase(it);
+    }
+
+    void eraseLocked(const Key &key) {
+        auto it = hot_.find(key);
+        if (it != hot_.end()) {
+            stats_.hot.bytes -= it->second.size;
+            --stats_.hot.entries;
+            hotOrder_.erase(it->second.pos);
+            hot_.erase(it);
+        }
+        auto c = cold_.find(key);
+        if (c != cold_.end()) {
+            eraseCold(c);
+        }
+        demoting_.erase(key);
+    }
+
+    /*
+        Encodes demoted documents into the cold tier, unless their key was
+        written or erased meanwhile
+    */
+    void demote(std::vector<Victim> victims) {
+        if (victims.empty()) {
+            return;
+        }
+        std::vector<Cold> encoded;
+        encoded.reserve(victims.size());
+        try {
+            std::ostringstream out;
+            for (const auto &victim : victims) {
+                out.str("");
+                writeDocument(out, *victim.doc);
+                const auto raw = out.str();
+                encoded.push_back(
+                    Cold{std::make_shared<const std::string>(
+                             lz4Compress(raw.data(), raw.size())),
+                         raw.size(),
+                         {}});
+            }
+        } catch (...) {
+            encoded.clear();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < victims.size(); ++i) {
+            auto it = demoting_.find(victims[i].key);
+            if (it == demoting_.end() ||
+                it->second.token != victims[i].token) {
+                continue;
+            }
+            demoting_.erase(it);
+            if (i < encoded.size()) {
+                ++stats_.demotions;
+                insertCold(victims[i].key, std::move(encoded[i]));
+            }
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<Key, Hot, Hash> hot_;
+    std::list<Key> hotOrder_;
+    ColdMap cold_;
+    std::list<Key> coldOrder_;
+    // Documents being encoded for the cold tier, still served by get. A
+    // get, put or erase meanwhile removes the key, so the demotion does
+    // not bring back stale data.
+    std::unordered_map<Key, Demoting, Hash> demoting_;
+    uint64_t lastToken_ = 0;
+    ChunkCacheStats stats_;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,762 @@
+/**
+    Dictionary coded compact NBT
+    @file compact.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string_view>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Shared table of compound keys and frequent string values. Versions
+    only ever append keys, so ids stay stable and a document encoded with
+    an older version decodes with any newer one.
+*/
+class KeyDictionary {
+public:
+    KeyDictionary() : sizes_{0} {
+    }
+
+    uint32_t version() const {
+        return static_cast<uint32_t>(sizes_.size() - 1);
+    }
+
+    size_t size() const {
+        return keys_.size();
+    }
+
+    /*
+        Returns the number of keys of an earlier version
+    */
+    size_t sizeAt(uint32_t version) const {
+        return sizes_.at(version);
+    }
+
+    /*
+        Returns the id of a key, -1 if it is not in the dictionary
+    */
+    int64_t find(const std::string &key) const {
+        auto it = ids_.find(key);
+        return it == ids_.end() ? -1 : static_cast<int64_t>(it->second);
+    }
+
+    const std::string &key(size_t id) const {
+        return keys_[id];
+    }
+
+    /*
+        Returns the next version, holding these keys and the new ones
+    */
+    KeyDictionary extend(const std::vector<std::string> &keys) const {
+        KeyDictionary out = *this;
+        for (const auto &key : keys) {
+            if (out.ids_.emplace(key, out.keys_.size()).second) {
+                out.keys_.push_back(key);
+            }
+        }
+        out.sizes_.push_back(out.keys_.size());
+        return out;
+    }
+
+    /*
+        Returns the dictionary as a compound, to be stored or sent with
+        writeDocument
+    */
+    std::unique_ptr<Tag> toTag() const {
+        std::vector<std::unique_ptr<Tag>> keys;
+        keys.reserve(keys_.size());
+        for (const auto &key : keys_) {
+            keys.push_back(std::make_unique<TagString>(std::nullopt, key));
+        }
+        std::vector<int32_t> sizes(sizes_.begin(), sizes_.end());
+        std::unordered_map<std::string, std::unique_ptr<Tag>> root;
+        root["keys"] = std::make_unique<TagList>(
+            "keys", TagType::TAG_STRING, std::move(keys));
+        root["sizes"] =
+            std::make_unique<TagIntArray>("sizes", std::move(sizes));
+        return std::make_unique<TagCompound>("", std::move(root));
+    }
+
+    /*
+        Returns the dictionary stored by toTag
+    */
+    static KeyDictionary fromTag(const Tag &tag) {
+        const auto &root = dynamic_cast<const TagCompound &>(tag).getValue();
+        const auto &keys =
+            dynamic_cast<const TagList &>(*root.at("keys")).getValue();
+        const auto &sizes =
+            dynamic_cast<const TagIntArray &>(*root.at("sizes")).getValue();
+        if (sizes.empty() || sizes.front() != 0 ||
+            static_cast<size_t>(sizes.back()) != keys.size() ||
+            !std::is_sorted(sizes.begin(), sizes.end())) {
+            throw std::runtime_error("KeyDictionary: malformed dictionary");
+        }
+        KeyDictionary out;
+        out.sizes_.assign(sizes.begin(), sizes.end());
+        for (const auto &key : keys) {
+            const auto &name = dynamic_cast<const TagString &>(*key);
+            out.ids_.emplace(name.getValue(), out.keys_.size());
+            out.keys_.push_back(name.getValue());
+        }
+        return out;
+    }
+
+private:
+    std::vector<std::string> keys_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<size_t> sizes_;
+};
+
+/*
+    Counts compound keys and string values over sample documents to pick
+    dictionary keys
+*/
+class KeyCounter {
+public:
+    /*
+        Counts the keys and strings of a standard NBT document
+    */
+    void observe(const char *data, size_t size) {
+        const char *end = data + size;
+        if (size < 3) {
+            throw UnexpectedEnd("KeyCounter: unexpected end of buffer");
+        }
+        auto p = skipPayload(TagType::TAG_STRING, data + 1, end);
+        walk(static_cast<TagType>(*data), p, end);
+    }
+
+    /*
+        Returns the keys seen at least minCount times, most frequent first
+        @param maxKeys the number of keys to return at most
+    */
+    std::vector<std::string> top(size_t maxKeys,
+                                 uint64_t minCount = 2) const {
+        std::vector<std::pair<uint64_t, std::string>> sorted;
+        for (const auto &it : counts_) {
+            if (it.second >= minCount) {
+                sorted.emplace_back(it.second, it.first);
+            }
+        }
+        std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+            return a.first != b.first ? a.first > b.first
+                                      : a.second < b.second;
+        });
+        std::vector<std::string> out;
+        for (size_t i = 0; i < sorted.size() && i < maxKeys; ++i) {
+            out.push_back(std::move(sorted[i].second));
+        }
+        return out;
+    }
+
+private:
+    const char *walk(TagType type, const char *p, const char *end) {
+        if (type == TagType::TAG_LIST) {
+            if (end - p < 5) {
+                throw UnexpectedEnd("KeyCounter: unexpected end of buffer");
+            }
+            auto elemType = static_cast<TagType>(*p);
+            auto len = readBuffer<int32_t>(p + 1);
+            p += 5;
+            for (int32_t i = 0; i < len; ++i) {
+                p = walk(elemType, p, end);
+            }
+            return p;
+        }
+        if (type == TagType::TAG_STRING) {
+            auto next = skipPayload(type, p, end);
+            ++counts_[std::string(p + 2, next)];
+            return next;
+        }
+        if (type != TagType::TAG_COMPOUND) {
+            return skipPayload(type, p, end);
+        }
+        while (true) {
+            if (p == end) {
+                throw UnexpectedEnd("KeyCounter: unexpected end of buffer");
+            }
+            auto entryType = static_cast<TagType>(*p++);
+            if (entryType == TagType::TAG_END) {
+                return p;
+            }
+            auto name = skipPayload(TagType::TAG_STRING, p, end);
+            ++counts_[std::string(p + 2, name)];
+            p = walk(entryType, name, end);
+        }
+    }
+
+private:
+    std::map<std::string, uint64_t> counts_;
+};
+
+/*
+    Compact encoding of a document, for storage and transport between
+    services sharing a KeyDictionary:
+
+        0xc0, varint dictionary version, root type, root key, payload
+
+    Keys and string values are a varint, id << 1 for a dictionary key, or
+    length << 1 | 1 followed by the bytes for any other string. Shorts,
+    ints, longs and int array elements are zigzag varints, lengths are
+    varints. Bytes, floats, doubles, byte arrays and long arrays keep their
+    NBT bytes, since long arrays of packed block states do not shrink as
+    varints.
+*/
+namespace compact {
+
+
+constexpr char MAGIC = '\xc0';
+
+inline void putVarint(std::string &out, uint64_t val) {
+    while (val >= 0x80) {
+        out += static_cast<char>(val | 0x80);
+        val >>= 7;
+    }
+    out += static_cast<char>(val);
+}
+
+inline uint64_t getVarint(const char *&p, const char *end) {
+    uint64_t val = 0;
+    for (int shift = 0; shift <= 63; shift += 7) {
+        if (p == end) {
+            throw UnexpectedEnd("compact: unexpected end of buffer");
+        }
+        auto byte = static_cast<uint8_t>(*p++);
+        val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return val;
+        }
+    }
+    throw std::runtime_error("compact: malformed varint");
+}
+
+inline uint64_t zigzag(int64_t val) {
+    return (static_cast<uint64_t>(val) << 1) ^
+           static_cast<uint64_t>(val >> 63);
+}
+
+inline int64_t unzigzag(uint64_t val) {
+    return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
+
+/*
+    Returns true if the buffer starts like a compact document
+*/
+inline bool isCompact(const char *data, size_t size) {
+    return size > 0 && data[0] == MAGIC;
+}
+
+
+}  // namespace compact
+
+/*
+    Encoder to the compact form, from standard NBT bytes or from Tags.
+    Reuse one encoder to keep its buffers.
+*/
+class CompactEncoder {
+public:
+    explicit CompactEncoder(const KeyDictionary &dict) : dict_(dict) {
+    }
+
+    /*
+        Returns the compact form of a standard NBT document
+    */
+    std::string encode(const char *data, size_t size) {
+        const char *end = data + size;
+        if (size < 3) {
+            throw UnexpectedEnd("CompactEncoder: unexpected end of buffer");
+        }
+        out_.clear();
+        header(static_cast<TagType>(*data));
+        auto p = putKey(data + 1, end);
+        transcode(static_cast<TagType>(*data), p, end);
+        return out_;
+    }
+
+    /*
+        Returns the compact form of a document
+    */
+    std::string encode(const Tag &doc) {
+        out_.clear();
+        header(doc.getTagType());
+        putKey(doc.getName().value_or(""));
+        payload(doc);
+        return out_;
+    }
+
+private:
+    void header(TagType type) {
+        out_ += compact::MAGIC;
+        compact::putVarint(out_, dict_.version());
+        out_ += static_cast<char>(type);
+    }
+
+    void putKey(const std::string &key) {
+        auto id = dict_.find(key);
+        if (id >= 0) {
+            compact::putVarint(out_, static_cast<uint64_t>(id) << 1);
+        } else {
+            compact::putVarint(out_, key.size() << 1 | 1);
+            out_ += key;
+        }
+    }
+
+    const char *putKey(const char *p, const char *end) {
+        auto next = skipPayload(TagType::TAG_STRING, p, end);
+        key_.assign(p + 2, next);
+        putKey(key_);
+        return next;
+    }
+
+    void need(const char *p, const char *end, size_t n) {
+        if (static_cast<size_t>(end - p) < n) {
+            throw UnexpectedEnd("CompactEncoder: unexpected end of buffer");
+        }
+    }
+
+    const char *transcode(TagType type, const char *p, const char *end) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            need(p, end, 1);
+            out_ += *p;
+            return p + 1;
+        case TagType::TAG_SHORT:
+            need(p, end, 2);
+            compact::putVarint(out_, compact::zigzag(readBuffer<int16_t>(p)));
+            return p + 2;
+        case TagType::TAG_INT:
+            need(p, end, 4);
+            compact::putVarint(out_, compact::zigzag(readBuffer<int32_t>(p)));
+            return p + 4;
+        case TagType::TAG_LONG:
+            need(p, end, 8);
+            compact::putVarint(out_, compact::zigzag(readBuffer<int64_t>(p)));
+            return p + 8;
+        case TagType::TAG_FLOAT:
+            need(p, end, 4);
+            out_.append(p, 4);
+            return p + 4;
+        case TagType::TAG_DOUBLE:
+            need(p, end, 8);
+            out_.append(p, 8);
+            return p + 8;
+        case TagType::TAG_STRING:
+            return putKey(p, end);
+        case TagType::TAG_BYTE_ARRAY:
+        case TagType::TAG_LONG_ARRAY: {
+            auto next = skipPayload(type, p, end);
+            compact::putVarint(
+                out_, static_cast<uint32_t>(std::max(readBuffer<int32_t>(p),
+                                                     0)));
+            out_.append(p + 4, next);
+            return next;
+        }
+        case TagType::TAG_INT_ARRAY: {
+            auto next = skipPayload(type, p, end);
+            compact::putVarint(out_, static_cast<size_t>(next - p - 4) / 4);
+            for (p += 4; p != next; p += 4) {
+                compact::putVarint(out_,
+                                   compact::zigzag(readBuffer<int32_t>(p)));
+            }
+            return next;
+        }
+        case TagType::TAG_LIST: {
+            need(p, end, 5);
+            auto elemType = static_cast<TagType>(*p);
+            auto len = std::max(readBuffer<int32_t>(p + 1), 0);
+            out_ += *p;
+            compact::putVarint(out_, static_cast<uint32_t>(len));
+            p += 5;
+            for (int32_t i = 0; i < len; ++i) {
+                p = transcode(elemType, p, end);
+            }
+            return p;
+        }
+        case TagType::TAG_COMPOUND:
+            while (true) {
+                need(p, end, 1);
+                auto entryType = static_cast<TagType>(*p++);
+                out_ += static_cast<char>(entryType);
+                if (entryType == TagType::TAG_END) {
+                    return p;
+                }
+                p = transcode(entryType, putKey(p, end), end);
+            }
+        default:
+            throw std::runtime_error("CompactEncoder: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    }
+
+    template <typename T>
+    void putArray(const std::vector<T> &val) {
+        compact::putVarint(out_, val.size());
+        for (auto elem : val) {
+            elem = endian::refineBigEndian<T>(elem);
+            out_.append(reinterpret_cast<const char *>(&elem), sizeof(elem));
+        }
+    }
+
+    void payload(const Tag &tag) {
+        switch (tag.getTagType()) {
+        case TagType::TAG_BYTE:
+            out_ += static_cast<char>(
+                static_cast<const TagByte &>(tag).getValue());
+            break;
+        case TagType::TAG_SHORT:
+            compact::putVarint(out_,
+                               compact::zigzag(static_cast<const TagShort &>(
+                                                   tag).getValue()));
+            break;
+        case TagType::TAG_INT:
+            compact::putVarint(out_,
+                               compact::zigzag(static_cast<const TagInt &>(
+                                                   tag).getValue()));
+            break;
+        case TagType::TAG_LONG:
+            compact::putVarint(out_,
+                               compact::zigzag(static_cast<const TagLong &>(
+                                                   tag).getValue()));
+            break;
+        case TagType::TAG_FLOAT: {
+            auto val = endian::refineBigEndian(
+                static_cast<const TagFloat &>(tag).getValue());
+            out_.append(reinterpret_cast<const char *>(&val), sizeof(val));
+            break;
+        }
+        case TagType::TAG_DOUBLE: {
+            auto val = endian::refineBigEndian(
+                static_cast<const TagDouble &>(tag).getValue());
+            out_.append(reinterpret_cast<const char *>(&val), sizeof(val));
+            break;
+        }
+        case TagType::TAG_STRING:
+            putKey(static_cast<const TagString &>(tag).getValue());
+            break;
+        case TagType::TAG_BYTE_ARRAY:
+            putArray(static_cast<const TagByteArray &>(tag).getValue());
+            break;
+        case TagType::TAG_LONG_ARRAY:
+            putArray(static_cast<const TagLongArray &>(tag).getValue());
+            break;
+        case TagType::TAG_INT_ARRAY: {
+            const auto &val = static_cast<const TagIntArray &>(tag).getValue();
+            compact::putVarint(out_, val.size());
+            for (auto elem : val) {
+                compact::putVarint(out_, compact::zigzag(elem));
+            }
+            break;
+        }
+        case TagType::TAG_LIST: {
+            const auto &list = static_cast<const TagList &>(tag);
+            out_ += static_cast<char>(list.getElementType());
+            compact::putVarint(out_, list.getValue().size());
+            for (const auto &elem : list.getValue()) {
+                payload(*elem);
+            }
+            break;
+        }
+        case TagType::TAG_COMPOUND:
+            for (const auto &it :
+                 static_cast<const TagCompound &>(tag).getValue()) {
+                out_ += static_cast<char>(it.second->getTagType());
+                putKey(it.first);
+                payload(*it.second);
+            }
+            out_ += static_cast<char>(TagType::TAG_END);
+            break;
+        default:
+            throw std::runtime_error("CompactEncoder: TagType " +
+                                     std::to_string(static_cast<int>(
+                                         tag.getTagType())) +
+                                     " not found");
+        }
+    }
+
+private:
+    const KeyDictionary &dict_;
+    std::string out_;
+    std::string key_;
+};
+
+/*
+    Decoder of the compact form, to Tags or back to standard NBT bytes
+*/
+class CompactDecoder {
+public:
+    explicit CompactDecoder(const KeyDictionary &dict) : dict_(dict) {
+    }
+
+    /*
+        Returns the root Tag of a compact document
+    */
+    std::unique_ptr<Tag> read(const char *data, size_t size) {
+        const char *end = data + size;
+        const char *p = header(data, end);
+        auto type = static_cast<TagType>(*p++);
+        auto name = key(p, end);
+        return tag(type, std::move(name), p, end);
+    }
+
+    /*
+        Returns the standard NBT bytes of a compact document
+    */
+    std::string toNbt(const char *data, size_t size) {
+        const char *end = data + size;
+        const char *p = header(data, end);
+        auto type = static_cast<TagType>(*p++);
+        out_.clear();
+        out_ += static_cast<char>(type);
+        putString(key(p, end));
+        transcode(type, p, end);
+        return out_;
+    }
+
+private:
+    const char *header(const char *p, const char *end) {
+        if (!compact::isCompact(p, static_cast<size_t>(end - p))) {
+            throw std::runtime_error("CompactDecoder: not a compact document");
+        }
+        ++p;
+        const auto version = compact::getVarint(p, end);
+        if (version > dict_.version()) {
+            throw std::runtime_error(
+                "CompactDecoder: dictionary version " +
+                std::to_string(version) + " is newer than " +
+                std::to_string(dict_.version()));
+        }
+        limit_ = dict_.sizeAt(static_cast<uint32_t>(version));
+        need(p, end, 1);
+        return p;
+    }
+
+    void need(const char *p, const char *end, size_t n) {
+        if (static_cast<size_t>(end - p) < n) {
+            throw UnexpectedEnd("CompactDecoder: unexpected end of buffer");
+        }
+    }
+
+    std::string key(const char *&p, const char *end) {
+        const auto ref = compact::getVarint(p, end);
+        if ((ref & 1) == 0) {
+            if ((ref >> 1) >= limit_) {
+                throw std::runtime_error("CompactDecoder: unknown key id");
+            }
+            return dict_.key(static_cast<size_t>(ref >> 1));
+        }
+        return bytes(ref >> 1, p, end);
+    }
+
+    std::string bytes(uint64_t len, const char *&p, const char *end) {
+        need(p, end, len);
+        std::string out(p, static_cast<size_t>(len));
+        p += len;
+        return out;
+    }
+
+    uint32_t length(const char *&p, const char *end) {
+        const auto len = compact::getVarint(p, end);
+        // Every element takes at least one byte
+        need(p, end, len);
+        return static_cast<uint32_t>(len);
+    }
+
+    template <typename T>
+    T varint(const char *&p, const char *end) {
+        return static_cast<T>(compact::unzigzag(compact::getVarint(p, end)));
+    }
+
+    template <typename T>
+    T fixed(const char *&p, const char *end) {
+        need(p, end, sizeof(T));
+        auto val = readBuffer<T>(p);
+        p += sizeof(T);
+        return val;
+    }
+
+    template <typename T>
+    std::vector<T> array(const char *&p, const char *end) {
+        const auto len = length(p, end);
+        need(p, end, static_cast<size_t>(len) * sizeof(T));
+        std::vector<T> val(len);
+        for (auto &elem : val) {
+            elem = readBuffer<T>(p);
+            p += sizeof(T);
+        }
+        return val;
+    }
+
+    std::unique_ptr<Tag> tag(TagType type, std::optional<std::string> name,
+                             const char *&p, const char *end) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            return std::make_unique<TagByte>(std::move(name),
+                                             fixed<int8_t>(p, end));
+        case TagType::TAG_SHORT:
+            return std::make_unique<TagShort>(std::move(name),
+                                              varint<int16_t>(p, end));
+        case TagType::TAG_INT:
+            return std::make_unique<TagInt>(std::move(name),
+                                            varint<int32_t>(p, end));
+        case TagType::TAG_LONG:
+            return std::make_unique<TagLong>(std::move(name),
+                                             varint<int64_t>(p, end));
+        case TagType::TAG_FLOAT:
+            return std::make_unique<TagFloat>(std::move(name),
+                                              fixed<float>(p, end));
+        case TagType::TAG_DOUBLE:
+            return std::make_unique<TagDouble>(std::move(name),
+                                               fixed<double>(p, end));
+        case TagType::TAG_STRING:
+            return std::make_unique<TagString>(std::move(name), key(p, end));
+        case TagType::TAG_BYTE_ARRAY:
+            return std::make_unique<TagByteArray>(std::move(name),
+                                                  array<int8_t>(p, end));
+        case TagType::TAG_LONG_ARRAY:
+            return std::make_unique<TagLongArray>(std::move(name),
+                                                  array<int64_t>(p, end));
+        case TagType::TAG_INT_ARRAY: {
+            std::vector<int32_t> val(length(p, end));
+            for (auto &elem : val) {
+                elem = varint<int32_t>(p, end);
+            }
+            return std::make_unique<TagIntArray>(std::move(name),
+                                                 std::move(val));
+        }
+        case TagType::TAG_LIST: {
+            need(p, end, 1);
+            auto elemType = static_cast<TagType>(*p++);
+            std::vector<std::unique_ptr<Tag>> val(length(p, end));
+            for (auto &elem : val) {
+                elem = tag(elemType, std::nullopt, p, end);
+            }
+            return std::make_unique<TagList>(std::move(name), elemType,
+                                             std::move(val));
+        }
+        case TagType::TAG_COMPOUND: {
+            std::unordered_map<std::string, std::unique_ptr<Tag>> val;
+            while (true) {
+                need(p, end, 1);
+                auto entryType = static_cast<TagType>(*p++);
+                if (entryType == TagType::TAG_END) {
+                    break;
+                }
+                auto entry = key(p, end);
+                auto child = tag(entryType, entry, p, end);
+                val.insert({std::move(entry), std::move(child)});
+            }
+            return std::make_unique<TagCompound>(std::move(name),
+                                                 std::move(val));
+        }
+        default:
+            throw std::runtime_error("CompactDecoder: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    }
+
+    template <typename T>
+    void put(T val) {
+        val = endian::refineBigEndian<T>(val);
+        out_.append(reinterpret_cast<const char *>(&val), sizeof(val));
+    }
+
+    void putString(const std::string &val) {
+        if (val.size() > UINT16_MAX) {
+            throw std::length_error(
+                "CompactDecoder: string longer than 65535 bytes");
+        }
+        put<uint16_t>(static_cast<uint16_t>(val.size()));
+        out_ += val;
+    }
+
+    void transcode(TagType type, const char *&p, const char *end) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+        case TagType::TAG_FLOAT:
+        case TagType::TAG_DOUBLE: {
+            const size_t width = type == TagType::TAG_BYTE    ? 1
+                                 : type == TagType::TAG_FLOAT ? 4
+                                                              : 8;
+            need(p, end, width);
+            out_.append(p, width);
+            p += width;
+            break;
+        }
+        case TagType::TAG_SHORT:
+            put(varint<int16_t>(p, end));
+            break;
+        case TagType::TAG_INT:
+            put(varint<int32_t>(p, end));
+            break;
+        case TagType::TAG_LONG:
+            put(varint<int64_t>(p, end));
+            break;
+        case TagType::TAG_STRING:
+            putString(key(p, end));
+            break;
+        case TagType::TAG_BYTE_ARRAY:
+        case TagType::TAG_LONG_ARRAY: {
+            const size_t width = type == TagType::TAG_BYTE_ARRAY ? 1 : 8;
+            const auto len = length(p, end);
+            need(p, end, static_cast<size_t>(len) * width);
+            put<int32_t>(static_cast<int32_t>(len));
+            out_.append(p, len * width);
+            p += len * width;
+            break;
+        }
+        case TagType::TAG_INT_ARRAY: {
+            const auto len = length(p, end);
+            put<int32_t>(static_cast<int32_t>(len));
+            for (uint32_t i = 0; i < len; ++i) {
+                put(varint<int32_t>(p, end));
+            }
+            break;
+        }
+        case TagType::TAG_LIST: {
+            need(p, end, 1);
+            auto elemType = static_cast<TagType>(*p++);
+            const auto len = length(p, end);
+            out_ += static_cast<char>(elemType);
+            put<int32_t>(static_cast<int32_t>(len));
+            for (uint32_t i = 0; i < len; ++i) {
+                transcode(elemType, p, end);
+            }
+            break;
+        }
+        case TagType::TAG_COMPOUND:
+            while (true) {
+                need(p, end, 1);
+                auto entryType = static_cast<TagType>(*p++);
+                out_ += static_cast<char>(entryType);
+                if (entryType == TagType::TAG_END) {
+                    break;
+                }
+                putString(key(p, end));
+                transcode(entryType, p, end);
+            }
+            break;
+        default:
+            throw std::runtime_error("CompactDecoder: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    }
+
+private:
+    const KeyDictionary &dict_;
+    size_t limit_ = 0;
+    std::string out_;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,309 @@
+/**
+    Compression helpers
+    @file compression.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+
+namespace nbt {
+
+
+/*
+    Returns the decompressed content of a gzip or zlib stream
+    @param data the compressed stream
+    @param size size of the compressed stream
+    @param windowBits as for inflateInit2, the default detects both headers
+    @return the decompressed bytes
+*/
+inline std::string inflateBuffer(const char *data, size_t size,
+                                 int windowBits = 15 + 32) {
+    z_stream zs{};
+    if (inflateInit2(&zs, windowBits) != Z_OK) {
+        throw std::runtime_error("inflateBuffer: inflateInit2 failed");
+    }
+    std::string out(std::max<size_t>(size * 4, 4096), '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = static_cast<uInt>(size);
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (zs.total_out == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        zs.next_out = reinterpret_cast<Bytef *>(&out[zs.total_out]);
+        zs.avail_out = static_cast<uInt>(out.size() - zs.total_out);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            inflateEnd(&zs);
+            throw std::runtime_error("inflateBuffer: corrupted stream");
+        }
+        if (ret == Z_OK && zs.avail_in == 0 && zs.avail_out != 0) {
+            inflateEnd(&zs);
+            throw std::runtime_error("inflateBuffer: truncated stream");
+        }
+    }
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+    return out;
+}
+
+
+/*
+    Returns the decompressed content of a raw Snappy block
+    @param data the compressed block
+    @param size size of the compressed block
+    @return the decompressed bytes
+*/
+inline std::string snappyUncompress(const char *data, size_t size) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data);
+    const auto *end = p + size;
+    auto corrupted = [] {
+        return std::runtime_error("snappyUncompress: corrupted block");
+    };
+
+    uint64_t length = 0;
+    for (int shift = 0;; shift += 7) {
+        if (p == end || shift > 28) {
+            throw corrupted();
+        }
+        length |= static_cast<uint64_t>(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            break;
+        }
+    }
+    std::string out;
+    // The header is untrusted; a copy tag expands to at most 64 bytes
+    out.reserve(std::min<uint64_t>(length, 32 * size));
+    while (p != end) {
+        const unsigned tag = *p++;
+        size_t len;
+        size_t offset = 0;
+        switch (tag & 3) {
+        case 0: {
+            len = (tag >> 2) + 1;
+            if (len > 60) {
+                const size_t bytes = len - 60;
+                if (static_cast<size_t>(end - p) < bytes) {
+                    throw corrupted();
+                }
+                len = 0;
+                for (size_t i = 0; i < bytes; ++i) {
+                    len |= static_cast<size_t>(p[i]) << (8 * i);
+                }
+                len += 1;
+                p += bytes;
+            }
+            if (static_cast<size_t>(end - p) < len) {
+                throw corrupted();
+            }
+            out.append(reinterpret_cast<const char *>(p), len);
+            p += len;
+            continue;
+        }
+        case 1:
+            if (p == end) {
+                throw corrupted();
+            }
+            len = 4 + ((tag >> 2) & 7);
+            offset = ((tag >> 5) << 8) | *p++;
+            break;
+        case 2:
+            if (end - p < 2) {
+                throw corrupted();
+            }
+            len = (tag >> 2) + 1;
+            offset = p[0] | (p[1] << 8);
+            p += 2;
+            break;
+        default:
+            if (end - p < 4) {
+                throw corrupted();
+            }
+            len = (tag >> 2) + 1;
+            offset = p[0] | (p[1] << 8) | (p[2] << 16) |
+                     (static_cast<size_t>(p[3]) << 24);
+            p += 4;
+            break;
+        }
+        if (offset == 0 || offset > out.size()) {
+            throw corrupted();
+        }
+        // Copies may overlap their own output, so go byte by byte
+        const size_t from = out.size() - offset;
+        for (size_t i = 0; i < len; ++i) {
+            out.push_back(out[from + i]);
+        }
+    }
+    if (out.size() != length) {
+        throw corrupted();
+    }
+    return out;
+}
+
+/*
+    Returns a block in the LZ4 block format, without frame or size header
+    @param data the bytes to compress
+    @param size number of bytes
+    @return the compressed block
+*/
+inline std::string lz4Compress(const char *data, size_t size) {
+    constexpr int HASH_LOG = 12;
+    constexpr size_t MIN_MATCH = 4;
+    // The format requires the last 5 bytes to be literals and the last
+    // match to start at least 12 bytes before the end
+    constexpr size_t LAST_LITERALS = 5;
+    constexpr size_t MF_LIMIT = 12;
+    constexpr size_t MAX_OFFSET = 65535;
+
+    auto read32 = [data](size_t pos) {
+        uint32_t v;
+        std::memcpy(&v, data + pos, sizeof(v));
+        return v;
+    };
+    auto hash = [](uint32_t v) {
+        return (v * 2654435761u) >> (32 - HASH_LOG);
+    };
+
+    std::string out;
+    out.reserve(size + size / 255 + 16);
+    auto putLength = [&out](size_t len) {
+        for (; len >= 255; len -= 255) {
+            out += static_cast<char>(255);
+        }
+        out += static_cast<char>(len);
+    };
+    auto putSequence = [&](size_t literalStart, size_t literals,
+                           size_t offset, size_t matchLength) {
+        const size_t extra = matchLength - MIN_MATCH;
+        out += static_cast<char>((std::min<size_t>(literals, 15) << 4) |
+                                 std::min<size_t>(extra, 15));
+        if (literals >= 15) {
+            putLength(literals - 15);
+        }
+        out.append(data + literalStart, literals);
+        out += static_cast<char>(offset & 0xff);
+        out += static_cast<char>(offset >> 8);
+        if (extra >= 15) {
+            putLength(extra - 15);
+        }
+    };
+
+    size_t anchor = 0;
+    if (size > MF_LIMIT) {
+        // Positions are stored plus one so that zero marks an empty slot
+        std::array<uint32_t, 1 << HASH_LOG> table{};
+        const size_t matchEnd = size - LAST_LITERALS;
+        const size_t lastStart = size - MF_LIMIT;
+        size_t pos = 0;
+        while (pos <= lastStart) {
+            const uint32_t seq = read32(pos);
+            auto &slot = table[hash(seq)];
+            size_t ref = slot;
+            slot = static_cast<uint32_t>(pos + 1);
+            if (ref == 0 || pos + 1 - ref > MAX_OFFSET ||
+                read32(ref - 1) != seq) {
+                // Step faster through data that does not compress
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            --ref;
+            while (pos > anchor && ref > 0 && data[pos - 1] == data[ref - 1]) {
+                --pos;
+                --ref;
+            }
+            size_t len = MIN_MATCH;
+            while (pos + len < matchEnd && data[pos + len] == data[ref + len]) {
+                ++len;
+            }
+            putSequence(anchor, pos - anchor, pos - ref, len);
+            pos += len;
+            anchor = pos;
+        }
+    }
+
+    const size_t literals = size - anchor;
+    out += static_cast<char>(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) {
+        putLength(literals - 15);
+    }
+    out.append(data + anchor, literals);
+    return out;
+}
+
+/*
+    Returns the content of an LZ4 block
+    @param data the compressed block
+    @param size size of the compressed block
+    @param rawSize size of the content, stored next to the block
+    @return the decompressed bytes
+*/
+inline std::string lz4Uncompress(const char *data, size_t size,
+                                 size_t rawSize) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data);
+    const auto *end = p + size;
+    auto corrupted = [] {
+        return std::runtime_error("lz4Uncompress: corrupted block");
+    };
+    auto readLength = [&](size_t len) {
+        if (len == 15) {
+            unsigned char byte;
+            do {
+                if (p == end) {
+                    throw corrupted();
+                }
+                byte = *p++;
+                len += byte;
+            } while (byte == 255);
+        }
+        return len;
+    };
+
+    std::string out(rawSize, '\0');
+    size_t o = 0;
+    while (true) {
+        if (p == end) {
+            throw corrupted();
+        }
+        const unsigned token = *p++;
+        const size_t literals = readLength(token >> 4);
+        if (static_cast<size_t>(end - p) < literals || rawSize - o < literals) {
+            throw corrupted();
+        }
+        std::memcpy(&out[o], p, literals);
+        p += literals;
+        o += literals;
+        if (p == end) {
+            break;
+        }
+        if (end - p < 2) {
+            throw corrupted();
+        }
+        const size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        const size_t len = readLength(token & 15) + 4;
+        if (offset == 0 || offset > o || rawSize - o < len) {
+            throw corrupted();
+        }
+        // Copies may overlap their own output, so go byte by byte
+        for (size_t i = 0; i < len; ++i, ++o) {
+            out[o] = out[o - offset];
+        }
+    }
+    if (o != rawSize) {
+        throw corrupted();
+    }
+    return out;
+}
+
+
+}  // namespace nbt
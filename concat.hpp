@@ -0,0 +1,241 @@
+/**
+    Concatenated NBT document reader
+    @file concat.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <istream>
+#include <iterator>
+#include <string_view>
+
+#include "batch.hpp"
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Thrown when the source ends in the middle of a document
+*/
+class TruncatedDocument : public std::runtime_error {
+public:
+    TruncatedDocument(size_t offset, size_t available)
+        : std::runtime_error("DocumentReader: document at offset " +
+                             std::to_string(offset) + " truncated after " +
+                             std::to_string(available) + " bytes"),
+          offset_(offset) {
+    }
+
+    /*
+        Returns the offset of the truncated document in the source
+    */
+    size_t offset() const {
+        return offset_;
+    }
+
+private:
+    size_t offset_;
+};
+
+/*
+    Reader of documents stored back to back, from a memory buffer or an
+    input stream. Each document is framed with skipPayload before being
+    decoded, so the end of the source between two documents is told apart
+    from a document cut short. One BatchDecodeStream and one read buffer
+    are reused for every document.
+*/
+class DocumentReader {
+public:
+    static constexpr size_t READ_SIZE = 64 << 10;
+
+    /*
+        @param buffer the documents, which must outlive the reader
+    */
+    explicit DocumentReader(std::string_view buffer) : view_(buffer) {
+    }
+
+    /*
+        @param in the stream of documents
+        @param readSize bytes requested from the stream at a time
+    */
+    explicit DocumentReader(std::istream &in, size_t readSize = READ_SIZE)
+        : in_(&in), readSize_(std::max<size_t>(readSize, 1)) {
+    }
+
+    DocumentReader(const DocumentReader &) = delete;
+    DocumentReader &operator=(const DocumentReader &) = delete;
+
+    /*
+        Returns the root Tag of the next document, nullptr at the end of
+        the source
+        @throw TruncatedDocument if the source ends inside a document
+    */
+    std::unique_ptr<Tag> next() {
+        size_t size = 0;
+        if (!frame(size)) {
+            return nullptr;
+        }
+        auto doc = stream_.read(view_.substr(pos_, size));
+        pos_ += size;
+        ++count_;
+        return doc;
+    }
+
+    /*
+        Appends up to max documents to out, reusing its capacity across
+        batches
+        @return the number of documents appended, 0 at the end
+    */
+    size_t nextBatch(std::vector<std::unique_ptr<Tag>> &out, size_t max) {
+        size_t n = 0;
+        for (; n < max; ++n) {
+            auto doc = next();
+            if (!doc) {
+                break;
+            }
+            out.push_back(std::move(doc));
+        }
+        return n;
+    }
+
+    /*
+        Returns the offset in the source of the next document
+    */
+    size_t offset() const {
+        return base_ + pos_;
+    }
+
+    /*
+        Returns the number of documents read so far
+    */
+    size_t count() const {
+        return count_;
+    }
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::unique_ptr<Tag>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type *;
+        using reference = value_type &;
+
+        iterator() = default;
+
+        explicit iterator(DocumentReader *reader) : reader_(reader) {
+            ++*this;
+        }
+
+        reference operator*() {
+            return doc_;
+        }
+
+        pointer operator->() {
+            return &doc_;
+        }
+
+        iterator &operator++() {
+            doc_ = reader_->next();
+            if (!doc_) {
+                reader_ = nullptr;
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const {
+            return reader_ == other.reader_;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return reader_ != other.reader_;
+        }
+
+    private:
+        DocumentReader *reader_ = nullptr;
+        std::unique_ptr<Tag> doc_;
+    };
+
+    iterator begin() {
+        return iterator(this);
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+private:
+    /*
+        Makes sure a whole document starts at pos_
+        @param size set to the size of the document
+        @return false at the end of the source
+    */
+    bool frame(size_t &size) {
+        while (true) {
+            const char *p = view_.data() + pos_;
+            const char *end = view_.data() + view_.size();
+            if (p == end) {
+                if (!refill()) {
+                    return false;
+                }
+                continue;
+            }
+            if (static_cast<TagType>(*p) != TagType::TAG_COMPOUND) {
+                throw std::runtime_error(
+                    "DocumentReader: document should be a named compound");
+            }
+            try {
+                auto last = skipPayload(TagType::TAG_STRING, p + 1, end);
+                size = static_cast<size_t>(
+                    skipPayload(TagType::TAG_COMPOUND, last, end) - p);
+                return true;
+            } catch (const UnexpectedEnd &) {
+                if (!refill()) {
+                    throw TruncatedDocument(offset(),
+                                            static_cast<size_t>(end - p));
+                }
+            }
+        }
+    }
+
+    /*
+        Moves the unread bytes to the front of the buffer and reads more,
+        at least as many as are already waiting so that a large document
+        is framed a logarithmic number of times
+        @return false if the source had nothing left
+    */
+    bool refill() {
+        if (in_ == nullptr) {
+            return false;
+        }
+        buffer_.erase(0, pos_);
+        base_ += pos_;
+        pos_ = 0;
+        const size_t unread = buffer_.size();
+        buffer_.resize(unread + std::max(readSize_, unread));
+        in_->read(buffer_.data() + unread,
+                  static_cast<std::streamsize>(buffer_.size() - unread));
+        const auto got = static_cast<size_t>(in_->gcount());
+        if (in_->bad()) {
+            throw std::runtime_error("DocumentReader: read error");
+        }
+        buffer_.resize(unread + got);
+        view_ = buffer_;
+        return got != 0;
+    }
+
+private:
+    std::istream *in_ = nullptr;
+    size_t readSize_ = READ_SIZE;
+    std::string buffer_;
+    std::string_view view_;
+    size_t pos_ = 0;
+    size_t base_ = 0;
+    size_t count_ = 0;
+    BatchDecodeStream stream_;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,167 @@
+/**
+    Cancellation, deadlines and progress of long running operations
+    @file control.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Thrown out of an operation stopped through its ScanControl
+*/
+class Cancelled : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class DeadlineExceeded : public Cancelled {
+public:
+    using Cancelled::Cancelled;
+};
+
+/*
+    Shared flag requesting operations to stop; cancel() may be called from
+    any thread
+*/
+class CancellationToken {
+public:
+    void cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    bool cancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled_{false};
+};
+
+/*
+    Counters updated by running operations, safe to poll from a monitoring
+    thread at any time
+*/
+struct Progress {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> chunks{0};
+    std::atomic<uint64_t> regions{0};
+
+    void add(std::atomic<uint64_t> &counter, uint64_t n) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+/*
+    Cancellation token, deadline and progress counters of one operation.
+    Every member is optional; a default ScanControl never stops anything.
+*/
+struct ScanControl {
+    using Clock = std::chrono::steady_clock;
+
+    const CancellationToken *token = nullptr;
+    Clock::time_point deadline = Clock::time_point::max();
+    Progress *progress = nullptr;
+
+    /*
+        Throws Cancelled or DeadlineExceeded if the operation should stop
+    */
+    void check() const {
+        if (token != nullptr && token->cancelled()) {
+            throw Cancelled("ScanControl: cancelled");
+        }
+        if (deadline != Clock::time_point::max() && Clock::now() > deadline) {
+            throw DeadlineExceeded("ScanControl: deadline exceeded");
+        }
+    }
+
+    void addBytes(uint64_t n) const {
+        if (progress != nullptr) {
+            progress->add(progress->bytes, n);
+        }
+    }
+
+    void addChunks(uint64_t n) const {
+        if (progress != nullptr) {
+            progress->add(progress->chunks, n);
+        }
+    }
+
+    void addRegions(uint64_t n) const {
+        if (progress != nullptr) {
+            progress->add(progress->regions, n);
+        }
+    }
+};
+
+/*
+    BufferStream checking a ScanControl at the checkpoints of list decoding.
+    It also counts the tags it decodes, from the list lengths and compound
+    sizes reported by the decoder.
+*/
+class ControlledStream : public BufferStream {
+public:
+    ControlledStream(const char *data, size_t size,
+                     const ScanControl *control)
+        : BufferStream(data, size), control_(control) {
+    }
+
+    bool decodeList(TagType elemType, int32_t length,
+                    std::vector<std::unique_ptr<Tag>> &out) override {
+        (void)elemType;
+        (void)out;
+        tags_ += static_cast<uint64_t>(length);
+        return false;
+    }
+
+    void recordCompoundSize(size_t slot, size_t entries) override {
+        (void)slot;
+        tags_ += entries;
+    }
+
+    void checkpoint() override {
+        if (control_ != nullptr) {
+            control_->check();
+        }
+    }
+
+    /*
+        Returns the number of tags decoded so far, not counting the roots
+    */
+    uint64_t tags() const {
+        return tags_;
+    }
+
+private:
+    const ScanControl *control_;
+    uint64_t tags_ = 0;
+};
+
+/*
+    Returns the root Tag of a document held in memory, stopping within
+    large lists once control says so
+    @param data the document
+    @param size size of the document in bytes
+    @param control the cancellation token and deadline to honor
+    @return the unique pointer of Tag
+*/
+inline std::unique_ptr<Tag> readDocument(const char *data, size_t size,
+                                         const ScanControl &control) {
+    control.check();
+    ControlledStream stream(data, size, &control);
+    auto doc = readDocument(stream);
+    control.addBytes(size);
+    return doc;
+}
+
+
+}  // namespace nbt
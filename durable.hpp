@@ -0,0 +1,79 @@
+/**
+    Crash safe file updates
+    @file durable.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+
+namespace nbt {
+
+
+/*
+    Waits until the entries of a directory are on disk, so that files
+    created or renamed in it survive a crash
+*/
+inline void syncDirectory(const std::string &dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "syncDirectory: " + dir);
+    }
+    if (::fsync(fd) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(),
+                                "syncDirectory: " + dir);
+    }
+    ::close(fd);
+}
+
+/*
+    Replaces a file with new contents. The bytes go to a temporary file
+    that is synced and renamed over the old one, then the directory is
+    synced, so after a crash the file holds either version, never a mix
+    or nothing.
+*/
+inline void replaceFile(const std::string &path, std::string_view bytes) {
+    const auto tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "replaceFile: " + tmp);
+    }
+    size_t done = 0;
+    while (done < bytes.size()) {
+        auto n = ::write(fd, bytes.data() + done, bytes.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    if (done < bytes.size() || ::fsync(fd) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(),
+                                "replaceFile: " + tmp);
+    }
+    ::close(fd);
+    std::filesystem::rename(tmp, path);
+    const auto dir = std::filesystem::path(path).parent_path();
+    syncDirectory(dir.empty() ? "." : dir.string());
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,326 @@
+/**
+    Scatter-gather NBT Writer
+    @file gather.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <system_error>
+#include <unordered_map>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Encodes a document into an iovec list instead of one contiguous buffer.
+    Headers and small values go to a scratch buffer; array payloads at least
+    inlineLimit bytes long are referenced in place when their in-memory
+    layout is already big endian. On little endian hosts that holds only
+    for byte arrays: int and long arrays are swapped into the scratch
+    buffer, unless the caller registered a big endian copy of their payload
+    with setBigEndian, such as one kept next to a chunk that is sent often.
+
+    Referenced arrays and registered payloads must outlive the iovec list.
+*/
+class GatherEncoder {
+public:
+    explicit GatherEncoder(size_t inlineLimit = 4096)
+        : inlineLimit_(inlineLimit) {
+    }
+
+    /*
+        Encodes the Tag as the root of a document, replacing any previous
+        content
+        @param doc the root Tag
+    */
+    void encode(const Tag &doc) {
+        clear();
+        putType(doc.getTagType());
+        putString(doc.getName().value_or(""));
+        encodePayload(doc);
+    }
+
+    void clear() {
+        scratch_.clear();
+        segments_.clear();
+    }
+
+    /*
+        Registers the payload of an int or long array already in big endian
+        order, referenced in place by the following encodes instead of
+        swapping the array. Registrations last until forgetBigEndian.
+        @param tag the array Tag, whose address identifies it
+        @param payload tag.getValue().size() elements in big endian order,
+               see toBigEndian
+    */
+    template <typename T, TagType tt>
+    void setBigEndian(const TagArray<T, tt> &tag, const T *payload) {
+        bigEndian_[&tag] = {reinterpret_cast<const char *>(payload),
+                            tag.getValue().size()};
+    }
+
+    void forgetBigEndian() {
+        bigEndian_.clear();
+    }
+
+    /*
+        Returns the iovec list of the encoded document, valid until the next
+        call to encode or clear
+    */
+    std::vector<iovec> iovecs() const {
+        std::vector<iovec> out;
+        out.reserve(segments_.size());
+        for (const auto &seg : segments_) {
+            auto base = seg.ptr ? seg.ptr : scratch_.data() + seg.offset;
+            out.push_back({const_cast<char *>(base), seg.len});
+        }
+        return out;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto &seg : segments_) {
+            total += seg.len;
+        }
+        return total;
+    }
+
+private:
+    struct Segment {
+        const char *ptr;
+        size_t offset;
+        size_t len;
+    };
+
+    struct Payload {
+        const char *data;
+        size_t count;
+    };
+
+    void appendScratch(const char *data, size_t len) {
+        if (segments_.empty() || segments_.back().ptr != nullptr) {
+            segments_.push_back({nullptr, scratch_.size(), 0});
+        }
+        scratch_.append(data, len);
+        segments_.back().len += len;
+    }
+
+    /*
+        Returns space for len bytes at the end of the scratch buffer
+    */
+    char *growScratch(size_t len) {
+        if (segments_.empty() || segments_.back().ptr != nullptr) {
+            segments_.push_back({nullptr, scratch_.size(), 0});
+        }
+        const size_t offset = scratch_.size();
+        scratch_.resize(offset + len);
+        segments_.back().len += len;
+        return scratch_.data() + offset;
+    }
+
+    void appendExternal(const char *data, size_t len) {
+        segments_.push_back({data, 0, len});
+    }
+
+    template <typename T>
+    void put(const T &val) {
+        T tmp = endian::refineBigEndian<T>(val);
+        appendScratch(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
+    }
+
+    void putString(const std::string &val) {
+        if (val.size() > UINT16_MAX) {
+            throw std::length_error(
+                "GatherEncoder::encode: string longer than 65535 bytes");
+        }
+        put<uint16_t>(static_cast<uint16_t>(val.size()));
+        appendScratch(val.data(), val.size());
+    }
+
+    void putType(TagType val) {
+        put<uint8_t>(static_cast<uint8_t>(val));
+    }
+
+    template <typename T, TagType tt>
+    void putArray(const TagArray<T, tt> &tag) {
+        const auto &val = tag.getValue();
+        put<int32_t>(static_cast<int32_t>(val.size()));
+        const size_t bytes = val.size() * sizeof(T);
+        auto data = reinterpret_cast<const char *>(val.data());
+        auto registered = bigEndian_.find(&tag);
+        if (registered != bigEndian_.end()) {
+            if (registered->second.count != val.size()) {
+                throw std::logic_error(
+                    "GatherEncoder::encode: array changed since setBigEndian");
+            }
+            data = registered->second.data;
+        }
+        if (sizeof(T) == 1 || !endian::isHostLittleEndian() ||
+            registered != bigEndian_.end()) {
+            if (bytes >= inlineLimit_) {
+                appendExternal(data, bytes);
+            } else {
+                appendScratch(data, bytes);
+            }
+            return;
+        }
+        // Swapped in one pass into a block of the scratch buffer, which
+        // stays a single segment with the headers around it
+        char *out = growScratch(bytes);
+        for (size_t i = 0; i < val.size(); ++i) {
+            const T tmp = endian::refineBigEndian<T>(val[i]);
+            std::memcpy(out + i * sizeof(T), &tmp, sizeof(T));
+        }
+    }
+
+    void encodePayload(const Tag &tag) {
+        switch (tag.getTagType()) {
+        case TagType::TAG_BYTE:
+            put<int8_t>(static_cast<const TagByte &>(tag).getValue());
+            break;
+        case TagType::TAG_SHORT:
+            put<int16_t>(static_cast<const TagShort &>(tag).getValue());
+            break;
+        case TagType::TAG_INT:
+            put<int32_t>(static_cast<const TagInt &>(tag).getValue());
+            break;
+        case TagType::TAG_LONG:
+            put<int64_t>(static_cast<const TagLong &>(tag).getValue());
+            break;
+        case TagType::TAG_FLOAT:
+            put<float>(static_cast<const TagFloat &>(tag).getValue());
+            break;
+        case TagType::TAG_DOUBLE:
+            put<double>(static_cast<const TagDouble &>(tag).getValue());
+            break;
+        case TagType::TAG_STRING:
+            putString(static_cast<const TagString &>(tag).getValue());
+            break;
+        case TagType::TAG_BYTE_ARRAY:
+            putArray(static_cast<const TagByteArray &>(tag));
+            break;
+        case TagType::TAG_INT_ARRAY:
+            putArray(static_cast<const TagIntArray &>(tag));
+            break;
+        case TagType::TAG_LONG_ARRAY:
+            putArray(static_cast<const TagLongArray &>(tag));
+            break;
+        case TagType::TAG_LIST: {
+            const auto &list = static_cast<const TagList &>(tag);
+            putType(list.getElementType());
+            put<int32_t>(static_cast<int32_t>(list.getValue().size()));
+            for (const auto &elem : list.getValue()) {
+                encodePayload(*elem);
+            }
+            break;
+        }
+        case TagType::TAG_COMPOUND:
+            for (const auto &it :
+                 static_cast<const TagCompound &>(tag).getValue()) {
+                putType(it.second->getTagType());
+                putString(it.first);
+                encodePayload(*it.second);
+            }
+            putType(TagType::TAG_END);
+            break;
+        default:
+            throw std::runtime_error(
+                "GatherEncoder::encode: TagType " +
+                std::to_string(static_cast<int>(tag.getTagType())) +
+                " not found");
+        }
+    }
+
+private:
+    size_t inlineLimit_;
+    std::string scratch_;
+    std::vector<Segment> segments_;
+    std::unordered_map<const Tag *, Payload> bigEndian_;
+};
+
+/*
+    Returns a copy of array elements in big endian order, for
+    GatherEncoder::setBigEndian
+*/
+template <typename T>
+std::vector<T> toBigEndian(const std::vector<T> &val) {
+    std::vector<T> out(val.size());
+    std::transform(val.begin(), val.end(), out.begin(),
+                   endian::refineBigEndian<T>);
+    return out;
+}
+
+/*
+    Submits the whole iovec list, resuming after partial writes
+    @param submit called with (iov, iovcnt), returns like writev
+*/
+template <typename Submit>
+void submitIovecs(std::vector<iovec> iov, Submit submit) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        auto count = std::min<size_t>(iov.size() - first, IOV_MAX);
+        auto written = submit(iov.data() + first, static_cast<int>(count));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "submitIovecs");
+        }
+        auto left = static_cast<size_t>(written);
+        while (first < iov.size() && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            ++first;
+        }
+        if (left > 0) {
+            auto base = static_cast<char *>(iov[first].iov_base);
+            iov[first].iov_base = base + left;
+            iov[first].iov_len -= left;
+        }
+    }
+}
+
+/*
+    Writes the Tag as the root of a document to a file descriptor with
+    writev, without flattening large arrays into one buffer
+    @param fd the file descriptor
+    @param doc the root Tag
+*/
+inline void writeDocument(int fd, const Tag &doc) {
+    GatherEncoder enc;
+    enc.encode(doc);
+    submitIovecs(enc.iovecs(), [fd](iovec *iov, int count) {
+        return ::writev(fd, iov, count);
+    });
+}
+
+/*
+    Sends the Tag as the root of a document over a socket with sendmsg
+    @param sock the socket
+    @param doc the root Tag
+    @param flags flags of sendmsg, MSG_NOSIGNAL is always added
+*/
+inline void sendDocument(int sock, const Tag &doc, int flags = 0) {
+    GatherEncoder enc;
+    enc.encode(doc);
+    submitIovecs(enc.iovecs(), [sock, flags](iovec *iov, int count) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        return ::sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+    });
+}
+
+
+}  // namespace nbt
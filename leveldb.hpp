@@ -0,0 +1,619 @@
+/**
+    Read-only LevelDB reader
+    @file leveldb.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+
+#include "compression.hpp"
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+namespace leveldb {
+
+
+enum class ValueType : uint8_t { DELETION = 0, VALUE = 1 };
+
+/*
+    Block compression ids, including the zlib variants of Mojang's fork
+*/
+enum class BlockCompression : uint8_t {
+    NONE = 0,
+    SNAPPY = 1,
+    ZLIB = 2,
+    ZLIB_RAW = 4,
+};
+
+/*
+    Returns the CRC-32C (Castagnoli) of a buffer
+*/
+inline uint32_t crc32c(const char *data, size_t size, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/*
+    Returns the CRC as stored by LevelDB, masked so that CRCs of data
+    holding CRCs stay well distributed
+*/
+inline uint32_t maskedCrc(uint32_t crc) {
+    return ((crc >> 15) | (crc << 17)) + 0xa282ead8u;
+}
+
+template <typename T>
+T readLittle(const char *p) {
+    T val;
+    std::memcpy(&val, p, sizeof(val));
+    return endian::isHostLittleEndian() ? val : endian::swapEndian(val);
+}
+
+inline uint64_t readVarint(const char *&p, const char *end) {
+    uint64_t val = 0;
+    for (int shift = 0; shift <= 63; shift += 7) {
+        if (p == end) {
+            break;
+        }
+        auto byte = static_cast<uint8_t>(*p++);
+        val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return val;
+        }
+    }
+    throw std::runtime_error("leveldb: malformed varint");
+}
+
+inline std::string_view readSlice(const char *&p, const char *end) {
+    auto len = readVarint(p, end);
+    if (static_cast<uint64_t>(end - p) < len) {
+        throw std::runtime_error("leveldb: slice out of bounds");
+    }
+    std::string_view slice(p, len);
+    p += len;
+    return slice;
+}
+
+inline std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::system_error(errno, std::generic_category(),
+                                "leveldb: " + path);
+    }
+    return std::string((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+}
+
+/*
+    Calls fn(std::string_view record) for every intact record of a file in
+    the LevelDB log format (write-ahead logs and the MANIFEST). Reading
+    stops at the first torn or corrupted record, as after a crash.
+*/
+template <typename Fn>
+void forEachLogRecord(const std::string &data, Fn fn) {
+    constexpr size_t BLOCK = 32768;
+    constexpr size_t HEADER = 7;
+    enum : uint8_t { ZERO = 0, FULL = 1, FIRST = 2, MIDDLE = 3, LAST = 4 };
+
+    std::string pending;
+    bool inRecord = false;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        const size_t left = BLOCK - pos % BLOCK;
+        if (left < HEADER) {
+            pos += left;
+            continue;
+        }
+        if (data.size() - pos < HEADER) {
+            return;
+        }
+        const char *header = data.data() + pos;
+        const auto crc = readLittle<uint32_t>(header);
+        const auto length = readLittle<uint16_t>(header + 4);
+        const auto type = static_cast<uint8_t>(header[6]);
+        if (type == ZERO && length == 0) {
+            pos += left;
+            continue;
+        }
+        if (HEADER + length > left || data.size() - pos < HEADER + length ||
+            maskedCrc(crc32c(header + 6, 1 + length)) != crc) {
+            return;
+        }
+        std::string_view payload(header + HEADER, length);
+        pos += HEADER + length;
+        switch (type) {
+        case FULL:
+            inRecord = false;
+            fn(payload);
+            break;
+        case FIRST:
+            pending.assign(payload);
+            inRecord = true;
+            break;
+        case MIDDLE:
+            if (inRecord) {
+                pending.append(payload);
+            }
+            break;
+        case LAST:
+            if (inRecord) {
+                pending.append(payload);
+                fn(std::string_view(pending));
+            }
+            inRecord = false;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+/*
+    Calls fn(key, sequence, ValueType, value) for every entry of the write
+    batches held in a write-ahead log
+*/
+template <typename Fn>
+void forEachLogEntry(const std::string &data, Fn fn) {
+    forEachLogRecord(data, [&](std::string_view batch) {
+        if (batch.size() < 12) {
+            throw std::runtime_error("leveldb: short write batch");
+        }
+        auto seq = readLittle<uint64_t>(batch.data());
+        const auto count = readLittle<uint32_t>(batch.data() + 8);
+        const char *p = batch.data() + 12;
+        const char *end = batch.data() + batch.size();
+        for (uint32_t i = 0; i < count; ++i, ++seq) {
+            if (p == end) {
+                throw std::runtime_error("leveldb: truncated write batch");
+            }
+            auto type = static_cast<ValueType>(*p++);
+            auto key = readSlice(p, end);
+            if (type == ValueType::VALUE) {
+                fn(key, seq, type, readSlice(p, end));
+            } else if (type == ValueType::DELETION) {
+                fn(key, seq, type, std::string_view());
+            } else {
+                throw std::runtime_error("leveldb: unknown batch entry");
+            }
+        }
+    });
+}
+
+/*
+    Sorted string table (.ldb / .sst), loaded in memory
+*/
+class Table {
+public:
+    static constexpr uint64_t MAGIC = 0xdb4775248b80fb57ull;
+    static constexpr size_t FOOTER = 48;
+
+    explicit Table(const std::string &path) : data_(readFile(path)) {
+        if (data_.size() < FOOTER ||
+            readLittle<uint64_t>(data_.data() + data_.size() - 8) != MAGIC) {
+            throw std::runtime_error("leveldb: " + path + " is not a table");
+        }
+        const char *p = data_.data() + data_.size() - FOOTER;
+        const char *end = data_.data() + data_.size() - 8;
+        readVarint(p, end);
+        readVarint(p, end);
+        indexOffset_ = readVarint(p, end);
+        indexSize_ = readVarint(p, end);
+    }
+
+    /*
+        Calls fn(key, sequence, ValueType, value) for every entry, in key
+        order
+    */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        auto index = block(indexOffset_, indexSize_);
+        forEachInBlock(index, [&](std::string_view, std::string_view handle) {
+            const char *p = handle.data();
+            const char *end = p + handle.size();
+            auto offset = readVarint(p, end);
+            auto size = readVarint(p, end);
+            auto contents = block(offset, size);
+            forEachInBlock(contents, [&](std::string_view internal,
+                                         std::string_view value) {
+                if (internal.size() < 8) {
+                    throw std::runtime_error("leveldb: short internal key");
+                }
+                const auto trailer = readLittle<uint64_t>(
+                    internal.data() + internal.size() - 8);
+                fn(internal.substr(0, internal.size() - 8), trailer >> 8,
+                   static_cast<ValueType>(trailer & 0xff), value);
+            });
+        });
+    }
+
+private:
+    std::string block(uint64_t offset, uint64_t size) const {
+        // Compared without adding, a corrupt size must not wrap around
+        if (offset > data_.size() || data_.size() - offset < 5 ||
+            size > data_.size() - offset - 5) {
+            throw std::runtime_error("leveldb: block out of table");
+        }
+        const char *p = data_.data() + offset;
+        const auto crc = readLittle<uint32_t>(p + size + 1);
+        if (maskedCrc(crc32c(p, size + 1)) != crc) {
+            throw std::runtime_error("leveldb: block checksum mismatch");
+        }
+        switch (static_cast<BlockCompression>(p[size])) {
+        case BlockCompression::NONE:
+            return std::string(p, size);
+        case BlockCompression::SNAPPY:
+            return snappyUncompress(p, size);
+        case BlockCompression::ZLIB:
+            return inflateBuffer(p, size);
+        case BlockCompression::ZLIB_RAW:
+            return inflateBuffer(p, size, -15);
+        default:
+            throw std::runtime_error(
+                "leveldb: block compression " +
+                std::to_string(static_cast<int>(p[size])) + " not supported");
+        }
+    }
+
+    template <typename Fn>
+    static void forEachInBlock(const std::string &block, Fn fn) {
+        if (block.size() < 4) {
+            throw std::runtime_error("leveldb: short block");
+        }
+        const auto restarts =
+            readLittle<uint32_t>(block.data() + block.size() - 4);
+        if ((block.size() - 4) / 4 < restarts) {
+            throw std::runtime_error("leveldb: malformed block");
+        }
+        const char *p = block.data();
+        const char *end = block.data() + block.size() - 4 - 4 * restarts;
+        std::string key;
+        while (p < end) {
+            auto shared = readVarint(p, end);
+            auto unshared = readVarint(p, end);
+            auto valueSize = readVarint(p, end);
+            const auto left = static_cast<uint64_t>(end - p);
+            if (shared > key.size() || unshared > left ||
+                valueSize > left - unshared) {
+                throw std::runtime_error("leveldb: malformed block entry");
+            }
+            key.resize(shared);
+            key.append(p, unshared);
+            p += unshared;
+            fn(std::string_view(key), std::string_view(p, valueSize));
+            p += valueSize;
+        }
+    }
+
+private:
+    std::string data_;
+    uint64_t indexOffset_ = 0;
+    uint64_t indexSize_ = 0;
+};
+
+/*
+    Read-only view of a LevelDB database directory. The live tables and
+    logs are taken from the MANIFEST named by CURRENT; without one, every
+    table and log of the directory is read. Each table or log is a
+    source; the newest sequence number of a key wins across sources.
+*/
+class Database {
+public:
+    explicit Database(const std::string &dir) : dir_(dir) {
+        const auto current = std::filesystem::path(dir) / "CURRENT";
+        if (std::filesystem::exists(current)) {
+            std::string manifest;
+            std::ifstream(current) >> manifest;
+            readManifest((std::filesystem::path(dir) / manifest).string());
+        } else {
+            listDirectory();
+        }
+    }
+
+    /*
+        Returns the paths of the live tables followed by the live logs,
+        oldest first
+    */
+    const std::vector<std::string> &sources() const {
+        return sources_;
+    }
+
+    /*
+        Calls fn(key, sequence, ValueType, value) for every entry of one
+        source, including overwritten and deleted versions
+    */
+    template <typename Fn>
+    void forEachIn(size_t source, Fn fn) const {
+        const auto &path = sources_.at(source);
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".log") == 0) {
+            forEachLogEntry(readFile(path), fn);
+        } else {
+            Table(path).forEach(fn);
+        }
+    }
+
+    /*
+        Calls fn(key, value) for the live version of every key, in no
+        particular order. This takes two passes over the sources: the first
+        resolves the newest version of every key, the second hands out the
+        live values, so every block is read and decompressed twice in
+        exchange for memory bounded by the keys instead of the values.
+    */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        auto latest = resolve();
+        for (size_t s = 0; s < sources_.size(); ++s) {
+            forEachIn(s, [&](std::string_view key, uint64_t seq,
+                             ValueType type, std::string_view value) {
+                if (type == ValueType::VALUE &&
+                    isLatest(latest, key, s, seq)) {
+                    fn(key, value);
+                }
+            });
+        }
+    }
+
+    struct Version {
+        uint64_t sequence;
+        uint32_t source;
+        bool deleted;
+    };
+
+    /*
+        Newest Version of each key. Key bytes are copied once into chunks
+        owned by the map and looked up as string_views, so lookups do not
+        allocate and merging moves chunks instead of keys.
+    */
+    class Versions {
+    public:
+        static constexpr size_t CHUNK = 64 << 10;
+
+        /*
+            Records a version of a key, kept if it is the newest
+        */
+        void add(std::string_view key, const Version &v) {
+            auto it = map_.find(key);
+            if (it == map_.end()) {
+                map_.emplace(store(key), v);
+            } else if (it->second.sequence < v.sequence) {
+                it->second = v;
+            }
+        }
+
+        /*
+            Folds the versions of another map into this one
+        */
+        void merge(Versions &&other) {
+            if (map_.empty()) {
+                *this = std::move(other);
+                return;
+            }
+            for (const auto &it : other.map_) {
+                auto slot = map_.try_emplace(it.first, it.second).first;
+                if (slot->second.sequence < it.second.sequence) {
+                    slot->second = it.second;
+                }
+            }
+            // Keys taken from other still point into its chunks
+            for (auto &chunk : other.chunks_) {
+                chunks_.push_back(std::move(chunk));
+            }
+            other.map_.clear();
+            other.chunks_.clear();
+        }
+
+        /*
+            Returns the newest version of a key, nullptr if absent
+        */
+        const Version *find(std::string_view key) const {
+            auto it = map_.find(key);
+            return it == map_.end() ? nullptr : &it->second;
+        }
+
+        size_t size() const {
+            return map_.size();
+        }
+
+    private:
+        std::string_view store(std::string_view key) {
+            if (key.size() > free_) {
+                const size_t size = std::max(CHUNK, key.size());
+                chunks_.push_back(std::make_unique<char[]>(size));
+                next_ = chunks_.back().get();
+                free_ = size;
+            }
+            std::memcpy(next_, key.data(), key.size());
+            std::string_view stored(next_, key.size());
+            next_ += key.size();
+            free_ -= key.size();
+            return stored;
+        }
+
+    private:
+        std::unordered_map<std::string_view, Version> map_;
+        std::vector<std::unique_ptr<char[]>> chunks_;
+        char *next_ = nullptr;
+        size_t free_ = 0;
+    };
+
+    /*
+        Returns the newest version of every key found in one source
+    */
+    Versions versionsIn(size_t source) const {
+        Versions out;
+        forEachIn(source, [&](std::string_view key, uint64_t seq,
+                              ValueType type, std::string_view) {
+            out.add(key, Version{seq, static_cast<uint32_t>(source),
+                                 type == ValueType::DELETION});
+        });
+        return out;
+    }
+
+    /*
+        Folds the versions of one source into the versions of others
+    */
+    static void mergeVersions(Versions &into, Versions &&from) {
+        into.merge(std::move(from));
+    }
+
+    /*
+        Returns the newest version of every key across all sources
+    */
+    Versions resolve() const {
+        Versions out;
+        for (size_t s = 0; s < sources_.size(); ++s) {
+            out.merge(versionsIn(s));
+        }
+        return out;
+    }
+
+    /*
+        Returns true if the entry is the live value of its key
+    */
+    static bool isLatest(const Versions &latest, std::string_view key,
+                         size_t source, uint64_t seq) {
+        const auto *v = latest.find(key);
+        return v != nullptr && !v->deleted && v->source == source &&
+               v->sequence == seq;
+    }
+
+private:
+    enum ManifestTag : uint64_t {
+        COMPARATOR = 1,
+        LOG_NUMBER = 2,
+        NEXT_FILE_NUMBER = 3,
+        LAST_SEQUENCE = 4,
+        COMPACT_POINTER = 5,
+        DELETED_FILE = 6,
+        NEW_FILE = 7,
+        PREV_LOG_NUMBER = 9,
+    };
+
+    std::string fileName(uint64_t number, const char *ext) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%06llu.%s",
+                      static_cast<unsigned long long>(number), ext);
+        return (std::filesystem::path(dir_) / name).string();
+    }
+
+    void readManifest(const std::string &path) {
+        std::set<uint64_t> tables;
+        uint64_t logNumber = 0;
+        uint64_t prevLogNumber = 0;
+        forEachLogRecord(readFile(path), [&](std::string_view edit) {
+            const char *p = edit.data();
+            const char *end = p + edit.size();
+            while (p < end) {
+                switch (readVarint(p, end)) {
+                case COMPARATOR:
+                    readSlice(p, end);
+                    break;
+                case LOG_NUMBER:
+                    logNumber = readVarint(p, end);
+                    break;
+                case PREV_LOG_NUMBER:
+                    prevLogNumber = readVarint(p, end);
+                    break;
+                case NEXT_FILE_NUMBER:
+                case LAST_SEQUENCE:
+                    readVarint(p, end);
+                    break;
+                case COMPACT_POINTER:
+                    readVarint(p, end);
+                    readSlice(p, end);
+                    break;
+                case DELETED_FILE:
+                    readVarint(p, end);
+                    tables.erase(readVarint(p, end));
+                    break;
+                case NEW_FILE:
+                    readVarint(p, end);
+                    tables.insert(readVarint(p, end));
+                    readVarint(p, end);
+                    readSlice(p, end);
+                    readSlice(p, end);
+                    break;
+                default:
+                    throw std::runtime_error("leveldb: " + path +
+                                             " has an unknown edit");
+                }
+            }
+        });
+        for (auto number : tables) {
+            auto ldb = fileName(number, "ldb");
+            sources_.push_back(std::filesystem::exists(ldb)
+                                   ? ldb
+                                   : fileName(number, "sst"));
+        }
+        std::set<uint64_t> logs;
+        for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+            const auto name = entry.path().filename().string();
+            unsigned long long number = 0;
+            char tail = 0;
+            if (std::sscanf(name.c_str(), "%llu.lo%c", &number, &tail) == 2 &&
+                tail == 'g' &&
+                (number >= logNumber ||
+                 (prevLogNumber != 0 && number == prevLogNumber))) {
+                logs.insert(number);
+            }
+        }
+        for (auto number : logs) {
+            sources_.push_back(fileName(number, "log"));
+        }
+    }
+
+    void listDirectory() {
+        std::vector<std::string> tables;
+        std::vector<std::string> logs;
+        for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+            const auto ext = entry.path().extension().string();
+            if (ext == ".ldb" || ext == ".sst") {
+                tables.push_back(entry.path().string());
+            } else if (ext == ".log") {
+                logs.push_back(entry.path().string());
+            }
+        }
+        std::sort(tables.begin(), tables.end());
+        std::sort(logs.begin(), logs.end());
+        sources_ = std::move(tables);
+        sources_.insert(sources_.end(), logs.begin(), logs.end());
+    }
+
+private:
+    std::string dir_;
+    std::vector<std::string> sources_;
+};
+
+
+}  // namespace leveldb
+
+
+}  // namespace nbt
@@ -0,0 +1,24 @@
+/**
+    Public header of the compiled libnbt
+    @file libnbt.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+/*
+    Same API as nbt.hpp, but the decoder core is compiled into libnbt.a /
+    libnbt.so: the tag templates and makeTag are declared extern, and
+    skipPayload, readDocument and the list and compound decoders are only
+    declared, so including TUs neither recompile nor duplicate them.
+    Include it before any other header of the library.
+*/
+#if defined(NBT_OUT_OF_LINE) && !defined(NBT_LIBRARY)
+#error "libnbt.hpp: included after nbt.hpp was included header only"
+#endif
+
+#ifndef NBT_LIBRARY
+#define NBT_LIBRARY
+#endif
+
+#include "nbt.hpp"
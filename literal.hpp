@@ -0,0 +1,572 @@
+/**
+    Compile-time NBT literals
+    @file literal.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+namespace literal {
+
+
+/*
+    A document serialized at compile time. bytes holds exactly what
+    readDocument expects, so it can be copied straight into a buffer.
+*/
+template <size_t N>
+struct Literal {
+    std::array<uint8_t, N> bytes{};
+
+    constexpr const uint8_t *data() const {
+        return bytes.data();
+    }
+
+    constexpr size_t size() const {
+        return N;
+    }
+
+    std::string_view view() const {
+        return std::string_view(reinterpret_cast<const char *>(bytes.data()),
+                                N);
+    }
+};
+
+/*
+    Sink of the sizing pass, only tracks the output position
+*/
+class CountSink {
+public:
+    constexpr void put(uint8_t) {
+        ++pos_;
+    }
+
+    constexpr void patch(size_t, uint8_t) {
+    }
+
+    constexpr size_t position() const {
+        return pos_;
+    }
+
+private:
+    size_t pos_ = 0;
+};
+
+/*
+    Sink of the emitting pass, writes into the final array
+*/
+template <size_t N>
+class ArraySink {
+public:
+    constexpr explicit ArraySink(std::array<uint8_t, N> &out) : out_(out) {
+    }
+
+    constexpr void put(uint8_t u) {
+        out_[pos_++] = u;
+    }
+
+    constexpr void patch(size_t pos, uint8_t u) {
+        out_[pos] = u;
+    }
+
+    constexpr size_t position() const {
+        return pos_;
+    }
+
+private:
+    std::array<uint8_t, N> &out_;
+    size_t pos_ = 0;
+};
+
+/*
+    Returns the IEEE 754 bit pattern of a finite value
+    @param v the magnitude, exactly representable with MBITS mantissa bits
+    @param negative whether the sign bit is set
+    @return the raw bits, sign in the highest bit of the field
+*/
+template <int MBITS, int EBITS>
+constexpr uint64_t ieeeBits(double v, bool negative) {
+    constexpr int bias = (1 << (EBITS - 1)) - 1;
+    const uint64_t sign = negative ? 1 : 0;
+    uint64_t exponent = 0;
+    double fraction = 0;
+    if (v != 0) {
+        int e = 0;
+        while (v >= 2) {
+            v /= 2;
+            ++e;
+        }
+        while (v < 1 && e > 1 - bias) {
+            v *= 2;
+            --e;
+        }
+        if (v < 1) {
+            fraction = v;
+        } else {
+            exponent = static_cast<uint64_t>(e + bias);
+            fraction = v - 1;
+        }
+    }
+    for (int i = 0; i < MBITS; ++i) {
+        fraction *= 2;
+    }
+    return (sign << (MBITS + EBITS)) | (exponent << MBITS) |
+           static_cast<uint64_t>(fraction);
+}
+
+/*
+    Constant expression SNBT compiler. Sink decides whether the pass only
+    sizes the document or writes it, so both passes share one grammar.
+*/
+template <typename Sink>
+class Compiler {
+public:
+    constexpr Compiler(std::string_view text, Sink sink)
+        : text_(text), sink_(sink) {
+    }
+
+    constexpr size_t run() {
+        if (peek() != '{') {
+            fail("document should be a compound");
+        }
+        sink_.put(static_cast<uint8_t>(TagType::TAG_COMPOUND));
+        putInt<uint16_t>(0);
+        value();
+        skipSpace();
+        if (cur_ != text_.size()) {
+            fail("trailing characters");
+        }
+        return sink_.position();
+    }
+
+private:
+    static constexpr void fail(const char *what) {
+        if (what != nullptr) {
+            throw std::logic_error(what);
+        }
+    }
+
+    static constexpr bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+    }
+
+    static constexpr bool isUnquoted(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+               (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.' ||
+               c == '+';
+    }
+
+    constexpr void skipSpace() {
+        while (cur_ < text_.size() && isSpace(text_[cur_])) {
+            ++cur_;
+        }
+    }
+
+    constexpr char peek() {
+        skipSpace();
+        if (cur_ == text_.size()) {
+            fail("unexpected end of input");
+        }
+        return text_[cur_];
+    }
+
+    constexpr void expect(char c) {
+        if (peek() != c) {
+            fail("unexpected character");
+        }
+        ++cur_;
+    }
+
+    template <typename T>
+    constexpr void putInt(T v) {
+        auto u = static_cast<uint64_t>(v);
+        for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+            sink_.put(static_cast<uint8_t>(u >> shift));
+        }
+    }
+
+    constexpr void patchInt(size_t pos, uint64_t u, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            sink_.patch(pos + i,
+                        static_cast<uint8_t>(u >> ((bytes - 1 - i) * 8)));
+        }
+    }
+
+    constexpr std::string_view scanUnquoted() {
+        auto start = cur_;
+        while (cur_ < text_.size() && isUnquoted(text_[cur_])) {
+            ++cur_;
+        }
+        if (start == cur_) {
+            fail("expected value");
+        }
+        return text_.substr(start, cur_ - start);
+    }
+
+    /*
+        Writes a length prefixed string, the prefix is patched once the
+        (possibly escaped) content has been emitted
+    */
+    constexpr void string() {
+        auto lenPos = sink_.position();
+        putInt<uint16_t>(0);
+        uint64_t len = 0;
+        if (peek() == '"' || text_[cur_] == '\'') {
+            const char quote = text_[cur_++];
+            while (true) {
+                if (cur_ == text_.size()) {
+                    fail("unterminated string");
+                }
+                char c = text_[cur_++];
+                if (c == quote) {
+                    break;
+                }
+                if (c == '\\') {
+                    if (cur_ == text_.size()) {
+                        fail("unterminated string");
+                    }
+                    c = text_[cur_++];
+                    if (c != quote && c != '\\') {
+                        fail("invalid escape sequence");
+                    }
+                }
+                sink_.put(static_cast<uint8_t>(c));
+                ++len;
+            }
+        } else {
+            for (char c : scanUnquoted()) {
+                sink_.put(static_cast<uint8_t>(c));
+                ++len;
+            }
+        }
+        if (len > UINT16_MAX) {
+            fail("string too long");
+        }
+        patchInt(lenPos, len, 2);
+    }
+
+    /*
+        Writes the payload of the next value and returns its type
+    */
+    constexpr TagType value() {
+        switch (peek()) {
+        case '{':
+            compound();
+            return TagType::TAG_COMPOUND;
+        case '[':
+            return bracket();
+        case '"':
+        case '\'':
+            string();
+            return TagType::TAG_STRING;
+        default:
+            return scalar(scanUnquoted());
+        }
+    }
+
+    constexpr void compound() {
+        ++cur_;
+        if (peek() != '}') {
+            while (true) {
+                auto typePos = sink_.position();
+                sink_.put(0);
+                string();
+                expect(':');
+                sink_.patch(typePos, static_cast<uint8_t>(value()));
+                if (peek() != ',') {
+                    break;
+                }
+                ++cur_;
+            }
+        }
+        expect('}');
+        sink_.put(static_cast<uint8_t>(TagType::TAG_END));
+    }
+
+    constexpr TagType bracket() {
+        ++cur_;
+        skipSpace();
+        if (cur_ + 1 < text_.size() && text_[cur_ + 1] == ';') {
+            const char kind = text_[cur_];
+            cur_ += 2;
+            switch (kind) {
+            case 'B':
+                array<int8_t>('b');
+                return TagType::TAG_BYTE_ARRAY;
+            case 'I':
+                array<int32_t>(0);
+                return TagType::TAG_INT_ARRAY;
+            case 'L':
+                array<int64_t>('l');
+                return TagType::TAG_LONG_ARRAY;
+            default:
+                fail("unknown array type");
+            }
+        }
+
+        auto headerPos = sink_.position();
+        putInt<uint8_t>(0);
+        putInt<int32_t>(0);
+        auto elemType = TagType::TAG_END;
+        uint64_t count = 0;
+        if (peek() != ']') {
+            while (true) {
+                auto type = value();
+                if (count != 0 && type != elemType) {
+                    fail("mixed element types in list");
+                }
+                elemType = type;
+                ++count;
+                if (peek() != ',') {
+                    break;
+                }
+                ++cur_;
+            }
+        }
+        expect(']');
+        sink_.patch(headerPos, static_cast<uint8_t>(elemType));
+        patchInt(headerPos + 1, count, 4);
+        return TagType::TAG_LIST;
+    }
+
+    template <typename T>
+    constexpr void array(char suffix) {
+        auto lenPos = sink_.position();
+        putInt<int32_t>(0);
+        uint64_t count = 0;
+        if (peek() != ']') {
+            while (true) {
+                skipSpace();
+                auto token = scanUnquoted();
+                if (suffix != 0 && (token.back() | 0x20) == suffix) {
+                    token.remove_suffix(1);
+                }
+                int64_t v = 0;
+                if (!integer(token, v)) {
+                    fail("invalid array element");
+                }
+                putInt<T>(narrow<T>(v));
+                ++count;
+                if (peek() != ',') {
+                    break;
+                }
+                ++cur_;
+            }
+        }
+        expect(']');
+        patchInt(lenPos, count, 4);
+    }
+
+    template <typename T>
+    static constexpr bool fits(int64_t v) {
+        return v >= static_cast<int64_t>(std::numeric_limits<T>::min()) &&
+               v <= static_cast<int64_t>(std::numeric_limits<T>::max());
+    }
+
+    static constexpr bool integer(std::string_view token, int64_t &out) {
+        size_t i = 0;
+        bool negative = false;
+        if (i < token.size() && (token[i] == '+' || token[i] == '-')) {
+            negative = token[i++] == '-';
+        }
+        if (i == token.size()) {
+            return false;
+        }
+        uint64_t mag = 0;
+        for (; i < token.size(); ++i) {
+            if (token[i] < '0' || token[i] > '9') {
+                return false;
+            }
+            if (mag > uint64_t(INT64_MAX) / 10) {
+                return false;
+            }
+            mag = mag * 10 + static_cast<uint64_t>(token[i] - '0');
+        }
+        if (mag > uint64_t(INT64_MAX) + (negative ? 1 : 0)) {
+            return false;
+        }
+        out = negative ? static_cast<int64_t>(0 - mag)
+                       : static_cast<int64_t>(mag);
+        return true;
+    }
+
+    /*
+        Parses a decimal number into its magnitude and sign
+    */
+    static constexpr bool decimal(std::string_view token, long double &out,
+                                  bool &negative) {
+        size_t i = 0;
+        negative = false;
+        if (i < token.size() && (token[i] == '+' || token[i] == '-')) {
+            negative = token[i++] == '-';
+        }
+        long double mant = 0;
+        int exp10 = 0;
+        bool digits = false;
+        for (; i < token.size() && token[i] >= '0' && token[i] <= '9'; ++i) {
+            mant = mant * 10 + (token[i] - '0');
+            digits = true;
+        }
+        if (i < token.size() && token[i] == '.') {
+            for (++i; i < token.size() && token[i] >= '0' && token[i] <= '9';
+                 ++i) {
+                mant = mant * 10 + (token[i] - '0');
+                --exp10;
+                digits = true;
+            }
+        }
+        if (!digits) {
+            return false;
+        }
+        if (i < token.size() && (token[i] | 0x20) == 'e') {
+            int64_t e = 0;
+            if (!integer(token.substr(i + 1), e) || e < -400 || e > 400) {
+                return false;
+            }
+            exp10 += static_cast<int>(e);
+            i = token.size();
+        }
+        if (i != token.size()) {
+            return false;
+        }
+        long double scale = 1;
+        for (int k = exp10 < 0 ? -exp10 : exp10; k > 0; --k) {
+            scale *= 10;
+        }
+        out = exp10 < 0 ? mant / scale : mant * scale;
+        return true;
+    }
+
+    /*
+        Classifies an unquoted token the same way readSNBT does, numbers
+        out of range of their type included
+    */
+    constexpr TagType scalar(std::string_view token) {
+        const char last = token.back() | 0x20;
+        auto body = token.substr(0, token.size() - 1);
+        int64_t i = 0;
+        long double d = 0;
+        bool negative = false;
+        if (last == 'b' && integer(body, i) && fits<int8_t>(i)) {
+            putInt<int8_t>(static_cast<int8_t>(i));
+            return TagType::TAG_BYTE;
+        }
+        if (last == 's' && integer(body, i) && fits<int16_t>(i)) {
+            putInt<int16_t>(static_cast<int16_t>(i));
+            return TagType::TAG_SHORT;
+        }
+        if (last == 'l' && integer(body, i)) {
+            putInt<int64_t>(i);
+            return TagType::TAG_LONG;
+        }
+        float f = 0;
+        double v = 0;
+        if (last == 'f' && decimal(body, d, negative) && round(d, f)) {
+            putInt<uint32_t>(
+                static_cast<uint32_t>(ieeeBits<23, 8>(f, negative)));
+            return TagType::TAG_FLOAT;
+        }
+        if (last == 'd' && decimal(body, d, negative) && round(d, v)) {
+            putDouble(v, negative);
+            return TagType::TAG_DOUBLE;
+        }
+        // Without a dot or an exponent a number can only be an int
+        if (token.find_first_of(".eE") == std::string_view::npos) {
+            if (integer(token, i) && fits<int32_t>(i)) {
+                putInt<int32_t>(static_cast<int32_t>(i));
+                return TagType::TAG_INT;
+            }
+        } else if (decimal(token, d, negative) && round(d, v)) {
+            putDouble(v, negative);
+            return TagType::TAG_DOUBLE;
+        }
+        if (token == "true" || token == "false") {
+            putInt<int8_t>(token == "true");
+            return TagType::TAG_BYTE;
+        }
+        auto end = cur_;
+        cur_ -= token.size();
+        string();
+        cur_ = end;
+        return TagType::TAG_STRING;
+    }
+
+    /*
+        Rounds a decimal magnitude to T, like from_chars does in readSNBT
+        @return false if it rounds to infinity
+    */
+    template <typename T>
+    static constexpr bool round(long double d, T &out) {
+        using limits = std::numeric_limits<T>;
+        if (d <= limits::max()) {
+            out = static_cast<T>(d);
+            return true;
+        }
+        // Up to half an ulp above max still rounds down to max, a tie
+        // goes to the even neighbour, infinity
+        long double halfUlp = limits::epsilon() / 2;
+        for (int e = 1; e < limits::max_exponent; ++e) {
+            halfUlp *= 2;
+        }
+        out = limits::max();
+        return d - limits::max() < halfUlp;
+    }
+
+    template <typename T>
+    static constexpr T narrow(int64_t v) {
+        if (!fits<T>(v)) {
+            fail("integer out of range");
+        }
+        return static_cast<T>(v);
+    }
+
+    constexpr void putDouble(double v, bool negative) {
+        putInt<uint64_t>(ieeeBits<52, 11>(v, negative));
+    }
+
+private:
+    std::string_view text_;
+    size_t cur_ = 0;
+    Sink sink_;
+};
+
+/*
+    Returns the serialized document of the SNBT text given by source
+    @param source a captureless lambda returning the SNBT text
+    @return the Literal holding the serialized bytes
+*/
+template <typename Source>
+constexpr auto compile(Source source) {
+    constexpr std::string_view text = source();
+    constexpr size_t size = Compiler<CountSink>(text, CountSink()).run();
+    Literal<size> lit;
+    Compiler<ArraySink<size>>(text, ArraySink<size>(lit.bytes)).run();
+    return lit;
+}
+
+
+}  // namespace literal
+
+
+}  // namespace nbt
+
+
+/*
+    Serializes an SNBT string literal at compile time, e.g.
+    constexpr auto item = NBT_LITERAL("{id:\"minecraft:stone\",Count:1b}");
+*/
+#define NBT_LITERAL(text) \
+    ::nbt::literal::compile([] { return std::string_view(text); })
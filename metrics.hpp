@@ -0,0 +1,709 @@
+/**
+    Metrics in the Prometheus text format
+    @file metrics.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+namespace metrics {
+
+
+// Counters and histograms are split in slots, one per thread up to SLOTS
+// threads, and merged on scrape
+constexpr size_t SLOTS = 64;
+
+/*
+    Returns the slot of the calling thread
+*/
+inline size_t threadSlot() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t slot =
+        next.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+    return slot;
+}
+
+inline void addDouble(std::atomic<double> &target, double value) {
+    double old = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(old, old + value,
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+/*
+    Returns a sample value in the shortest form that reads back the same
+*/
+inline std::string formatValue(double value) {
+    if (std::isnan(value)) {
+        return "NaN";
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    char text[32];
+    for (int precision = 15; precision <= 17; ++precision) {
+        std::snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (std::strtod(text, nullptr) == value) {
+            break;
+        }
+    }
+    return text;
+}
+
+inline std::string escape(const std::string &text, bool quote) {
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '"' && quote) {
+            out += "\\\"";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+inline bool validName(const std::string &name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+               c == ':';
+    });
+}
+
+
+}  // namespace metrics
+
+enum class MetricType : uint8_t { COUNTER, GAUGE, HISTOGRAM };
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/*
+    Monotonic counter. Each thread adds to its own cache line.
+*/
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        slots_[metrics::threadSlot()].value.fetch_add(
+            n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto &slot : slots_) {
+            total += slot.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Slot, metrics::SLOTS> slots_;
+};
+
+/*
+    Value that goes up and down
+*/
+class Gauge {
+public:
+    void set(double value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    void add(double value) {
+        metrics::addDouble(value_, value);
+    }
+
+    double value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> value_{0};
+};
+
+/*
+    Distribution of observed values over fixed buckets. Each thread counts
+    into its own slot.
+*/
+class Histogram {
+public:
+    /*
+        Returns bucket bounds in seconds from 100 us to 10 s
+    */
+    static std::vector<double> latencyBuckets() {
+        return {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+                0.025,  0.05,    0.1,    0.25,  0.5,    1,     2.5,
+                5,      10};
+    }
+
+    /*
+        Measures the time until its destruction
+    */
+    class Timer {
+    public:
+        explicit Timer(Histogram &histogram)
+            : histogram_(histogram), start_(Clock::now()) {
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer() {
+            histogram_.observe(
+                std::chrono::duration<double>(Clock::now() - start_).count());
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Histogram &histogram_;
+        Clock::time_point start_;
+    };
+
+    /*
+        @param bounds upper bounds of the buckets, sorted ascending. A +Inf
+               bucket is always added.
+    */
+    explicit Histogram(std::vector<double> bounds = latencyBuckets())
+        : bounds_(std::move(bounds)),
+          linesPerSlot_((bounds_.size() + Line::COUNTS) / Line::COUNTS),
+          lines_(metrics::SLOTS * linesPerSlot_) {
+        if (!std::is_sorted(bounds_.begin(), bounds_.end())) {
+            throw std::invalid_argument(
+                "Histogram: bucket bounds should be sorted");
+        }
+    }
+
+    void observe(double value) {
+        const size_t slot = metrics::threadSlot();
+        const size_t bucket = static_cast<size_t>(
+            std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+            bounds_.begin());
+        lines_[slot * linesPerSlot_ + bucket / Line::COUNTS]
+            .counts[bucket % Line::COUNTS]
+            .fetch_add(1, std::memory_order_relaxed);
+        metrics::addDouble(sums_[slot].value, value);
+    }
+
+    Timer time() {
+        return Timer(*this);
+    }
+
+    const std::vector<double> &bounds() const {
+        return bounds_;
+    }
+
+    /*
+        Returns the number of observations per bucket, not cumulative, the
+        last one being the +Inf bucket
+    */
+    std::vector<uint64_t> counts() const {
+        std::vector<uint64_t> counts(bounds_.size() + 1);
+        for (size_t slot = 0; slot < metrics::SLOTS; ++slot) {
+            const Line *lines = &lines_[slot * linesPerSlot_];
+            for (size_t b = 0; b < counts.size(); ++b) {
+                counts[b] += lines[b / Line::COUNTS]
+                                 .counts[b % Line::COUNTS]
+                                 .load(std::memory_order_relaxed);
+            }
+        }
+        return counts;
+    }
+
+    double sum() const {
+        double sum = 0;
+        for (const auto &slot : sums_) {
+            sum += slot.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    struct alignas(64) Sum {
+        std::atomic<double> value{0};
+    };
+
+    // Bucket counts of one slot start on a cache line of their own, so
+    // threads in neighbouring slots never write to the same line
+    struct alignas(64) Line {
+        static constexpr size_t COUNTS = 64 / sizeof(std::atomic<uint64_t>);
+
+        std::atomic<uint64_t> counts[COUNTS]{};
+    };
+
+    std::vector<double> bounds_;
+    size_t linesPerSlot_;
+    std::vector<Line> lines_;
+    std::array<Sum, metrics::SLOTS> sums_;
+};
+
+/*
+    Named metrics rendered in the Prometheus text exposition format.
+    Registering a name and label set again returns the metric registered
+    first, so independent components can share a registry. Metrics live as
+    long as the registry and are safe to update from any thread.
+*/
+class MetricsRegistry {
+public:
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    Counter &counter(const std::string &name, const std::string &help,
+                     const MetricLabels &labels = {}) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &series = get(name, help, MetricType::COUNTER, labels);
+        if (!series.counter) {
+            series.counter = std::make_unique<Counter>();
+        }
+        return *series.counter;
+    }
+
+    Gauge &gauge(const std::string &name, const std::string &help,
+                 const MetricLabels &labels = {}) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &series = get(name, help, MetricType::GAUGE, labels);
+        if (!series.gauge) {
+            series.gauge = std::make_unique<Gauge>();
+        }
+        return *series.gauge;
+    }
+
+    Histogram &histogram(
+        const std::string &name, const std::string &help,
+        std::vector<double> bounds = Histogram::latencyBuckets(),
+        const MetricLabels &labels = {}) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &series = get(name, help, MetricType::HISTOGRAM, labels);
+        if (!series.histogram) {
+            series.histogram = std::make_unique<Histogram>(std::move(bounds));
+        }
+        return *series.histogram;
+    }
+
+    /*
+        Registers a counter or gauge whose value is read on every scrape,
+        replacing a previous callback of the same name and labels
+        @param read called as read() -> double, with the registry locked
+    */
+    void callback(const std::string &name, const std::string &help,
+                  MetricType type, std::function<double()> read,
+                  const MetricLabels &labels = {}) {
+        if (type == MetricType::HISTOGRAM) {
+            throw std::invalid_argument(
+                "MetricsRegistry: callback of histogram " + name);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        get(name, help, type, labels).read = std::move(read);
+    }
+
+    /*
+        Returns every metric in the Prometheus text exposition format
+    */
+    std::string render() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string out;
+        for (const auto &it : families_) {
+            const auto &name = it.first;
+            const auto &family = it.second;
+            out += "# HELP " + name + " " +
+                   metrics::escape(family.help, false) + "\n";
+            out += "# TYPE " + name + " " + typeName(family.type) + "\n";
+            for (const auto &series : family.series) {
+                render(out, name, *series);
+            }
+        }
+        return out;
+    }
+
+private:
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> read;
+    };
+
+    struct Family {
+        std::string help;
+        MetricType type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    static const char *typeName(MetricType type) {
+        switch (type) {
+        case MetricType::COUNTER:
+            return "counter";
+        case MetricType::GAUGE:
+            return "gauge";
+        default:
+            return "histogram";
+        }
+    }
+
+    static std::string formatLabels(const MetricLabels &labels) {
+        std::string out;
+        for (const auto &label : labels) {
+            if (!metrics::validName(label.first)) {
+                throw std::invalid_argument(
+                    "MetricsRegistry: invalid label name " + label.first);
+            }
+            out += (out.empty() ? "" : ",") + label.first + "=\"" +
+                   metrics::escape(label.second, true) + "\"";
+        }
+        return out;
+    }
+
+    /*
+        Returns the series of a name and label set, created if new.
+        Requires mutex_ to be held.
+    */
+    Series &get(const std::string &name, const std::string &help,
+                MetricType type, const MetricLabels &labels) {
+        if (!metrics::validName(name)) {
+            throw std::invalid_argument("MetricsRegistry: invalid name " +
+                                        name);
+        }
+        const auto text = formatLabels(labels);
+        auto it = families_.find(name);
+        if (it == families_.end()) {
+            it = families_.emplace(name, Family{help, type, {}}).first;
+        } else if (it->second.type != type) {
+            throw std::invalid_argument("MetricsRegistry: " + name +
+                                        " registered with another type");
+        }
+        for (auto &series : it->second.series) {
+            if (series->labels == text) {
+                return *series;
+            }
+        }
+        it->second.series.push_back(std::make_unique<Series>());
+        it->second.series.back()->labels = text;
+        return *it->second.series.back();
+    }
+
+    static void render(std::string &out, const std::string &name,
+                       const Series &series) {
+        const auto &labels = series.labels;
+        const auto braced = labels.empty() ? "" : "{" + labels + "}";
+        if (series.histogram) {
+            const auto &bounds = series.histogram->bounds();
+            const auto counts = series.histogram->counts();
+            const auto prefix = labels.empty() ? "" : labels + ",";
+            uint64_t total = 0;
+            for (size_t i = 0; i < counts.size(); ++i) {
+                total += counts[i];
+                const auto le = i < bounds.size()
+                                    ? metrics::formatValue(bounds[i])
+                                    : std::string("+Inf");
+                out += name + "_bucket{" + prefix + "le=\"" + le + "\"} " +
+                       std::to_string(total) + "\n";
+            }
+            out += name + "_sum" + braced + " " +
+                   metrics::formatValue(series.histogram->sum()) + "\n";
+            out += name + "_count" + braced + " " + std::to_string(total) +
+                   "\n";
+            return;
+        }
+        std::string value;
+        if (series.read) {
+            value = metrics::formatValue(series.read());
+        } else if (series.counter) {
+            value = std::to_string(series.counter->value());
+        } else if (series.gauge) {
+            value = metrics::formatValue(series.gauge->value());
+        } else {
+            return;
+        }
+        out += name + braced + " " + value + "\n";
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+/*
+    Metrics recorded by the library itself once installed with
+    setLibraryMetrics. Region files count the bytes they read and time
+    chunk loads; decoded bytes and tags are counted per chunk.
+*/
+struct LibraryMetrics {
+    explicit LibraryMetrics(MetricsRegistry &registry)
+        : decodeBytes(registry.counter("nbt_decode_bytes_total",
+                                       "NBT bytes decoded")),
+          decodeTags(registry.counter("nbt_decode_tags_total",
+                                      "Tags decoded")),
+          ioBytes(registry.counter("nbt_io_read_bytes_total",
+                                   "Bytes read from region files")),
+          ioReads(registry.counter("nbt_io_reads_total",
+                                   "Reads from region files")),
+          chunkLoad(registry.histogram(
+              "nbt_chunk_load_seconds",
+              "Time to read, decompress and decode a chunk")) {
+    }
+
+    Counter &decodeBytes;
+    Counter &decodeTags;
+    Counter &ioBytes;
+    Counter &ioReads;
+    Histogram &chunkLoad;
+};
+
+/*
+    Returns the metrics the library records into, nullptr while disabled.
+    The metrics must outlive the library calls that may record into them.
+*/
+inline std::atomic<LibraryMetrics *> &libraryMetrics() {
+    static std::atomic<LibraryMetrics *> metrics{nullptr};
+    return metrics;
+}
+
+/*
+    Exposes the hits, misses, sizes and hit ratios of both tiers of a
+    ChunkCache, read on scrape. The cache must outlive the registry.
+*/
+template <typename Cache>
+void watchCache(MetricsRegistry &registry, const std::string &name,
+                const Cache &cache) {
+    using Stats = decltype(cache.stats());
+    using Tier = decltype(Stats::hot);
+    const std::pair<const char *, Tier Stats::*> tiers[] = {
+        {"hot", &Stats::hot}, {"cold", &Stats::cold}};
+    for (const auto &tier : tiers) {
+        const MetricLabels labels = {{"cache", name}, {"tier", tier.first}};
+        const auto member = tier.second;
+        const auto read = [&cache, member](auto field) {
+            return [&cache, member, field] {
+                return static_cast<double>((cache.stats().*member).*field);
+            };
+        };
+        registry.callback("nbt_cache_hits_total", "Cache hits",
+                          MetricType::COUNTER, read(&Tier::hits), labels);
+        registry.callback("nbt_cache_misses_total", "Cache misses",
+                          MetricType::COUNTER, read(&Tier::misses), labels);
+        registry.callback("nbt_cache_entries", "Cache entries",
+                          MetricType::GAUGE, read(&Tier::entries), labels);
+        registry.callback("nbt_cache_bytes", "Memory held by the cache",
+                          MetricType::GAUGE, read(&Tier::bytes), labels);
+        registry.callback(
+            "nbt_cache_hit_ratio", "Share of lookups that hit",
+            MetricType::GAUGE,
+            [&cache, member] { return (cache.stats().*member).hitRatio(); },
+            labels);
+    }
+}
+
+/*
+    Exposes the queue depth of each class of a ThreadPool, read on scrape.
+    The pool must outlive the registry.
+*/
+inline void watchPool(MetricsRegistry &registry, const std::string &name,
+                      const ThreadPool &pool) {
+    const std::pair<const char *, Priority> classes[] = {
+        {"interactive", Priority::INTERACTIVE},
+        {"background", Priority::BACKGROUND}};
+    for (const auto &cls : classes) {
+        const auto priority = cls.second;
+        registry.callback(
+            "nbt_pool_queue_depth", "Tasks queued and not yet running",
+            MetricType::GAUGE,
+            [&pool, priority] {
+                return static_cast<double>(pool.queueDepth(priority));
+            },
+            {{"pool", name}, {"priority", cls.first}});
+    }
+    registry.callback(
+        "nbt_pool_threads", "Worker threads", MetricType::GAUGE,
+        [&pool] { return static_cast<double>(pool.size()); },
+        {{"pool", name}});
+}
+
+/*
+    Exposes the memory mapped by page buffers, the scratch buffers of every
+    thread included
+*/
+inline void watchPageBuffers(MetricsRegistry &registry) {
+    registry.callback(
+        "nbt_page_buffer_bytes", "Memory mapped by page buffers",
+        MetricType::GAUGE, [] {
+            return static_cast<double>(
+                PageBuffer::mappedBytes().load(std::memory_order_relaxed));
+        });
+}
+
+/*
+    Serves a registry over HTTP, on one thread, for Prometheus to scrape.
+    GET /metrics and GET / return the exposition, anything else 404. Meant
+    for a trusted network: requests are answered one at a time.
+*/
+class MetricsServer {
+public:
+    /*
+        Starts listening
+        @param port the TCP port, 0 for any free one
+        @param address the IPv4 address to bind, loopback by default
+    */
+    explicit MetricsServer(const MetricsRegistry &registry, uint16_t port = 0,
+                           const std::string &address = "127.0.0.1")
+        : registry_(registry) {
+        fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "MetricsServer: socket");
+        }
+        const int one = 1;
+        ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        socklen_t length = sizeof(addr);
+        if (::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+            ::close(fd_);
+            throw std::invalid_argument("MetricsServer: invalid address " +
+                                        address);
+        }
+        if (::bind(fd_, reinterpret_cast<sockaddr *>(&addr), length) != 0 ||
+            ::listen(fd_, 16) != 0 ||
+            ::getsockname(fd_, reinterpret_cast<sockaddr *>(&addr),
+                          &length) != 0) {
+            const int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(),
+                                    "MetricsServer: bind " + address + ":" +
+                                        std::to_string(port));
+        }
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    ~MetricsServer() {
+        stop_ = true;
+        thread_.join();
+        ::close(fd_);
+    }
+
+    /*
+        Returns the port listened on
+    */
+    uint16_t port() const {
+        return port_;
+    }
+
+private:
+    static constexpr int POLL_MS = 100;
+    static constexpr size_t MAX_REQUEST = 8 << 10;
+
+    void run() {
+        while (!stop_) {
+            pollfd listening{fd_, POLLIN, 0};
+            if (::poll(&listening, 1, POLL_MS) <= 0) {
+                continue;
+            }
+            const int client = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                continue;
+            }
+            try {
+                serve(client);
+            } catch (...) {
+            }
+            ::close(client);
+        }
+    }
+
+    void serve(int client) {
+        const timeval timeout{1, 0};
+        ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                     sizeof(timeout));
+        ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                     sizeof(timeout));
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos &&
+               request.size() < MAX_REQUEST) {
+            const auto got = ::recv(client, buffer, sizeof(buffer), 0);
+            if (got <= 0) {
+                return;
+            }
+            request.append(buffer, static_cast<size_t>(got));
+        }
+        const auto line = request.substr(0, request.find("\r\n"));
+        const bool found = line.compare(0, 13, "GET /metrics ") == 0 ||
+                           line.compare(0, 6, "GET / ") == 0;
+        const auto body = found ? registry_.render() : "not found\n";
+        std::string response =
+            std::string("HTTP/1.1 ") +
+            (found ? "200 OK\r\n" : "404 Not Found\r\n") +
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n" +
+            "Content-Length: " + std::to_string(body.size()) +
+            "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const auto n = ::send(client, response.data() + sent,
+                                  response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+private:
+    const MetricsRegistry &registry_;
+    int fd_ = -1;
+    uint16_t port_ = 0;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+
+}  // namespace nbt
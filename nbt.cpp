@@ -0,0 +1,29 @@
+/**
+    Compiled decoder core of libnbt
+    @file nbt.cpp
+    @author Mudream
+*/
+
+#define NBT_LIBRARY_IMPLEMENTATION
+#include "libnbt.hpp"
+
+
+namespace nbt {
+
+
+template class TagSingle<int8_t, TagType::TAG_BYTE>;
+template class TagSingle<int16_t, TagType::TAG_SHORT>;
+template class TagSingle<int32_t, TagType::TAG_INT>;
+template class TagSingle<int64_t, TagType::TAG_LONG>;
+template class TagSingle<float, TagType::TAG_FLOAT>;
+template class TagSingle<double, TagType::TAG_DOUBLE>;
+template class TagSingle<std::string, TagType::TAG_STRING>;
+template class TagArray<int8_t, TagType::TAG_BYTE_ARRAY>;
+template class TagArray<int32_t, TagType::TAG_INT_ARRAY>;
+template class TagArray<int64_t, TagType::TAG_LONG_ARRAY>;
+
+template std::unique_ptr<Tag> makeTag(TagType, std::istream &);
+template std::unique_ptr<Tag> makeTag(TagType, std::string &, std::istream &);
+
+
+}  // namespace nbt
@@ -6,15 +6,28 @@
 
 #pragma once
 
+#include <algorithm>
 #include <climits>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+/*
+    Functions declared with NBT_OUT_OF_LINE are defined at the end of this
+    header, or compiled into libnbt when included through libnbt.hpp
+*/
+#ifdef NBT_LIBRARY
+#define NBT_OUT_OF_LINE
+#else
+#define NBT_OUT_OF_LINE inline
+#endif
+
 
 namespace nbt {
 
@@ -89,7 +102,7 @@ enum class TagType : uint8_t {
     TAG_LONG_ARRAY
 };
 
-std::unordered_map<TagType, std::string> TAGTYPE_TO_NAME = {
+inline std::unordered_map<TagType, std::string> TAGTYPE_TO_NAME = {
     {TagType::TAG_END, "TAG_END"},
     {TagType::TAG_BYTE, "TAG_BYTE"},
     {TagType::TAG_SHORT, "TAG_SHORT"},
@@ -105,6 +118,14 @@ std::unordered_map<TagType, std::string> TAGTYPE_TO_NAME = {
     {TagType::TAG_LONG_ARRAY, "TAG_LONG_ARRAY"},
 };
 
+/*
+    Thrown when a stream or buffer ends in the middle of a tag
+*/
+class UnexpectedEnd : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 template <typename T>
 T readStream(std::istream &buf);
 
@@ -116,30 +137,219 @@ T readStream(std::istream &buf);
 template <typename T>
 T readStream(std::istream &buf) {
     T tmp;
-    buf.read(reinterpret_cast<char *>(&tmp), sizeof(tmp));
+    if (!buf.read(reinterpret_cast<char *>(&tmp), sizeof(tmp))) {
+        throw UnexpectedEnd("readStream: unexpected end of stream");
+    }
     return endian::refineBigEndian<T>(tmp);
 }
 
 template <>
-std::string readStream(std::istream &buf) {
+inline std::string readStream(std::istream &buf) {
     auto len = readStream<uint16_t>(buf);
 
-    std::vector<char> tmp(len + 1);
-    buf.read(tmp.data(), len);
+    std::string tmp(len, '\0');
+    if (!buf.read(tmp.data(), len)) {
+        throw UnexpectedEnd("readStream: unexpected end of stream");
+    }
 
-    return std::string(tmp.begin(), tmp.end());
+    return tmp;
 }
 
 template <>
-TagType readStream(std::istream &buf) {
+inline TagType readStream(std::istream &buf) {
     return static_cast<TagType>(readStream<uint8_t>(buf));
 }
 
+template <typename T>
+void writeStream(std::ostream &buf, const T &val);
+
+/*
+    Writes the value to output stream in big endian
+    @param buf The output stream
+    @param val the value with type T
+*/
+template <typename T>
+void writeStream(std::ostream &buf, const T &val) {
+    T tmp = endian::refineBigEndian<T>(val);
+    buf.write(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
+}
+
+template <>
+inline void writeStream(std::ostream &buf, const std::string &val) {
+    if (val.size() > UINT16_MAX) {
+        throw std::length_error("writeStream: string longer than 65535 bytes");
+    }
+    writeStream<uint16_t>(buf, static_cast<uint16_t>(val.size()));
+    buf.write(val.data(), val.size());
+}
+
+template <>
+inline void writeStream(std::ostream &buf, const TagType &val) {
+    writeStream<uint8_t>(buf, static_cast<uint8_t>(val));
+}
+
+/*
+    Returns the value stored in big endian at p
+    @param p pointer into a buffer, needs no alignment
+    @return the value with type T
+*/
+template <typename T>
+T readBuffer(const char *p) {
+    T tmp;
+    std::memcpy(&tmp, p, sizeof(tmp));
+    return endian::refineBigEndian<T>(tmp);
+}
+
+/*
+    Returns the end of a tag payload without decoding it
+    @param type type of the tag
+    @param p start of the payload
+    @param end end of the buffer
+    @return the pointer just past the payload
+*/
+NBT_OUT_OF_LINE const char *skipPayload(TagType type, const char *p,
+                                     const char *end);
+
+class Tag;
+
+/*
+    Input stream over a memory buffer. Lists and compounds decoded from a
+    BufferStream ask it first through decodeList and decodeCompound, so a
+    subclass can take over decoding of their elements.
+*/
+class BufferStream : public std::istream {
+public:
+    static constexpr int CHECKPOINT_INTERVAL = 1024;
+
+    BufferStream(const char *data, size_t size) : std::istream(nullptr) {
+        reset(data, size);
+    }
+
+    virtual ~BufferStream() = default;
+
+    /*
+        Points the stream at another buffer and clears its state
+    */
+    void reset(const char *data, size_t size) {
+        buf_.reset(data, size);
+        rdbuf(&buf_);
+    }
+
+    const char *data() const {
+        return buf_.begin();
+    }
+
+    size_t size() const {
+        return buf_.size();
+    }
+
+    size_t position() const {
+        return buf_.position();
+    }
+
+    void seek(size_t pos) {
+        buf_.seek(pos);
+    }
+
+    /*
+        Decodes the elements of a list whose header was just read
+        @return true if out was filled and the stream advanced past them
+    */
+    virtual bool decodeList(TagType elemType, int32_t length,
+                            std::vector<std::unique_ptr<Tag>> &out) {
+        (void)elemType;
+        (void)length;
+        (void)out;
+        return false;
+    }
+
+    /*
+        Decodes the entries of a compound up to and including TAG_END
+        @return true if out was filled and the stream advanced past them
+    */
+    virtual bool decodeCompound(
+        std::unordered_map<std::string, std::unique_ptr<Tag>> &out) {
+        (void)out;
+        return false;
+    }
+
+    /*
+        Called every CHECKPOINT_INTERVAL elements while decoding a list, may
+        throw to abort decoding
+    */
+    virtual void checkpoint() {
+    }
+
+    /*
+        Returns the expected number of entries of the compound about to be
+        decoded, used to reserve its map
+        @param slot set to the value to pass to recordCompoundSize
+    */
+    virtual size_t predictCompoundSize(size_t &slot) {
+        slot = 0;
+        return 0;
+    }
+
+    /*
+        Reports the actual number of entries of a decoded compound
+    */
+    virtual void recordCompoundSize(size_t slot, size_t entries) {
+        (void)slot;
+        (void)entries;
+    }
+
+private:
+    class Buf : public std::streambuf {
+    public:
+        void reset(const char *data, size_t size) {
+            auto p = const_cast<char *>(data);
+            setg(p, p, p + size);
+        }
+
+        const char *begin() const {
+            return eback();
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(egptr() - eback());
+        }
+
+        size_t position() const {
+            return static_cast<size_t>(gptr() - eback());
+        }
+
+        void seek(size_t pos) {
+            setg(eback(), eback() + std::min(pos, size()), egptr());
+        }
+
+    protected:
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                         std::ios_base::openmode) override {
+            off_type base = dir == std::ios_base::beg   ? 0
+                            : dir == std::ios_base::cur ? position()
+                                                        : size();
+            if (base + off < 0 || base + off > static_cast<off_type>(size())) {
+                return pos_type(off_type(-1));
+            }
+            seek(static_cast<size_t>(base + off));
+            return pos_type(base + off);
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override {
+            return seekoff(off_type(pos), std::ios_base::beg, mode);
+        }
+    };
+
+    Buf buf_;
+};
+
 class Tag {
 public:
     Tag(TagType tt) : type_(tt){};
     Tag(TagType tt, const std::string &name) : type_(tt), name_(name){};
     Tag(TagType tt, std::string &&name) : type_(tt), name_(std::move(name)){};
+    Tag(TagType tt, std::optional<std::string> &&name)
+        : type_(tt), name_(std::move(name)){};
     virtual ~Tag() = default;
 
     TagType getTagType() const {
@@ -150,6 +360,12 @@ public:
         return name_;
     }
 
+    /*
+        Writes the payload of the tag, without type and name
+        @param buf The output stream
+    */
+    virtual void encode(std::ostream &buf) const = 0;
+
 private:
     const TagType type_;
     const std::optional<std::string> name_;
@@ -171,10 +387,18 @@ public:
         decode(buf);
     }
 
+    TagSingle(std::optional<std::string> name, T val)
+        : Tag(tt, std::move(name)), val_(std::move(val)) {
+    }
+
     const auto &getValue() const {
         return val_;
     }
 
+    void encode(std::ostream &buf) const override {
+        writeStream<T>(buf, val_);
+    }
+
 private:
     void decode(std::istream &buf) {
         val_ = readStream<T>(buf);
@@ -192,6 +416,52 @@ using TagFloat = TagSingle<float, TagType::TAG_FLOAT>;
 using TagDouble = TagSingle<double, TagType::TAG_DOUBLE>;
 using TagString = TagSingle<std::string, TagType::TAG_STRING>;
 
+/*
+    Maps the value type of a tag to its TagType
+*/
+template <typename T>
+struct TagTypeOf;
+
+template <>
+struct TagTypeOf<int8_t>
+    : std::integral_constant<TagType, TagType::TAG_BYTE> {};
+
+template <>
+struct TagTypeOf<int16_t>
+    : std::integral_constant<TagType, TagType::TAG_SHORT> {};
+
+template <>
+struct TagTypeOf<int32_t>
+    : std::integral_constant<TagType, TagType::TAG_INT> {};
+
+template <>
+struct TagTypeOf<int64_t>
+    : std::integral_constant<TagType, TagType::TAG_LONG> {};
+
+template <>
+struct TagTypeOf<float>
+    : std::integral_constant<TagType, TagType::TAG_FLOAT> {};
+
+template <>
+struct TagTypeOf<double>
+    : std::integral_constant<TagType, TagType::TAG_DOUBLE> {};
+
+template <>
+struct TagTypeOf<std::string>
+    : std::integral_constant<TagType, TagType::TAG_STRING> {};
+
+template <>
+struct TagTypeOf<std::vector<int8_t>>
+    : std::integral_constant<TagType, TagType::TAG_BYTE_ARRAY> {};
+
+template <>
+struct TagTypeOf<std::vector<int32_t>>
+    : std::integral_constant<TagType, TagType::TAG_INT_ARRAY> {};
+
+template <>
+struct TagTypeOf<std::vector<int64_t>>
+    : std::integral_constant<TagType, TagType::TAG_LONG_ARRAY> {};
+
 template <typename T, TagType tt>
 class TagArray : public Tag {
 public:
@@ -210,10 +480,21 @@ public:
         decode(buf);
     }
 
+    TagArray(std::optional<std::string> name, std::vector<T> val)
+        : Tag(tt, std::move(name)), val_(std::move(val)) {
+    }
+
     const auto &getValue() const {
         return val_;
     }
 
+    void encode(std::ostream &buf) const override {
+        writeStream<int32_t>(buf, static_cast<int32_t>(val_.size()));
+        for (const auto &elem : val_) {
+            writeStream<T>(buf, elem);
+        }
+    }
+
 private:
     void decode(std::istream &buf) {
         auto len = readStream<uint32_t>(buf);
@@ -235,6 +516,20 @@ using TagByteArray = TagArray<int8_t, TagType::TAG_BYTE_ARRAY>;
 using TagIntArray = TagArray<int32_t, TagType::TAG_INT_ARRAY>;
 using TagLongArray = TagArray<int64_t, TagType::TAG_LONG_ARRAY>;
 
+#ifdef NBT_LIBRARY
+// Instantiated once in nbt.cpp, see libnbt.hpp
+extern template class TagSingle<int8_t, TagType::TAG_BYTE>;
+extern template class TagSingle<int16_t, TagType::TAG_SHORT>;
+extern template class TagSingle<int32_t, TagType::TAG_INT>;
+extern template class TagSingle<int64_t, TagType::TAG_LONG>;
+extern template class TagSingle<float, TagType::TAG_FLOAT>;
+extern template class TagSingle<double, TagType::TAG_DOUBLE>;
+extern template class TagSingle<std::string, TagType::TAG_STRING>;
+extern template class TagArray<int8_t, TagType::TAG_BYTE_ARRAY>;
+extern template class TagArray<int32_t, TagType::TAG_INT_ARRAY>;
+extern template class TagArray<int64_t, TagType::TAG_LONG_ARRAY>;
+#endif
+
 class TagCompound;
 class TagList;
 
@@ -292,48 +587,76 @@ std::unique_ptr<Tag> makeTag(TagType type, Args &&... args) {
     }
 }
 
+#ifdef NBT_LIBRARY
+extern template std::unique_ptr<Tag> makeTag(TagType, std::istream &);
+extern template std::unique_ptr<Tag> makeTag(TagType, std::string &,
+                                             std::istream &);
+#endif
+
 class TagList : public Tag {
 public:
     TagList() : Tag(TagType::TAG_LIST) {
     }
 
-    TagList(std::istream &buf) : Tag(TagType::TAG_LIST) {
-        decode(buf);
+    TagList(std::istream &buf)
+        : TagList(buf, dynamic_cast<BufferStream *>(&buf)) {
     }
 
     TagList(const std::string &name, std::istream &buf)
-        : Tag(TagType::TAG_LIST, name) {
-        decode(buf);
+        : TagList(name, buf, dynamic_cast<BufferStream *>(&buf)) {
     }
 
     TagList(std::string &&name, std::istream &buf)
+        : TagList(std::move(name), buf, dynamic_cast<BufferStream *>(&buf)) {
+    }
+
+    /*
+        Decodes from buf, known to be the BufferStream mem or no
+        BufferStream when mem is nullptr. Nested lists and compounds get
+        mem passed down instead of looking it up again.
+    */
+    TagList(std::istream &buf, BufferStream *mem) : Tag(TagType::TAG_LIST) {
+        decode(buf, mem);
+    }
+
+    TagList(const std::string &name, std::istream &buf, BufferStream *mem)
+        : Tag(TagType::TAG_LIST, name) {
+        decode(buf, mem);
+    }
+
+    TagList(std::string &&name, std::istream &buf, BufferStream *mem)
         : Tag(TagType::TAG_LIST, std::move(name)) {
-        decode(buf);
+        decode(buf, mem);
+    }
+
+    TagList(std::optional<std::string> name, TagType elemType,
+            std::vector<std::unique_ptr<Tag>> val)
+        : Tag(TagType::TAG_LIST, std::move(name)),
+          elemType_(elemType),
+          val_(std::move(val)) {
+    }
+
+    TagType getElementType() const {
+        return elemType_;
     }
 
     const auto &getValue() const {
         return val_;
     }
 
-private:
-    void decode(std::istream &buf) {
-        elemType_ = readStream<TagType>(buf);
-        auto length = readStream<int32_t>(buf);
-        if (length <= 0) {
-            // TODO
-            throw std::runtime_error(
-                "TagList::decode: not implement for variant length list");
-            return;
-        }
-
-        val_.resize(length);
-        for (int i = 0; i < length; ++i) {
-            val_[i] = makeTag(elemType_, buf);
+    void encode(std::ostream &buf) const override {
+        writeStream<TagType>(buf, elemType_);
+        writeStream<int32_t>(buf, static_cast<int32_t>(val_.size()));
+        for (const auto &elem : val_) {
+            elem->encode(buf);
         }
     }
 
 private:
-    TagType elemType_;
+    void decode(std::istream &buf, BufferStream *mem);
+
+private:
+    TagType elemType_ = TagType::TAG_END;
     std::vector<std::unique_ptr<Tag>> val_;
 };
 
@@ -342,33 +665,59 @@ public:
     TagCompound() : Tag(TagType::TAG_COMPOUND) {
     }
 
-    TagCompound(std::istream &buf) : Tag(TagType::TAG_COMPOUND) {
-        decode(buf);
+    TagCompound(std::istream &buf)
+        : TagCompound(buf, dynamic_cast<BufferStream *>(&buf)) {
     }
 
     TagCompound(const std::string &name, std::istream &buf)
-        : Tag(TagType::TAG_COMPOUND, name) {
-        decode(buf);
+        : TagCompound(name, buf, dynamic_cast<BufferStream *>(&buf)) {
     }
 
     TagCompound(std::string &&name, std::istream &buf)
+        : TagCompound(std::move(name), buf,
+                      dynamic_cast<BufferStream *>(&buf)) {
+    }
+
+    /*
+        Decodes from buf with its BufferStream already resolved, like the
+        TagList constructors taking mem
+    */
+    TagCompound(std::istream &buf, BufferStream *mem)
+        : Tag(TagType::TAG_COMPOUND) {
+        decode(buf, mem);
+    }
+
+    TagCompound(const std::string &name, std::istream &buf, BufferStream *mem)
+        : Tag(TagType::TAG_COMPOUND, name) {
+        decode(buf, mem);
+    }
+
+    TagCompound(std::string &&name, std::istream &buf, BufferStream *mem)
         : Tag(TagType::TAG_COMPOUND, std::move(name)) {
-        decode(buf);
+        decode(buf, mem);
+    }
+
+    TagCompound(std::optional<std::string> name,
+                std::unordered_map<std::string, std::unique_ptr<Tag>> val)
+        : Tag(TagType::TAG_COMPOUND, std::move(name)), val_(std::move(val)) {
     }
 
     const auto &getValue() const {
         return val_;
     }
 
-private:
-    void decode(std::istream &buf) {
-        for (auto type = readStream<TagType>(buf); type != TagType::TAG_END;
-             type = readStream<TagType>(buf)) {
-            auto name = readStream<std::string>(buf);
-            val_.insert({std::move(name), makeTag(type, name, buf)});
+    void encode(std::ostream &buf) const override {
+        for (const auto &it : val_) {
+            writeStream<TagType>(buf, it.second->getTagType());
+            writeStream<std::string>(buf, it.first);
+            it.second->encode(buf);
         }
+        writeStream<TagType>(buf, TagType::TAG_END);
     }
 
+private:
+    void decode(std::istream &buf, BufferStream *mem);
+
 private:
     std::unordered_map<std::string, std::unique_ptr<Tag>> val_;
 };
@@ -378,7 +727,159 @@ private:
     @param buf The file stream of input file
     @return the unique pointer of Tag
 */
-std::unique_ptr<Tag> readDocument(std::istream &buf) {
+NBT_OUT_OF_LINE std::unique_ptr<Tag> readDocument(std::istream &buf);
+
+/*
+    Writes the Tag as the root of a document
+    @param buf The output stream
+    @param doc the root Tag, usually a named compound
+*/
+inline void writeDocument(std::ostream &buf, const Tag &doc) {
+    writeStream<TagType>(buf, doc.getTagType());
+    writeStream<std::string>(buf, doc.getName().value_or(""));
+    doc.encode(buf);
+}
+
+
+/*
+    Decoder core, inline in header only use and compiled once by nbt.cpp
+    into libnbt otherwise
+*/
+#if !defined(NBT_LIBRARY) || defined(NBT_LIBRARY_IMPLEMENTATION)
+
+NBT_OUT_OF_LINE const char *skipPayload(TagType type, const char *p,
+                                     const char *end) {
+    auto need = [&](size_t n) {
+        if (static_cast<size_t>(end - p) < n) {
+            throw UnexpectedEnd("skipPayload: unexpected end of buffer");
+        }
+    };
+    auto skipArray = [&](size_t elemSize) {
+        need(4);
+        auto len = readBuffer<int32_t>(p);
+        p += 4;
+        if (len > 0) {
+            need(static_cast<size_t>(len) * elemSize);
+            p += static_cast<size_t>(len) * elemSize;
+        }
+        return p;
+    };
+
+    switch (type) {
+    case TagType::TAG_BYTE:
+        need(1);
+        return p + 1;
+    case TagType::TAG_SHORT:
+        need(2);
+        return p + 2;
+    case TagType::TAG_INT:
+    case TagType::TAG_FLOAT:
+        need(4);
+        return p + 4;
+    case TagType::TAG_LONG:
+    case TagType::TAG_DOUBLE:
+        need(8);
+        return p + 8;
+    case TagType::TAG_BYTE_ARRAY:
+        return skipArray(1);
+    case TagType::TAG_INT_ARRAY:
+        return skipArray(4);
+    case TagType::TAG_LONG_ARRAY:
+        return skipArray(8);
+    case TagType::TAG_STRING: {
+        need(2);
+        auto len = readBuffer<uint16_t>(p);
+        p += 2;
+        need(len);
+        return p + len;
+    }
+    case TagType::TAG_LIST: {
+        need(5);
+        auto elemType = static_cast<TagType>(*p);
+        auto len = readBuffer<int32_t>(p + 1);
+        p += 5;
+        for (int32_t i = 0; i < len; ++i) {
+            p = skipPayload(elemType, p, end);
+        }
+        return p;
+    }
+    case TagType::TAG_COMPOUND:
+        while (true) {
+            need(1);
+            auto entryType = static_cast<TagType>(*p++);
+            if (entryType == TagType::TAG_END) {
+                return p;
+            }
+            need(2);
+            auto nameLen = readBuffer<uint16_t>(p);
+            p += 2;
+            need(nameLen);
+            p = skipPayload(entryType, p + nameLen, end);
+        }
+    default:
+        throw std::runtime_error("skipPayload: TagType " +
+                                 std::to_string(static_cast<int>(type)) +
+                                 " not found");
+    }
+}
+
+/*
+    Returns a list element or compound entry like makeTag, passing the
+    BufferStream resolved by the enclosing decode down to nested lists and
+    compounds
+*/
+template <typename... Args>
+std::unique_ptr<Tag> makeNestedTag(TagType type, BufferStream *mem,
+                                   Args &&... args) {
+    switch (type) {
+    case TagType::TAG_LIST:
+        return std::make_unique<TagList>(std::forward<Args>(args)..., mem);
+    case TagType::TAG_COMPOUND:
+        return std::make_unique<TagCompound>(std::forward<Args>(args)..., mem);
+    default:
+        return makeTag(type, std::forward<Args>(args)...);
+    }
+}
+
+NBT_OUT_OF_LINE void TagList::decode(std::istream &buf, BufferStream *mem) {
+    elemType_ = readStream<TagType>(buf);
+    auto length = readStream<int32_t>(buf);
+    if (length <= 0) {
+        return;
+    }
+    if (mem != nullptr && mem->decodeList(elemType_, length, val_)) {
+        return;
+    }
+
+    val_.resize(length);
+    for (int i = 0; i < length; ++i) {
+        if (mem != nullptr && i % BufferStream::CHECKPOINT_INTERVAL == 0) {
+            mem->checkpoint();
+        }
+        val_[i] = makeNestedTag(elemType_, mem, buf);
+    }
+}
+
+NBT_OUT_OF_LINE void TagCompound::decode(std::istream &buf,
+                                         BufferStream *mem) {
+    if (mem != nullptr && mem->decodeCompound(val_)) {
+        return;
+    }
+    size_t slot = 0;
+    if (mem != nullptr) {
+        val_.reserve(mem->predictCompoundSize(slot));
+    }
+    for (auto type = readStream<TagType>(buf); type != TagType::TAG_END;
+         type = readStream<TagType>(buf)) {
+        auto name = readStream<std::string>(buf);
+        val_.insert({std::move(name), makeNestedTag(type, mem, name, buf)});
+    }
+    if (mem != nullptr) {
+        mem->recordCompoundSize(slot, val_.size());
+    }
+}
+
+NBT_OUT_OF_LINE std::unique_ptr<Tag> readDocument(std::istream &buf) {
     auto tagType = readStream<TagType>(buf);
     if (tagType != TagType::TAG_COMPOUND) {
         throw std::runtime_error(
@@ -386,8 +887,10 @@ std::unique_ptr<Tag> readDocument(std::istream &buf) {
     }
 
     auto name = readStream<std::string>(buf);
-    return makeTag(tagType, name, buf);
+    return std::make_unique<TagCompound>(std::move(name), buf,
+                                         dynamic_cast<BufferStream *>(&buf));
 }
 
+#endif
 
 }  // namespace nbt
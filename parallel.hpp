@@ -0,0 +1,247 @@
+/**
+    Parallel NBT Reader
+    @file parallel.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include "control.hpp"
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+struct ParallelOptions {
+    // Lists and compounds with a smaller payload are decoded sequentially
+    size_t minBytes = 1 << 20;
+    // Lists and compounds with fewer elements are decoded sequentially
+    size_t minElements = 64;
+    // Number of element ranges handed out per worker
+    size_t tasksPerWorker = 4;
+    // Checked within large lists by every task, optional
+    const ScanControl *control = nullptr;
+};
+
+/*
+    BufferStream decoding large lists and compounds on a thread pool.
+    A skip pass finds the element boundaries first, then ranges of elements
+    are decoded in parallel into preallocated slots. The skip pass also
+    remembers where every container of at least minBytes ends, and what it
+    covered: nested lists and compounds decoded afterwards jump over the
+    large children it found and skip no pass at all when they are small,
+    so the document is walked once however deep it is.
+*/
+class ParallelDecodeStream : public BufferStream {
+public:
+    ParallelDecodeStream(const char *data, size_t size, ThreadPool &pool,
+                         const ParallelOptions &opts = {})
+        : BufferStream(data, size), pool_(pool), opts_(opts) {
+    }
+
+    bool decodeList(TagType elemType, int32_t length,
+                    std::vector<std::unique_ptr<Tag>> &out) override {
+        const auto count = static_cast<size_t>(length);
+        const size_t remaining = size() - position();
+        // The header of elemType and length is already read
+        if (elemType == TagType::TAG_END || count < opts_.minElements ||
+            !mayBeLarge(position() - 5)) {
+            return false;
+        }
+        // Every other element type takes at least one byte, so a longer
+        // list cannot fit and is rejected before sizing anything from it
+        if (count > remaining) {
+            throw UnexpectedEnd(
+                "ParallelDecodeStream: list longer than the buffer");
+        }
+
+        std::vector<size_t> bounds(count + 1);
+        const size_t first = position();
+        const char *p = data() + first;
+        for (size_t i = 0; i < count; ++i) {
+            bounds[i] = static_cast<size_t>(p - data());
+            p = skip(elemType, p);
+        }
+        bounds[count] = static_cast<size_t>(p - data());
+        covered(first - 5, bounds[count]);
+        if (bounds[count] - bounds[0] < opts_.minBytes) {
+            return false;
+        }
+
+        out.resize(count);
+        forRanges(count, [&](size_t lo, size_t hi) {
+            ControlledStream stream(data() + bounds[lo],
+                                    bounds[hi] - bounds[lo], opts_.control);
+            std::istream &in = stream;
+            for (size_t i = lo; i < hi; ++i) {
+                out[i] = makeTag(elemType, in);
+            }
+        });
+        seek(bounds[count]);
+        return true;
+    }
+
+    bool decodeCompound(
+        std::unordered_map<std::string, std::unique_ptr<Tag>> &out) override {
+        if (!mayBeLarge(position())) {
+            return false;
+        }
+
+        std::vector<size_t> bounds;
+        const size_t first = position();
+        const char *p = data() + first;
+        const char *end = data() + size();
+        while (true) {
+            if (p == end) {
+                throw std::runtime_error(
+                    "ParallelDecodeStream: unexpected end of buffer");
+            }
+            bounds.push_back(static_cast<size_t>(p - data()));
+            auto type = static_cast<TagType>(*p);
+            if (type == TagType::TAG_END) {
+                break;
+            }
+            p = skip(type, skipPayload(TagType::TAG_STRING, p + 1, end));
+        }
+        const size_t count = bounds.size() - 1;
+        covered(first, bounds[count] + 1);
+        if (count < opts_.minElements ||
+            bounds[count] - bounds[0] < opts_.minBytes) {
+            return false;
+        }
+
+        std::vector<std::pair<std::string, std::unique_ptr<Tag>>> entries(
+            count);
+        forRanges(count, [&](size_t lo, size_t hi) {
+            ControlledStream stream(data() + bounds[lo],
+                                    bounds[hi] - bounds[lo], opts_.control);
+            std::istream &in = stream;
+            for (size_t i = lo; i < hi; ++i) {
+                auto type = readStream<TagType>(in);
+                auto name = readStream<std::string>(in);
+                auto tag = makeTag(type, name, in);
+                entries[i] = {std::move(name), std::move(tag)};
+            }
+        });
+        out.reserve(count);
+        for (auto &entry : entries) {
+            out.insert(std::move(entry));
+        }
+        seek(bounds[count] + 1);
+        return true;
+    }
+
+    void checkpoint() override {
+        if (opts_.control != nullptr) {
+            opts_.control->check();
+        }
+    }
+
+private:
+    template <typename Fn>
+    void forRanges(size_t n, Fn fn) {
+        parallelFor(pool_, n, pool_.size() * opts_.tasksPerWorker, fn);
+    }
+
+    /*
+        Returns false if the container whose payload starts at an offset
+        is known to be smaller than minBytes, from the bytes left or from
+        an earlier skip pass over it
+    */
+    bool mayBeLarge(size_t at) const {
+        if (size() - at < opts_.minBytes) {
+            return false;
+        }
+        return at >= skippedTo_ || ends_.count(at) != 0;
+    }
+
+    void covered(size_t from, size_t to) {
+        if (from >= skippedTo_) {
+            skippedTo_ = to;
+        }
+    }
+
+    /*
+        Returns the end of a payload like skipPayload, jumping over the
+        large containers found before and remembering new ones. Large
+        containers are keyed by the offset of their payload, which for a
+        list is its header, so that a list and its first element differ.
+    */
+    const char *skip(TagType type, const char *p) {
+        const char *end = data() + size();
+        if (type != TagType::TAG_LIST && type != TagType::TAG_COMPOUND) {
+            return skipPayload(type, p, end);
+        }
+        const char *first = p;
+        const auto known = ends_.find(static_cast<size_t>(first - data()));
+        if (known != ends_.end()) {
+            return data() + known->second;
+        }
+
+        if (type == TagType::TAG_LIST) {
+            if (end - p < 5) {
+                throw UnexpectedEnd(
+                    "ParallelDecodeStream: unexpected end of buffer");
+            }
+            const auto elemType = static_cast<TagType>(*p);
+            const auto length = readBuffer<int32_t>(p + 1);
+            p += 5;
+            for (int32_t i = 0; i < length; ++i) {
+                p = skip(elemType, p);
+            }
+        } else {
+            while (true) {
+                if (p == end) {
+                    throw UnexpectedEnd(
+                        "ParallelDecodeStream: unexpected end of buffer");
+                }
+                const auto entryType = static_cast<TagType>(*p++);
+                if (entryType == TagType::TAG_END) {
+                    break;
+                }
+                p = skip(entryType, skipPayload(TagType::TAG_STRING, p, end));
+            }
+        }
+        if (static_cast<size_t>(p - first) >= opts_.minBytes) {
+            ends_.emplace(first - data(), p - data());
+        }
+        return p;
+    }
+
+private:
+    ThreadPool &pool_;
+    const ParallelOptions opts_;
+    // Payload offset of every large container skipped so far, mapped to
+    // the offset past its end
+    std::unordered_map<size_t, size_t> ends_;
+    // Offset up to which the document has been skipped
+    size_t skippedTo_ = 0;
+};
+
+/*
+    Returns the root Tag of a document held in memory, decoding large
+    lists and compounds on the thread pool
+    @param data the document
+    @param size size of the document in bytes
+    @param pool the pool running the decode tasks
+    @param opts size thresholds below which decoding stays sequential
+    @return the unique pointer of Tag
+*/
+inline std::unique_ptr<Tag> readDocument(const char *data, size_t size,
+                                         ThreadPool &pool,
+                                         const ParallelOptions &opts = {}) {
+    if (opts.control != nullptr) {
+        opts.control->check();
+    }
+    ParallelDecodeStream stream(data, size, pool, opts);
+    auto doc = readDocument(stream);
+    if (opts.control != nullptr) {
+        opts.control->addBytes(size);
+    }
+    return doc;
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,361 @@
+/**
+    Memory pressure monitoring
+    @file pressure.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "topology.hpp"
+
+
+namespace nbt {
+
+
+struct PressureLine {
+    // Share of time stalled in percent, averaged over 10, 60 and 300 s
+    double avg10 = 0;
+    double avg60 = 0;
+    double avg300 = 0;
+    // Total time stalled in microseconds
+    uint64_t total = 0;
+};
+
+struct MemoryPressure {
+    // Time in which at least one task was stalled on memory
+    PressureLine some;
+    // Time in which every non idle task was stalled on memory
+    PressureLine full;
+};
+
+/*
+    Parses the PSI format of /proc/pressure/memory and memory.pressure
+    @return false if no "some" line was found
+*/
+inline bool parsePressure(std::istream &in, MemoryPressure &pressure) {
+    bool found = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        PressureLine *target = kind == "some"   ? &pressure.some
+                               : kind == "full" ? &pressure.full
+                                                : nullptr;
+        if (target == nullptr) {
+            continue;
+        }
+        found |= target == &pressure.some;
+        std::string field;
+        while (fields >> field) {
+            const auto eq = field.find('=');
+            if (eq == std::string::npos) {
+                continue;
+            }
+            const auto name = field.substr(0, eq);
+            const auto value = field.substr(eq + 1);
+            try {
+                if (name == "avg10") {
+                    target->avg10 = std::stod(value);
+                } else if (name == "avg60") {
+                    target->avg60 = std::stod(value);
+                } else if (name == "avg300") {
+                    target->avg300 = std::stod(value);
+                } else if (name == "total") {
+                    target->total = std::stoull(value);
+                }
+            } catch (const std::exception &) {
+                return false;
+            }
+        }
+    }
+    return found;
+}
+
+/*
+    Returns the cgroup v2 directory of the calling process, empty if the
+    process is not in a cgroup v2 hierarchy
+*/
+inline std::string cgroupDirectory() {
+    std::string mount;
+    std::ifstream mounts("/proc/self/mounts");
+    std::string device, point, type, rest;
+    while (mounts >> device >> point >> type && std::getline(mounts, rest)) {
+        if (type == "cgroup2") {
+            mount = point;
+            break;
+        }
+    }
+    std::ifstream groups("/proc/self/cgroup");
+    std::string line;
+    while (!mount.empty() && std::getline(groups, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            return mount + (line.size() > 4 ? line.substr(3) : "");
+        }
+    }
+    return {};
+}
+
+enum class PressureSource : uint8_t {
+    // Nothing to read, the monitor never shrinks
+    NONE,
+    // System wide PSI
+    PSI,
+    // PSI of the process's cgroup
+    CGROUP_PSI,
+    // Usage of the process's cgroup against memory.max
+    CGROUP_USAGE,
+};
+
+struct PressureOptions {
+    // Stall share in percent from which caches are shrunk
+    double threshold = 10;
+    // Fraction shrunk at the threshold, growing linearly with the stall
+    double shrinkStep = 0.1;
+    // Largest fraction shrunk by one poll
+    double maxShrink = 0.5;
+    // Share of memory.max from which cgroup usage counts as pressure, used
+    // when no PSI is available. Full usage counts as a 100 % stall.
+    double usageHigh = 0.9;
+    // Time between two polls of the background thread
+    std::chrono::milliseconds interval{1000};
+    std::string psiPath = "/proc/pressure/memory";
+    // cgroup v2 directory, empty for the one of the process
+    std::string cgroupPath;
+    // Also trim the scratch buffers of every thread
+    bool trimScratch = true;
+};
+
+/*
+    Watches memory pressure and asks registered caches to give memory back
+    before the OOM killer steps in. Pressure is read from /proc/pressure/
+    memory, or from the cgroup v2 memory.pressure and then memory.current
+    against memory.max where PSI is unavailable. When the share of time
+    stalled on memory reaches the threshold, every callback is asked to
+    shrink by the same fraction of what it holds, so caches shrink
+    proportionally to their size.
+
+    Polls run on a background thread once started, or on demand.
+    Callbacks run with the registry locked and must not add or remove
+    callbacks.
+*/
+class MemoryPressureMonitor {
+public:
+    using Callback = std::function<void(double fraction)>;
+
+    explicit MemoryPressureMonitor(PressureOptions options = {})
+        : options_(std::move(options)) {
+        if (options_.cgroupPath.empty()) {
+            options_.cgroupPath = cgroupDirectory();
+        }
+        MemoryPressure pressure;
+        if (readPsi(options_.psiPath, pressure)) {
+            source_ = PressureSource::PSI;
+        } else if (!options_.cgroupPath.empty() &&
+                   readPsi(options_.cgroupPath + "/memory.pressure",
+                           pressure)) {
+            source_ = PressureSource::CGROUP_PSI;
+        } else if (!options_.cgroupPath.empty() && readUsage() >= 0) {
+            source_ = PressureSource::CGROUP_USAGE;
+        }
+    }
+
+    MemoryPressureMonitor(const MemoryPressureMonitor &) = delete;
+    MemoryPressureMonitor &operator=(const MemoryPressureMonitor &) = delete;
+
+    ~MemoryPressureMonitor() {
+        stop();
+    }
+
+    PressureSource source() const {
+        return source_;
+    }
+
+    /*
+        Registers a callback called as callback(fraction) under pressure,
+        fraction being the share of its memory to give back
+        @return an id for remove
+    */
+    size_t add(Callback callback) {
+        std::lock_guard<std::mutex> lock(callbacksMutex_);
+        callbacks_.emplace_back(++lastId_, std::move(callback));
+        return lastId_;
+    }
+
+    void remove(size_t id) {
+        std::lock_guard<std::mutex> lock(callbacksMutex_);
+        callbacks_.erase(
+            std::remove_if(callbacks_.begin(), callbacks_.end(),
+                           [id](const auto &it) { return it.first == id; }),
+            callbacks_.end());
+    }
+
+    /*
+        Returns the current stall share in percent. With PSI it is measured
+        since the previous call, the first call uses the 10 s average.
+    */
+    double level() {
+        switch (source_) {
+        case PressureSource::PSI:
+        case PressureSource::CGROUP_PSI: {
+            std::lock_guard<std::mutex> lock(sampleMutex_);
+            MemoryPressure pressure;
+            const auto now = std::chrono::steady_clock::now();
+            if (!readPsi(source_ == PressureSource::PSI
+                             ? options_.psiPath
+                             : options_.cgroupPath + "/memory.pressure",
+                         pressure)) {
+                return 0;
+            }
+            double stall = pressure.some.avg10;
+            if (sampled_ && pressure.some.total >= lastTotal_ &&
+                now > lastSample_) {
+                const auto elapsed =
+                    std::chrono::duration<double, std::micro>(now -
+                                                              lastSample_)
+                        .count();
+                stall = 100.0 * (pressure.some.total - lastTotal_) / elapsed;
+            }
+            sampled_ = true;
+            lastTotal_ = pressure.some.total;
+            lastSample_ = now;
+            return std::min(stall, 100.0);
+        }
+        case PressureSource::CGROUP_USAGE: {
+            const double usage = readUsage();
+            if (usage <= options_.usageHigh || options_.usageHigh >= 1) {
+                return 0;
+            }
+            return std::min(100.0, 100.0 * (usage - options_.usageHigh) /
+                                       (1 - options_.usageHigh));
+        }
+        default:
+            return 0;
+        }
+    }
+
+    /*
+        Returns the fraction to shrink by at a stall share
+    */
+    double fraction(double level) const {
+        if (level < options_.threshold || options_.threshold <= 0) {
+            return 0;
+        }
+        return std::min(options_.maxShrink,
+                        options_.shrinkStep * level / options_.threshold);
+    }
+
+    /*
+        Reads the pressure and shrinks the registered caches if it is over
+        the threshold
+        @return the fraction shrunk, 0 if under the threshold
+    */
+    double poll() {
+        const double shrunk = fraction(level());
+        if (shrunk > 0) {
+            shrink(shrunk);
+        }
+        return shrunk;
+    }
+
+    /*
+        Asks every registered cache to give back a fraction of its memory
+    */
+    void shrink(double fraction) {
+        if (options_.trimScratch) {
+            trimScratchBuffers();
+        }
+        std::lock_guard<std::mutex> lock(callbacksMutex_);
+        for (auto &it : callbacks_) {
+            it.second(fraction);
+        }
+    }
+
+    /*
+        Starts polling on a background thread. Exceptions thrown by
+        callbacks there are dropped.
+    */
+    void start() {
+        std::lock_guard<std::mutex> lock(threadMutex_);
+        if (thread_.joinable() || source_ == PressureSource::NONE) {
+            return;
+        }
+        stop_ = false;
+        thread_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(threadMutex_);
+            while (!cv_.wait_for(lock, options_.interval,
+                                 [this] { return stop_; })) {
+                lock.unlock();
+                try {
+                    poll();
+                } catch (...) {
+                }
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> lock(threadMutex_);
+            stop_ = true;
+            thread = std::move(thread_);
+        }
+        cv_.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+private:
+    static bool readPsi(const std::string &path, MemoryPressure &pressure) {
+        std::ifstream file(path);
+        return file && parsePressure(file, pressure);
+    }
+
+    /*
+        Returns memory.current over memory.max of the cgroup, -1 if either
+        is missing or there is no limit
+    */
+    double readUsage() const {
+        std::ifstream maxFile(options_.cgroupPath + "/memory.max");
+        std::ifstream currentFile(options_.cgroupPath + "/memory.current");
+        double max = 0, current = 0;
+        if (!(maxFile >> max) || !(currentFile >> current) || max <= 0) {
+            return -1;
+        }
+        return current / max;
+    }
+
+private:
+    PressureOptions options_;
+    PressureSource source_ = PressureSource::NONE;
+    std::mutex sampleMutex_;
+    bool sampled_ = false;
+    uint64_t lastTotal_ = 0;
+    std::chrono::steady_clock::time_point lastSample_;
+    std::mutex callbacksMutex_;
+    std::vector<std::pair<size_t, Callback>> callbacks_;
+    size_t lastId_ = 0;
+    std::mutex threadMutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool stop_ = false;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,344 @@
+/**
+    Access profiling and projected decoding
+    @file profile.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <typeinfo>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Set of paths to decode, organized as a tree. A path joins compound
+    keys with '.' and marks list elements with "[]", e.g.
+    "Level.Entities[].id". A node without children stands for its whole
+    subtree, as does a node reached through a "*" segment; an empty
+    Projection therefore decodes everything.
+*/
+class Projection {
+public:
+    struct Node {
+        bool all = false;
+        std::map<std::string, Node> children;
+
+        /*
+            Returns the child of a key or "[]", nullptr if not projected
+        */
+        const Node *child(const std::string &key) const {
+            auto it = children.find(key);
+            return it == children.end() ? nullptr : &it->second;
+        }
+
+        bool whole() const {
+            return all || children.empty();
+        }
+    };
+
+    Projection() = default;
+
+    explicit Projection(const std::vector<std::string> &paths) {
+        for (const auto &path : paths) {
+            add(path);
+        }
+    }
+
+    void add(const std::string &path) {
+        Node *node = &root_;
+        for (const auto &segment : split(path)) {
+            if (segment == "*") {
+                node->all = true;
+                return;
+            }
+            node = &node->children[segment];
+        }
+        if (node == &root_) {
+            root_.all = true;
+        }
+    }
+
+    const Node &root() const {
+        return root_;
+    }
+
+    /*
+        Returns the segments of a path: keys and "[]" list markers
+    */
+    static std::vector<std::string> split(const std::string &path) {
+        std::vector<std::string> segments;
+        std::string key;
+        for (size_t i = 0; i < path.size(); ++i) {
+            if (path[i] == '.') {
+                if (!key.empty()) {
+                    segments.push_back(std::move(key));
+                    key.clear();
+                }
+            } else if (path.compare(i, 2, "[]") == 0) {
+                if (!key.empty()) {
+                    segments.push_back(std::move(key));
+                    key.clear();
+                }
+                segments.emplace_back("[]");
+                ++i;
+            } else {
+                key += path[i];
+            }
+        }
+        if (!key.empty()) {
+            segments.push_back(std::move(key));
+        }
+        return segments;
+    }
+
+private:
+    Node root_;
+};
+
+/*
+    Aggregated count of accessed paths, shared by every ProfiledTag of a
+    workload. Safe to record from several threads.
+*/
+class AccessProfile {
+public:
+    void record(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++counts_[path];
+    }
+
+    /*
+        Adds the counts of another profile, e.g. from another process
+    */
+    void merge(const AccessProfile &other) {
+        auto theirs = other.counts();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &it : theirs) {
+            counts_[it.first] += it.second;
+        }
+    }
+
+    std::map<std::string, uint64_t> counts() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return counts_;
+    }
+
+    /*
+        Writes one "count<TAB>path" line per path, sorted by path
+    */
+    void write(std::ostream &out) const {
+        for (const auto &it : counts()) {
+            out << it.second << '\t' << it.first << '\n';
+        }
+    }
+
+    /*
+        Adds the counts of a profile written by write
+    */
+    void read(std::istream &in) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string line;
+        while (std::getline(in, line)) {
+            auto tab = line.find('\t');
+            if (tab == std::string::npos) {
+                if (line.empty()) {
+                    continue;
+                }
+                throw std::runtime_error("AccessProfile: malformed line " +
+                                         line);
+            }
+            counts_[line.substr(tab + 1)] += std::stoull(line.substr(0, tab));
+        }
+    }
+
+    /*
+        Returns the projection of the paths accessed at least minCount
+        times
+    */
+    Projection projection(uint64_t minCount = 1) const {
+        Projection out;
+        for (const auto &it : counts()) {
+            if (it.second >= minCount) {
+                out.add(it.first);
+            }
+        }
+        return out;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, uint64_t> counts_;
+};
+
+/*
+    Read-only view of a Tag recording every path it is navigated through.
+    Compound keys and list elements are recorded as they are visited; tag()
+    and get() on a list or compound record the whole subtree as used.
+*/
+class ProfiledTag {
+public:
+    ProfiledTag(const Tag &tag, AccessProfile &profile, std::string path = "")
+        : tag_(&tag), profile_(&profile), path_(std::move(path)) {
+    }
+
+    const std::string &path() const {
+        return path_;
+    }
+
+    TagType getTagType() const {
+        return tag_->getTagType();
+    }
+
+    /*
+        Returns the entry of a compound
+        @throw std::out_of_range if the key is absent
+    */
+    ProfiledTag operator[](const std::string &key) const {
+        auto childPath = path_.empty() ? key : path_ + "." + key;
+        profile_->record(childPath);
+        const auto &entries = as<TagCompound>().getValue();
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            throw std::out_of_range("ProfiledTag: no key " + childPath);
+        }
+        return ProfiledTag(*it->second, *profile_, std::move(childPath));
+    }
+
+    /*
+        Returns the element of a list
+    */
+    ProfiledTag operator[](size_t index) const {
+        auto childPath = path_ + "[]";
+        profile_->record(childPath);
+        return ProfiledTag(*as<TagList>().getValue().at(index), *profile_,
+                           std::move(childPath));
+    }
+
+    bool contains(const std::string &key) const {
+        profile_->record(path_.empty() ? key : path_ + "." + key);
+        return as<TagCompound>().getValue().count(key) != 0;
+    }
+
+    /*
+        Returns the number of elements of a list or entries of a compound;
+        the latter depends on every key and uses the whole compound
+    */
+    size_t size() const {
+        if (tag_->getTagType() == TagType::TAG_LIST) {
+            return as<TagList>().getValue().size();
+        }
+        return get<TagCompound>().getValue().size();
+    }
+
+    /*
+        Returns the underlying Tag, counted as a use of its whole subtree
+    */
+    const Tag &tag() const {
+        if (tag_->getTagType() == TagType::TAG_LIST ||
+            tag_->getTagType() == TagType::TAG_COMPOUND) {
+            profile_->record(path_.empty() ? "*" : path_ + ".*");
+        }
+        return *tag_;
+    }
+
+    /*
+        Returns the underlying Tag as T, e.g. get<TagInt>().getValue()
+        @throw std::bad_cast if the tag is not a T
+    */
+    template <typename T>
+    const T &get() const {
+        return dynamic_cast<const T &>(tag());
+    }
+
+private:
+    template <typename T>
+    const T &as() const {
+        return dynamic_cast<const T &>(*tag_);
+    }
+
+private:
+    const Tag *tag_;
+    AccessProfile *profile_;
+    std::string path_;
+};
+
+/*
+    BufferStream materializing only the paths of a Projection. Entries and
+    list elements outside of it are stepped over with skipPayload.
+*/
+class ProjectedStream : public BufferStream {
+public:
+    ProjectedStream(const char *data, size_t size,
+                    const Projection &projection)
+        : BufferStream(data, size), stack_{&projection.root()} {
+    }
+
+    bool decodeCompound(
+        std::unordered_map<std::string, std::unique_ptr<Tag>> &out) override {
+        const auto node = stack_.back();
+        if (node->whole()) {
+            return false;
+        }
+        std::istream &in = *this;
+        for (auto type = readStream<TagType>(in); type != TagType::TAG_END;
+             type = readStream<TagType>(in)) {
+            auto name = readStream<std::string>(in);
+            auto child = node->child(name);
+            if (child == nullptr) {
+                seek(static_cast<size_t>(
+                    skipPayload(type, data() + position(), data() + size()) -
+                    data()));
+                continue;
+            }
+            stack_.push_back(child);
+            auto tag = makeTag(type, name, in);
+            stack_.pop_back();
+            out.insert({std::move(name), std::move(tag)});
+        }
+        return true;
+    }
+
+    bool decodeList(TagType elemType, int32_t length,
+                    std::vector<std::unique_ptr<Tag>> &out) override {
+        const auto node = stack_.back();
+        auto child = node->child("[]");
+        if (node->whole() || child == nullptr) {
+            return false;
+        }
+        std::istream &in = *this;
+        stack_.push_back(child);
+        out.resize(static_cast<size_t>(length));
+        for (auto &elem : out) {
+            elem = makeTag(elemType, in);
+        }
+        stack_.pop_back();
+        return true;
+    }
+
+private:
+    std::vector<const Projection::Node *> stack_;
+};
+
+/*
+    Returns the root Tag of a document held in memory, with only the
+    projected paths decoded
+    @param data the document
+    @param size size of the document in bytes
+    @param projection paths to decode, relative to the root compound
+    @return the unique pointer of Tag
+*/
+inline std::unique_ptr<Tag> readDocument(const char *data, size_t size,
+                                         const Projection &projection) {
+    ProjectedStream stream(data, size, projection);
+    return readDocument(stream);
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,661 @@
+/**
+    Append-only NBT record log
+    @file record_log.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <system_error>
+
+#include "batch.hpp"
+#include "compression.hpp"
+#include "durable.hpp"
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+enum class RecordCompression : uint8_t {
+    NONE = 0,
+    LZ4 = 1,
+};
+
+struct RecordLogOptions {
+    // Encoded bytes gathered before a block is sealed and written
+    size_t blockSize = 64 << 10;
+    // Bytes written to a segment before the next one is started
+    size_t segmentSize = 64 << 20;
+    RecordCompression compression = RecordCompression::LZ4;
+};
+
+/*
+    On-disk layout shared by RecordLog and its readers. A log is a
+    directory of segments named after their first sequence number. A
+    segment is a run of blocks, each made of a header and the records it
+    holds, stored compressed or not:
+
+        u32 magic, u32 stored size, u32 raw size, u32 record count,
+        u64 first sequence, u8 compression, 3 bytes padding,
+        u32 CRC-32 of the header up to here and the stored bytes
+
+    Inside a block every record is a u32 length followed by one NBT
+    document. All integers are big endian, like NBT. Next to each segment
+    an index file lists the first sequence and offset of every block as
+    two u64, so a replay can start in the middle of a segment.
+*/
+namespace record_log {
+
+
+constexpr uint32_t MAGIC = 0x4e42544c;
+constexpr size_t HEADER = 32;
+constexpr size_t INDEX_ENTRY = 16;
+
+struct BlockHeader {
+    uint32_t storedSize;
+    uint32_t rawSize;
+    uint32_t count;
+    uint64_t firstSequence;
+    RecordCompression compression;
+};
+
+struct IndexEntry {
+    uint64_t firstSequence;
+    uint64_t offset;
+};
+
+template <typename T>
+void put(std::string &out, T val) {
+    val = endian::refineBigEndian<T>(val);
+    out.append(reinterpret_cast<const char *>(&val), sizeof(val));
+}
+
+inline uint32_t checksum(const char *header, const char *stored,
+                         size_t storedSize) {
+    auto crc = ::crc32(0L, reinterpret_cast<const Bytef *>(header),
+                       static_cast<uInt>(HEADER - 4));
+    return static_cast<uint32_t>(
+        ::crc32(crc, reinterpret_cast<const Bytef *>(stored),
+                static_cast<uInt>(storedSize)));
+}
+
+inline std::string segmentName(uint64_t firstSequence) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu.seg",
+                  static_cast<unsigned long long>(firstSequence));
+    return name;
+}
+
+inline std::string indexPath(const std::string &segment) {
+    return segment.substr(0, segment.size() - 4) + ".idx";
+}
+
+/*
+    Returns the segments of a log directory, oldest first
+*/
+inline std::vector<std::string> listSegments(const std::string &dir) {
+    std::vector<std::string> out;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".seg") {
+            out.push_back(entry.path().string());
+        }
+    }
+    // Names are zero padded, so the lexical order is the sequence order
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+/*
+    Parses the header of the block at p
+    @param available bytes from p to the end of the segment
+    @return false if there is no whole block at p
+*/
+inline bool readHeader(const char *p, size_t available, BlockHeader &h) {
+    if (available < HEADER || readBuffer<uint32_t>(p) != MAGIC) {
+        return false;
+    }
+    h.storedSize = readBuffer<uint32_t>(p + 4);
+    h.rawSize = readBuffer<uint32_t>(p + 8);
+    h.count = readBuffer<uint32_t>(p + 12);
+    h.firstSequence = readBuffer<uint64_t>(p + 16);
+    h.compression = static_cast<RecordCompression>(p[24]);
+    return available - HEADER >= h.storedSize;
+}
+
+/*
+    Returns true if the block at p matches its checksum
+*/
+inline bool verify(const char *p, const BlockHeader &h) {
+    return readBuffer<uint32_t>(p + 28) ==
+           checksum(p, p + HEADER, h.storedSize);
+}
+
+/*
+    Returns the index of the intact blocks of a segment. Entries of the
+    index file are followed as long as they chain up block after block;
+    blocks past them are found by walking the segment, which stops at the
+    first block cut short or failing its checksum.
+    @param data the segment
+    @param size size of the segment
+    @param end set to the end of the last intact block
+*/
+inline std::vector<IndexEntry> buildIndex(const std::string &segment,
+                                          const char *data, size_t size,
+                                          size_t &end) {
+    std::vector<IndexEntry> index;
+    std::ifstream file(indexPath(segment), std::ios::binary);
+    char entry[INDEX_ENTRY];
+    BlockHeader h{};
+    BlockHeader last{};
+    end = 0;
+    while (file.read(entry, sizeof(entry))) {
+        IndexEntry e{readBuffer<uint64_t>(entry),
+                     readBuffer<uint64_t>(entry + 8)};
+        if (e.offset != end || !readHeader(data + end, size - end, h) ||
+            h.firstSequence != e.firstSequence) {
+            break;
+        }
+        index.push_back(e);
+        last = h;
+        end += HEADER + h.storedSize;
+    }
+    // The last indexed block may be the one a crash interrupted
+    if (!index.empty() && !verify(data + index.back().offset, last)) {
+        end = index.back().offset;
+        index.pop_back();
+    }
+    while (readHeader(data + end, size - end, h) && verify(data + end, h)) {
+        index.push_back({h.firstSequence, end});
+        end += HEADER + h.storedSize;
+    }
+    return index;
+}
+
+
+}  // namespace record_log
+
+/*
+    Read-only, memory mapped view of one segment of a record log
+*/
+class LogSegment {
+public:
+    explicit LogSegment(const std::string &path) : path_(path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "LogSegment: " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(),
+                                    "LogSegment: " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(),
+                                        "LogSegment: " + path);
+            }
+            data_ = static_cast<const char *>(p);
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+        index_ = record_log::buildIndex(path, data_, size_, end_);
+    }
+
+    LogSegment(const LogSegment &) = delete;
+    LogSegment &operator=(const LogSegment &) = delete;
+
+    ~LogSegment() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    const std::string &path() const {
+        return path_;
+    }
+
+    const std::vector<record_log::IndexEntry> &index() const {
+        return index_;
+    }
+
+    /*
+        Returns the sequence number in the segment name
+    */
+    uint64_t firstSequence() const {
+        return std::stoull(std::filesystem::path(path_).stem().string());
+    }
+
+    /*
+        Returns the sequence number following the last intact record
+    */
+    uint64_t nextSequence() const {
+        if (index_.empty()) {
+            return firstSequence();
+        }
+        record_log::BlockHeader h{};
+        record_log::readHeader(data_ + index_.back().offset,
+                               size_ - index_.back().offset, h);
+        return h.firstSequence + h.count;
+    }
+
+    /*
+        Returns the size of the intact blocks, smaller than the file when
+        a crash interrupted a write
+    */
+    size_t validSize() const {
+        return end_;
+    }
+
+    /*
+        Calls fn(uint64_t sequence, std::string_view document) for every
+        record from a sequence number on, in order
+        @param from the first sequence number wanted
+    */
+    template <typename Fn>
+    void forEach(uint64_t from, Fn fn) const {
+        auto it = std::upper_bound(
+            index_.begin(), index_.end(), from,
+            [](uint64_t seq, const record_log::IndexEntry &e) {
+                return seq < e.firstSequence;
+            });
+        if (it != index_.begin()) {
+            --it;
+        }
+        std::string raw;
+        for (; it != index_.end(); ++it) {
+            record_log::BlockHeader h;
+            const char *block = data_ + it->offset;
+            if (!record_log::readHeader(block, size_ - it->offset, h) ||
+                !record_log::verify(block, h)) {
+                throw std::runtime_error("LogSegment: " + path_ +
+                                         " has a corrupted block");
+            }
+            const char *stored = block + record_log::HEADER;
+            std::string_view records(stored, h.storedSize);
+            if (h.compression == RecordCompression::LZ4) {
+                raw = lz4Uncompress(stored, h.storedSize, h.rawSize);
+                records = raw;
+            } else if (h.compression != RecordCompression::NONE) {
+                throw std::runtime_error("LogSegment: " + path_ +
+                                         " has an unknown compression");
+            }
+            forEachRecord(h, records, from, fn);
+        }
+    }
+
+private:
+    template <typename Fn>
+    void forEachRecord(const record_log::BlockHeader &h,
+                       std::string_view records, uint64_t from,
+                       Fn fn) const {
+        size_t pos = 0;
+        for (uint32_t i = 0; i < h.count; ++i) {
+            if (records.size() - pos < 4) {
+                throw std::runtime_error("LogSegment: " + path_ +
+                                         " has a malformed block");
+            }
+            const auto len = readBuffer<uint32_t>(records.data() + pos);
+            pos += 4;
+            if (records.size() - pos < len) {
+                throw std::runtime_error("LogSegment: " + path_ +
+                                         " has a malformed block");
+            }
+            if (h.firstSequence + i >= from) {
+                fn(h.firstSequence + i, records.substr(pos, len));
+            }
+            pos += len;
+        }
+    }
+
+private:
+    std::string path_;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t end_ = 0;
+    std::vector<record_log::IndexEntry> index_;
+};
+
+/*
+    Writer of a record log. Records get consecutive sequence numbers and
+    are gathered into blocks, compressed and checksummed one block at a
+    time. Opening an existing log drops a torn block left by a crash and
+    continues after the last intact record. Safe to append from several
+    threads.
+*/
+class RecordLog {
+public:
+    /*
+        @param dir the log directory, created if missing
+        @param options block, segment and compression settings
+    */
+    explicit RecordLog(const std::string &dir, RecordLogOptions options = {})
+        : dir_(dir), options_(options) {
+        std::filesystem::create_directories(dir);
+        auto segments = record_log::listSegments(dir);
+        if (!segments.empty()) {
+            recover(segments.back());
+        }
+    }
+
+    RecordLog(const RecordLog &) = delete;
+    RecordLog &operator=(const RecordLog &) = delete;
+
+    ~RecordLog() {
+        try {
+            flush();
+        } catch (...) {
+            // Destructors must not throw; call flush to see errors
+        }
+        closeSegment();
+    }
+
+    /*
+        Appends a document
+        @return the sequence number of the record
+    */
+    uint64_t append(const Tag &doc) {
+        std::ostringstream out;
+        writeDocument(out, doc);
+        return append(out.str());
+    }
+
+    /*
+        Appends an encoded document
+        @return the sequence number of the record
+    */
+    uint64_t append(std::string_view document) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (document.size() > UINT32_MAX) {
+            throw std::length_error("RecordLog: record too large");
+        }
+        record_log::put<uint32_t>(pending_,
+                                  static_cast<uint32_t>(document.size()));
+        pending_.append(document);
+        ++pendingCount_;
+        const uint64_t seq = next_++;
+        if (pending_.size() >= options_.blockSize) {
+            seal();
+        }
+        return seq;
+    }
+
+    /*
+        Writes the records gathered so far as a block
+    */
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seal();
+    }
+
+    /*
+        Flushes, then waits until the segment and its index are on disk
+    */
+    void sync() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seal();
+        if (fd_ >= 0 && (::fdatasync(fd_) != 0 || ::fdatasync(indexFd_) != 0)) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "RecordLog: " + dir_);
+        }
+    }
+
+    /*
+        Returns the sequence number of the next record
+    */
+    uint64_t nextSequence() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return next_;
+    }
+
+private:
+    void recover(const std::string &segment) {
+        size_t end = 0;
+        {
+            LogSegment view(segment);
+            end = view.validSize();
+            next_ = view.nextSequence();
+            rewriteIndex(segment, view.index());
+        }
+        if (std::filesystem::file_size(segment) > end) {
+            std::filesystem::resize_file(segment, end);
+        }
+        if (end > 0) {
+            openSegment(segment);
+            segmentBytes_ = end;
+        }
+    }
+
+    static void rewriteIndex(const std::string &segment,
+                             const std::vector<record_log::IndexEntry> &idx) {
+        std::string bytes;
+        for (const auto &e : idx) {
+            record_log::put<uint64_t>(bytes, e.firstSequence);
+            record_log::put<uint64_t>(bytes, e.offset);
+        }
+        replaceFile(record_log::indexPath(segment), bytes);
+    }
+
+    void openSegment(const std::string &path) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                     0644);
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "RecordLog: " + path);
+        }
+        const auto index = record_log::indexPath(path);
+        indexFd_ = ::open(index.c_str(),
+                          O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (indexFd_ < 0) {
+            int err = errno;
+            closeSegment();
+            throw std::system_error(err, std::generic_category(),
+                                    "RecordLog: " + index);
+        }
+        segmentBytes_ = 0;
+    }
+
+    void closeSegment() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            ::close(indexFd_);
+            fd_ = -1;
+            indexFd_ = -1;
+        }
+    }
+
+    static void writeAll(int fd, const std::string &bytes,
+                         const std::string &what) {
+        size_t written = 0;
+        while (written < bytes.size()) {
+            auto n = ::write(fd, bytes.data() + written,
+                             bytes.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw std::system_error(errno, std::generic_category(),
+                                        "RecordLog: " + what);
+            }
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    void seal() {
+        if (pendingCount_ == 0) {
+            return;
+        }
+        const uint64_t first = next_ - pendingCount_;
+        if (fd_ >= 0 && segmentBytes_ >= options_.segmentSize) {
+            closeSegment();
+        }
+        if (fd_ < 0) {
+            openSegment((std::filesystem::path(dir_) /
+                         record_log::segmentName(first))
+                            .string());
+            // Without this a crash may lose the new files even after a
+            // sync of their contents
+            syncDirectory(dir_);
+        }
+
+        auto compression = options_.compression;
+        std::string compressed;
+        if (compression == RecordCompression::LZ4) {
+            compressed = lz4Compress(pending_.data(), pending_.size());
+            if (compressed.size() >= pending_.size()) {
+                compression = RecordCompression::NONE;
+            }
+        }
+        const std::string &stored =
+            compression == RecordCompression::NONE ? pending_ : compressed;
+
+        std::string block;
+        block.reserve(record_log::HEADER + stored.size());
+        record_log::put<uint32_t>(block, record_log::MAGIC);
+        record_log::put<uint32_t>(block, static_cast<uint32_t>(stored.size()));
+        record_log::put<uint32_t>(block,
+                                  static_cast<uint32_t>(pending_.size()));
+        record_log::put<uint32_t>(block, pendingCount_);
+        record_log::put<uint64_t>(block, first);
+        block += static_cast<char>(compression);
+        block.append(3, '\0');
+        record_log::put<uint32_t>(
+            block,
+            record_log::checksum(block.data(), stored.data(), stored.size()));
+        block += stored;
+
+        std::string entry;
+        record_log::put<uint64_t>(entry, first);
+        record_log::put<uint64_t>(entry, segmentBytes_);
+        writeAll(fd_, block, dir_);
+        writeAll(indexFd_, entry, dir_);
+        segmentBytes_ += block.size();
+        pending_.clear();
+        pendingCount_ = 0;
+    }
+
+private:
+    std::string dir_;
+    RecordLogOptions options_;
+    mutable std::mutex mutex_;
+    int fd_ = -1;
+    int indexFd_ = -1;
+    size_t segmentBytes_ = 0;
+    uint64_t next_ = 0;
+    std::string pending_;
+    uint32_t pendingCount_ = 0;
+};
+
+/*
+    Reader of a record log directory. Segments are memory mapped when a
+    replay or scan reaches them.
+*/
+class RecordLogReader {
+public:
+    explicit RecordLogReader(const std::string &dir)
+        : segments_(record_log::listSegments(dir)) {
+    }
+
+    const std::vector<std::string> &segments() const {
+        return segments_;
+    }
+
+    /*
+        Calls fn(uint64_t sequence, std::string_view document) for every
+        record from a sequence number on, in order
+        @param from the first sequence number wanted, found through the
+               segment names and indexes
+    */
+    template <typename Fn>
+    void replay(uint64_t from, Fn fn) const {
+        size_t first = 0;
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            if (sequenceOf(segments_[i]) <= from) {
+                first = i;
+            }
+        }
+        for (size_t i = first; i < segments_.size(); ++i) {
+            LogSegment(segments_[i]).forEach(from, fn);
+        }
+    }
+
+    /*
+        Decodes every record on the pool, one task per segment
+        @param pool the pool running the tasks
+        @param visit called as visit(State &, uint64_t sequence,
+               const Tag &) for every record
+        @param merge called as merge(State &total, State &&partial), in
+               segment order
+        @param priority the queue of the tasks
+        @return the merged State
+    */
+    template <typename State, typename Visit, typename Merge>
+    State scan(ThreadPool &pool, Visit visit, Merge merge,
+               Priority priority = Priority::BACKGROUND) const {
+        std::vector<std::future<State>> futures;
+        for (const auto &path : segments_) {
+            futures.push_back(pool.submit(
+                [&visit, &pool, path] {
+                    State partial{};
+                    BatchDecodeStream stream;
+                    LogSegment(path).forEach(
+                        0, [&](uint64_t seq, std::string_view document) {
+                            visit(partial, seq, *stream.read(document));
+                            pool.preempt();
+                        });
+                    return partial;
+                },
+                priority));
+        }
+
+        State total{};
+        std::exception_ptr error;
+        for (auto &fut : futures) {
+            try {
+                merge(total, pool.wait(fut));
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return total;
+    }
+
+private:
+    static uint64_t sequenceOf(const std::string &segment) {
+        return std::stoull(std::filesystem::path(segment).stem().string());
+    }
+
+private:
+    std::vector<std::string> segments_;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,629 @@
+/**
+    Region file and world reader
+    @file region.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <system_error>
+
+#include "compression.hpp"
+#include "control.hpp"
+#include "durable.hpp"
+#include "metrics.hpp"
+#include "nbt.hpp"
+#include "thread_pool.hpp"
+#include "throttle.hpp"
+#include "topology.hpp"
+
+
+namespace nbt {
+
+
+struct ChunkPos {
+    int32_t x;
+    int32_t z;
+};
+
+inline bool operator==(const ChunkPos &a, const ChunkPos &b) {
+    return a.x == b.x && a.z == b.z;
+}
+
+inline bool operator!=(const ChunkPos &a, const ChunkPos &b) {
+    return !(a == b);
+}
+
+enum class ChunkCompression : uint8_t {
+    GZIP = 1,
+    ZLIB = 2,
+    NONE = 3,
+    LZ4 = 4,
+};
+
+/*
+    Reader of an Anvil region file (r.<x>.<z>.mca) holding 32x32 chunks.
+    Reads use pread, so one RegionFile can serve several threads.
+*/
+class RegionFile {
+public:
+    static constexpr int CHUNKS = 32;
+    static constexpr size_t SECTOR = 4096;
+
+    /*
+        @param path the region file
+        @param limiter throttles chunk reads when set, must outlive this
+    */
+    explicit RegionFile(const std::string &path,
+                        IoLimiter *limiter = nullptr)
+        : path_(path), limiter_(limiter) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "RegionFile: " + path);
+        }
+        std::array<char, SECTOR> header;
+        if (::pread(fd_, header.data(), header.size(), 0) !=
+            static_cast<ssize_t>(header.size())) {
+            ::close(fd_);
+            throw std::runtime_error("RegionFile: " + path +
+                                     " has no location table");
+        }
+        for (size_t i = 0; i < locations_.size(); ++i) {
+            locations_[i] = readBuffer<uint32_t>(header.data() + i * 4);
+        }
+        parseName();
+    }
+
+    RegionFile(const RegionFile &) = delete;
+    RegionFile &operator=(const RegionFile &) = delete;
+
+    ~RegionFile() {
+        ::close(fd_);
+    }
+
+    const std::string &path() const {
+        return path_;
+    }
+
+    /*
+        Returns the region coordinates parsed from the file name, (0, 0)
+        if the name does not follow r.<x>.<z>.mca
+    */
+    ChunkPos regionPos() const {
+        return region_;
+    }
+
+    bool hasChunk(int localX, int localZ) const {
+        return location(localX, localZ) != 0;
+    }
+
+    /*
+        Returns the decompressed NBT bytes of a chunk
+        @param localX chunk x inside the region, 0 to 31
+        @param localZ chunk z inside the region, 0 to 31
+        @return the bytes, empty if the chunk is absent
+    */
+    std::string readChunkData(int localX, int localZ) const {
+        auto loc = location(localX, localZ);
+        if (loc == 0) {
+            return std::string();
+        }
+        const size_t offset = static_cast<size_t>(loc >> 8) * SECTOR;
+        const size_t sectors = loc & 0xff;
+        auto &buffer = scratchBuffer(sectors * SECTOR);
+        const char *raw = buffer.data();
+        if (limiter_ != nullptr) {
+            limiter_->acquire(sectors * SECTOR);
+        }
+        const auto start = IoLimiter::Clock::now();
+        auto got = ::pread(fd_, buffer.data(), sectors * SECTOR,
+                           static_cast<off_t>(offset));
+        if (limiter_ != nullptr) {
+            limiter_->record(IoLimiter::Clock::now() - start);
+        }
+        if (auto metrics = libraryMetrics().load(std::memory_order_acquire)) {
+            metrics->ioReads.add();
+            metrics->ioBytes.add(got > 0 ? static_cast<uint64_t>(got) : 0);
+        }
+        if (got < 5) {
+            throw std::runtime_error("RegionFile: " + path_ +
+                                     " chunk sectors out of file");
+        }
+        const size_t length = readBuffer<uint32_t>(raw);
+        if (length == 0 || length + 4 > static_cast<size_t>(got)) {
+            throw std::runtime_error("RegionFile: " + path_ +
+                                     " chunk length out of sectors");
+        }
+        auto compression = static_cast<ChunkCompression>(raw[4]);
+        const char *payload = raw + 5;
+        const size_t payloadSize = length - 1;
+        switch (compression) {
+        case ChunkCompression::GZIP:
+        case ChunkCompression::ZLIB:
+            return inflateBuffer(payload, payloadSize);
+        case ChunkCompression::NONE:
+            return std::string(payload, payloadSize);
+        default:
+            throw std::runtime_error(
+                "RegionFile: " + path_ + " chunk compression " +
+                std::to_string(static_cast<int>(compression)) +
+                " not supported");
+        }
+    }
+
+    /*
+        Returns the root Tag of a chunk, nullptr if the chunk is absent
+        @param control checked within large lists of the chunk, optional
+    */
+    std::unique_ptr<Tag> readChunk(int localX, int localZ,
+                                   const ScanControl *control = nullptr) const {
+        auto metrics = libraryMetrics().load(std::memory_order_acquire);
+        const auto start = std::chrono::steady_clock::now();
+        auto data = readChunkData(localX, localZ);
+        if (data.empty()) {
+            return nullptr;
+        }
+        ControlledStream stream(data.data(), data.size(), control);
+        auto chunk = readDocument(stream);
+        if (metrics != nullptr) {
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            metrics->chunkLoad.observe(elapsed.count());
+            metrics->decodeBytes.add(data.size());
+            metrics->decodeTags.add(stream.tags() + 1);
+        }
+        return chunk;
+    }
+
+    /*
+        Loads a chunk on the pool. Chunk loads default to INTERACTIVE so
+        they overtake background scans queued on the same pool.
+    */
+    std::future<std::unique_ptr<Tag>> loadChunk(
+        ThreadPool &pool, int localX, int localZ,
+        Priority priority = Priority::INTERACTIVE) const {
+        return pool.submit(
+            [this, localX, localZ] { return readChunk(localX, localZ); },
+            priority);
+    }
+
+    /*
+        Calls fn(ChunkPos, const Tag &) for every present chunk in file
+        order, with absolute chunk coordinates
+        @param control checked before every chunk, counts chunks and bytes
+    */
+    template <typename Fn>
+    void forEachChunk(Fn fn, const ScanControl &control = {}) const {
+        std::array<int, CHUNKS * CHUNKS> order;
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = static_cast<int>(i);
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return locations_[a] >> 8 < locations_[b] >> 8;
+        });
+        for (auto i : order) {
+            if (locations_[i] == 0) {
+                continue;
+            }
+            control.check();
+            const int localX = i % CHUNKS;
+            const int localZ = i / CHUNKS;
+            auto chunk = readChunk(localX, localZ, &control);
+            control.addBytes((locations_[i] & 0xff) * SECTOR);
+            fn(ChunkPos{region_.x * CHUNKS + localX,
+                        region_.z * CHUNKS + localZ},
+               *chunk);
+            control.addChunks(1);
+        }
+    }
+
+private:
+    uint32_t location(int localX, int localZ) const {
+        if (localX < 0 || localX >= CHUNKS || localZ < 0 ||
+            localZ >= CHUNKS) {
+            throw std::out_of_range("RegionFile: chunk out of region");
+        }
+        return locations_[localZ * CHUNKS + localX];
+    }
+
+    void parseName() {
+        auto name = std::filesystem::path(path_).filename().string();
+        int x = 0;
+        int z = 0;
+        char tail = 0;
+        if (std::sscanf(name.c_str(), "r.%d.%d.mc%c", &x, &z, &tail) == 3) {
+            region_ = {x, z};
+        }
+    }
+
+private:
+    std::string path_;
+    IoLimiter *limiter_;
+    int fd_ = -1;
+    ChunkPos region_{0, 0};
+    std::array<uint32_t, CHUNKS * CHUNKS> locations_{};
+};
+
+/*
+    Returns the region files (r.<x>.<z>.mca) of a region directory, sorted
+*/
+inline std::vector<std::string> listRegionFiles(const std::string &dir) {
+    std::vector<std::string> files;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        const auto name = entry.path().filename().string();
+        if (entry.is_regular_file() && name.size() > 6 &&
+            name.compare(0, 2, "r.") == 0 &&
+            name.compare(name.size() - 4, 4, ".mca") == 0) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+/*
+    Progress journal of a resumable WorldScanner::scan: the region
+    directory, the names of the completed regions and the reducer state
+    merged from them, stored as a small NBT document. The state is
+    converted through user hooks, so any State that can be expressed as a
+    Tag can be journaled.
+
+    Saving is split in two so that a scan only holds its merge lock while
+    the state is serialized: snapshot encodes the journal in memory, write
+    puts it on disk. Writes may come from several threads; a snapshot
+    older than the last one written is dropped.
+*/
+template <typename State>
+class ScanJournal {
+public:
+    using Serialize = std::function<std::unique_ptr<Tag>(const State &)>;
+    using Deserialize = std::function<State(const Tag &)>;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int32_t VERSION = 2;
+
+    /*
+        Encoded journal, ready to be written
+    */
+    struct Snapshot {
+        uint64_t sequence = 0;
+        std::string bytes;
+    };
+
+    /*
+        @param path the journal file, replaced atomically on every save
+        @param serialize converts the merged State into a Tag
+        @param deserialize converts a saved Tag back into a State
+        @param interval minimum time between two saves during a scan
+    */
+    ScanJournal(std::string path, Serialize serialize,
+                Deserialize deserialize,
+                Clock::duration interval = std::chrono::seconds(30))
+        : path_(std::move(path)),
+          serialize_(std::move(serialize)),
+          deserialize_(std::move(deserialize)),
+          interval_(interval) {
+    }
+
+    const std::string &path() const {
+        return path_;
+    }
+
+    /*
+        Reads the journal file if it exists
+        @param dir the region directory about to be scanned
+        @param state set to the saved State
+        @param done set to the names of the completed regions
+        @return false if there is no journal to resume from
+        @throw std::runtime_error if the journal is of another directory
+    */
+    bool load(const std::string &dir, State &state,
+              std::set<std::string> &done) const {
+        if (!std::filesystem::exists(path_)) {
+            return false;
+        }
+        std::ifstream file(path_, std::ios::binary);
+        auto doc = readDocument(file);
+        const auto &root = static_cast<const TagCompound &>(*doc).getValue();
+        auto version = root.find("version");
+        auto savedDir = root.find("dir");
+        auto regions = root.find("regions");
+        auto saved = root.find("state");
+        if (version == root.end() || savedDir == root.end() ||
+            regions == root.end() || saved == root.end() ||
+            version->second->getTagType() != TagType::TAG_INT ||
+            savedDir->second->getTagType() != TagType::TAG_STRING ||
+            regions->second->getTagType() != TagType::TAG_LIST ||
+            static_cast<const TagInt &>(*version->second).getValue() !=
+                VERSION) {
+            throw std::runtime_error("ScanJournal: " + path_ +
+                                     " is not a scan journal");
+        }
+        const auto &journaled =
+            static_cast<const TagString &>(*savedDir->second).getValue();
+        if (journaled != canonical(dir)) {
+            throw std::runtime_error("ScanJournal: " + path_ +
+                                     " is the journal of " + journaled);
+        }
+        done.clear();
+        for (const auto &name :
+             static_cast<const TagList &>(*regions->second).getValue()) {
+            if (name->getTagType() != TagType::TAG_STRING) {
+                throw std::runtime_error("ScanJournal: " + path_ +
+                                         " is not a scan journal");
+            }
+            done.insert(static_cast<const TagString &>(*name).getValue());
+        }
+        state = deserialize_(*saved->second);
+        return true;
+    }
+
+    /*
+        Returns the encoded journal of a scan. Call it with the state
+        locked; it does no I/O.
+        @param dir the region directory being scanned
+        @param state the merged State
+        @param done the names of the completed regions
+    */
+    Snapshot snapshot(const std::string &dir, const State &state,
+                      const std::set<std::string> &done) {
+        std::vector<std::unique_ptr<Tag>> names;
+        names.reserve(done.size());
+        for (const auto &name : done) {
+            names.push_back(std::make_unique<TagString>(std::nullopt, name));
+        }
+        std::unordered_map<std::string, std::unique_ptr<Tag>> root;
+        root["version"] = std::make_unique<TagInt>(std::nullopt, VERSION);
+        root["dir"] = std::make_unique<TagString>(std::nullopt, canonical(dir));
+        root["regions"] = std::make_unique<TagList>(
+            std::nullopt, TagType::TAG_STRING, std::move(names));
+        root["state"] = serialize_(state);
+
+        std::ostringstream out;
+        writeDocument(out, TagCompound("", std::move(root)));
+        lastSnapshot_ = Clock::now();
+        return {++sequence_, out.str()};
+    }
+
+    /*
+        Returns a snapshot if the interval has passed since the last one
+    */
+    std::optional<Snapshot> snapshotIfDue(const std::string &dir,
+                                          const State &state,
+                                          const std::set<std::string> &done) {
+        if (Clock::now() - lastSnapshot_ < interval_) {
+            return std::nullopt;
+        }
+        return snapshot(dir, state, done);
+    }
+
+    /*
+        Replaces the journal with a snapshot through replaceFile, so a
+        crash leaves either journal intact. Does nothing if a newer
+        snapshot was written already.
+    */
+    void write(const Snapshot &snapshot) {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        if (snapshot.sequence <= written_) {
+            return;
+        }
+        replaceFile(path_, snapshot.bytes);
+        written_ = snapshot.sequence;
+    }
+
+    /*
+        Snapshots and writes the journal at once
+    */
+    void save(const std::string &dir, const State &state,
+              const std::set<std::string> &done) {
+        write(snapshot(dir, state, done));
+    }
+
+private:
+    /*
+        Returns the form of a directory stored in the journal
+    */
+    static std::string canonical(const std::string &dir) {
+        auto path = std::filesystem::absolute(dir).lexically_normal();
+        if (!path.has_filename() && path.has_relative_path()) {
+            path = path.parent_path();
+        }
+        return path.string();
+    }
+
+private:
+    std::string path_;
+    Serialize serialize_;
+    Deserialize deserialize_;
+    Clock::duration interval_;
+    // Guarded by the caller's lock on the state
+    Clock::time_point lastSnapshot_ = Clock::now();
+    uint64_t sequence_ = 0;
+    std::mutex writeMutex_;
+    uint64_t written_ = 0;
+};
+
+/*
+    Scans every chunk of a region directory on a thread pool. Each region
+    is one BACKGROUND task that folds its chunks into a partial State;
+    partials are merged in region order once all tasks have finished.
+    Between chunks a task calls ThreadPool::preempt, so interactive work
+    queued on the same pool is not held up by a long scan.
+*/
+class WorldScanner {
+public:
+    explicit WorldScanner(ThreadPool &pool,
+                          Priority priority = Priority::BACKGROUND)
+        : pool_(pool), priority_(priority) {
+    }
+
+    /*
+        Throttles the chunk reads of later scans; the limiter must outlive
+        them and may be retuned while they run
+    */
+    void setLimiter(IoLimiter *limiter) {
+        limiter_ = limiter;
+    }
+
+    /*
+        @param dir the region directory
+        @param visit called as visit(State &, ChunkPos, const Tag &),
+               concurrently for chunks of different regions
+        @param merge called as merge(State &total, State &&partial)
+        @param control cancellation, deadline and progress of the scan
+        @return the merged State
+    */
+    template <typename State, typename Visit, typename Merge>
+    State scan(const std::string &dir, Visit visit, Merge merge,
+               const ScanControl &control = {}) {
+        const auto files = listRegionFiles(dir);
+        std::vector<std::future<State>> futures;
+        futures.reserve(files.size());
+        for (const auto &file : files) {
+            futures.push_back(pool_.submit(
+                [this, &file, &visit, &control] {
+                    control.check();
+                    State partial{};
+                    RegionFile region(file, limiter_);
+                    region.forEachChunk(
+                        [&](ChunkPos pos, const Tag &chunk) {
+                            visit(partial, pos, chunk);
+                            pool_.preempt();
+                        },
+                        control);
+                    control.addRegions(1);
+                    return partial;
+                },
+                priority_));
+        }
+
+        State total{};
+        std::exception_ptr error;
+        for (auto &fut : futures) {
+            try {
+                merge(total, pool_.wait(fut));
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return total;
+    }
+
+    /*
+        Resumable scan. Regions recorded in the journal are skipped without
+        being opened and the saved State is the starting total. Partials
+        are merged as regions complete, so merge should not depend on the
+        region order; the journal is saved at its interval and once more
+        when the scan ends, successfully or not. Only the encoding of the
+        journal happens under the merge lock, writing it does not.
+        @param dir the region directory
+        @param visit called as visit(State &, ChunkPos, const Tag &)
+        @param merge called as merge(State &total, State &&partial)
+        @param journal the journal to resume from and save to
+        @param control cancellation, deadline and progress of the scan
+        @return the merged State
+    */
+    template <typename State, typename Visit, typename Merge>
+    State scan(const std::string &dir, Visit visit, Merge merge,
+               ScanJournal<State> &journal, const ScanControl &control = {}) {
+        State total{};
+        std::set<std::string> done;
+        journal.load(dir, total, done);
+
+        std::mutex mutex;
+        std::vector<std::future<void>> futures;
+        for (const auto &file : listRegionFiles(dir)) {
+            auto name = std::filesystem::path(file).filename().string();
+            if (done.count(name) != 0) {
+                continue;
+            }
+            futures.push_back(pool_.submit(
+                [&, file, name] {
+                    control.check();
+                    State partial{};
+                    RegionFile region(file, limiter_);
+                    region.forEachChunk(
+                        [&](ChunkPos pos, const Tag &chunk) {
+                            visit(partial, pos, chunk);
+                            pool_.preempt();
+                        },
+                        control);
+                    control.addRegions(1);
+
+                    std::optional<typename ScanJournal<State>::Snapshot>
+                        snapshot;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        merge(total, std::move(partial));
+                        done.insert(name);
+                        snapshot = journal.snapshotIfDue(dir, total, done);
+                    }
+                    if (snapshot) {
+                        journal.write(*snapshot);
+                    }
+                },
+                priority_));
+        }
+
+        std::exception_ptr error;
+        for (auto &fut : futures) {
+            try {
+                pool_.wait(fut);
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        journal.save(dir, total, done);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return total;
+    }
+
+private:
+    ThreadPool &pool_;
+    const Priority priority_;
+    IoLimiter *limiter_ = nullptr;
+};
+
+
+}  // namespace nbt
+
+
+namespace std {
+
+
+template <>
+struct hash<nbt::ChunkPos> {
+    size_t operator()(const nbt::ChunkPos &pos) const noexcept {
+        return hash<uint64_t>()(
+            static_cast<uint64_t>(static_cast<uint32_t>(pos.x)) << 32 |
+            static_cast<uint32_t>(pos.z));
+    }
+};
+
+
+}  // namespace std
@@ -0,0 +1,352 @@
+/**
+    Time sliced decoding
+    @file resumable.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Decoder of one document that does bounded work per call, for threads
+    with a frame budget such as a game tick. Nesting is kept on an explicit
+    stack instead of the call stack, so decoding can stop after any tag and
+    continue on the next call; large arrays are also decoded a piece at a
+    time. The decoder is its own continuation: call step until it returns
+    false, then take the result.
+
+        ResumableDecoder decoder(bytes);
+        // every tick
+        if (decoder.step(std::chrono::microseconds(300))) {
+            return;
+        }
+        auto doc = decoder.result();
+*/
+class ResumableDecoder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Units of work between two reads of the clock
+    static constexpr size_t CLOCK_INTERVAL = 32;
+    // Array elements decoded as one unit of work
+    static constexpr size_t ARRAY_PIECE = 4096;
+
+    /*
+        @param document the document bytes, which must outlive the decoder
+    */
+    explicit ResumableDecoder(std::string_view document)
+        : data_(document.data()), end_(document.data() + document.size()) {
+    }
+
+    ResumableDecoder(const ResumableDecoder &) = delete;
+    ResumableDecoder &operator=(const ResumableDecoder &) = delete;
+
+    /*
+        Decodes until the budget is spent or the document is complete. At
+        least one unit of work is done per call.
+        @param budget time to spend, overrun by at most CLOCK_INTERVAL units
+        @return true if work remains
+    */
+    bool step(Clock::duration budget) {
+        const auto deadline = Clock::now() + budget;
+        for (size_t units = 1; !done(); ++units) {
+            advance();
+            if (units % CLOCK_INTERVAL == 0 && Clock::now() >= deadline) {
+                break;
+            }
+        }
+        return !done();
+    }
+
+    /*
+        Decodes at most a number of units of work, a unit being one tag or
+        one piece of an array
+        @return true if work remains
+    */
+    bool step(size_t units) {
+        for (size_t i = 0; i < std::max<size_t>(units, 1) && !done(); ++i) {
+            advance();
+        }
+        return !done();
+    }
+
+    bool done() const {
+        return root_ != nullptr;
+    }
+
+    /*
+        Returns the bytes consumed so far
+    */
+    size_t position() const {
+        return static_cast<size_t>(p_ - data_);
+    }
+
+    /*
+        Returns the nesting depth of the tag being decoded
+    */
+    size_t depth() const {
+        return stack_.size();
+    }
+
+    /*
+        Returns the root Tag once done, leaving the decoder empty
+    */
+    std::unique_ptr<Tag> result() {
+        if (!done()) {
+            throw std::logic_error("ResumableDecoder: document not complete");
+        }
+        return std::move(root_);
+    }
+
+    /*
+        Decodes the rest of the document at once
+    */
+    std::unique_ptr<Tag> finish() {
+        while (!done()) {
+            advance();
+        }
+        return result();
+    }
+
+private:
+    struct Frame {
+        TagType type;
+        std::optional<std::string> name;
+        // TAG_COMPOUND
+        std::unordered_map<std::string, std::unique_ptr<Tag>> members;
+        // TAG_LIST
+        TagType elemType = TagType::TAG_END;
+        std::vector<std::unique_ptr<Tag>> elems;
+        // TAG_LIST and arrays
+        size_t remaining = 0;
+        std::vector<int8_t> bytes;
+        std::vector<int32_t> ints;
+        std::vector<int64_t> longs;
+    };
+
+    void need(size_t n) const {
+        if (static_cast<size_t>(end_ - p_) < n) {
+            throw UnexpectedEnd("ResumableDecoder: unexpected end of buffer");
+        }
+    }
+
+    template <typename T>
+    T read() {
+        need(sizeof(T));
+        const T val = readBuffer<T>(p_);
+        p_ += sizeof(T);
+        return val;
+    }
+
+    std::string readString() {
+        const auto len = read<uint16_t>();
+        need(len);
+        std::string val(p_, len);
+        p_ += len;
+        return val;
+    }
+
+    size_t readLength() {
+        const auto len = read<int32_t>();
+        return len > 0 ? static_cast<size_t>(len) : 0;
+    }
+
+    /*
+        Does one unit of work on the top of the stack
+    */
+    void advance() {
+        if (stack_.empty()) {
+            if (read<uint8_t>() !=
+                static_cast<uint8_t>(TagType::TAG_COMPOUND)) {
+                throw std::runtime_error(
+                    "ResumableDecoder: document should be a named compound");
+            }
+            begin(TagType::TAG_COMPOUND, readString());
+            return;
+        }
+        auto &top = stack_.back();
+        switch (top.type) {
+        case TagType::TAG_COMPOUND: {
+            const auto type = static_cast<TagType>(read<uint8_t>());
+            if (type == TagType::TAG_END) {
+                close(std::make_unique<TagCompound>(std::move(top.name),
+                                                    std::move(top.members)));
+                return;
+            }
+            begin(type, readString());
+            return;
+        }
+        case TagType::TAG_LIST:
+            if (top.remaining == 0) {
+                close(std::make_unique<TagList>(std::move(top.name),
+                                                top.elemType,
+                                                std::move(top.elems)));
+                return;
+            }
+            --top.remaining;
+            begin(top.elemType, std::nullopt);
+            return;
+        case TagType::TAG_BYTE_ARRAY:
+            if (fill(top.bytes, top.remaining)) {
+                close(std::make_unique<TagByteArray>(std::move(top.name),
+                                                     std::move(top.bytes)));
+            }
+            return;
+        case TagType::TAG_INT_ARRAY:
+            if (fill(top.ints, top.remaining)) {
+                close(std::make_unique<TagIntArray>(std::move(top.name),
+                                                    std::move(top.ints)));
+            }
+            return;
+        default:
+            if (fill(top.longs, top.remaining)) {
+                close(std::make_unique<TagLongArray>(std::move(top.name),
+                                                     std::move(top.longs)));
+            }
+            return;
+        }
+    }
+
+    /*
+        Starts a tag whose header was just read: scalars are decoded and
+        attached at once, containers and arrays get a frame
+    */
+    void begin(TagType type, std::optional<std::string> name) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            attach(std::make_unique<TagByte>(std::move(name), read<int8_t>()));
+            return;
+        case TagType::TAG_SHORT:
+            attach(
+                std::make_unique<TagShort>(std::move(name), read<int16_t>()));
+            return;
+        case TagType::TAG_INT:
+            attach(std::make_unique<TagInt>(std::move(name), read<int32_t>()));
+            return;
+        case TagType::TAG_LONG:
+            attach(
+                std::make_unique<TagLong>(std::move(name), read<int64_t>()));
+            return;
+        case TagType::TAG_FLOAT:
+            attach(std::make_unique<TagFloat>(std::move(name), read<float>()));
+            return;
+        case TagType::TAG_DOUBLE:
+            attach(
+                std::make_unique<TagDouble>(std::move(name), read<double>()));
+            return;
+        case TagType::TAG_STRING:
+            attach(
+                std::make_unique<TagString>(std::move(name), readString()));
+            return;
+        case TagType::TAG_COMPOUND:
+            push(type, std::move(name));
+            return;
+        case TagType::TAG_LIST: {
+            const auto elemType = static_cast<TagType>(read<uint8_t>());
+            const auto length = readLength();
+            push(type, std::move(name));
+            stack_.back().elemType = elemType;
+            stack_.back().remaining = length;
+            return;
+        }
+        case TagType::TAG_BYTE_ARRAY:
+        case TagType::TAG_INT_ARRAY:
+        case TagType::TAG_LONG_ARRAY: {
+            const auto length = readLength();
+            const size_t elemSize = type == TagType::TAG_BYTE_ARRAY  ? 1
+                                    : type == TagType::TAG_INT_ARRAY ? 4
+                                                                     : 8;
+            // Checked up front so a bogus length cannot reserve memory
+            need(length * elemSize);
+            push(type, std::move(name));
+            auto &frame = stack_.back();
+            frame.remaining = length;
+            if (type == TagType::TAG_BYTE_ARRAY) {
+                frame.bytes.reserve(length);
+            } else if (type == TagType::TAG_INT_ARRAY) {
+                frame.ints.reserve(length);
+            } else {
+                frame.longs.reserve(length);
+            }
+            return;
+        }
+        default:
+            throw std::runtime_error("ResumableDecoder: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    }
+
+    void push(TagType type, std::optional<std::string> name) {
+        stack_.emplace_back();
+        stack_.back().type = type;
+        stack_.back().name = std::move(name);
+    }
+
+    /*
+        Decodes the next piece of an array
+        @return true once the array is complete
+    */
+    template <typename T>
+    bool fill(std::vector<T> &out, size_t &remaining) {
+        const size_t n = std::min(remaining, ARRAY_PIECE);
+        const size_t old = out.size();
+        out.resize(old + n);
+        for (size_t i = 0; i < n; ++i) {
+            out[old + i] = readBuffer<T>(p_ + i * sizeof(T));
+        }
+        p_ += n * sizeof(T);
+        remaining -= n;
+        return remaining == 0;
+    }
+
+    /*
+        Pops the finished frame on top and attaches its tag to the parent
+    */
+    void close(std::unique_ptr<Tag> tag) {
+        stack_.pop_back();
+        attach(std::move(tag));
+    }
+
+    /*
+        Adds a finished tag to the container on top of the stack, or makes
+        it the root
+    */
+    void attach(std::unique_ptr<Tag> tag) {
+        if (stack_.empty()) {
+            root_ = std::move(tag);
+            return;
+        }
+        auto &parent = stack_.back();
+        if (parent.type == TagType::TAG_LIST) {
+            parent.elems.push_back(std::move(tag));
+        } else {
+            auto name = *tag->getName();
+            parent.members.insert({std::move(name), std::move(tag)});
+        }
+    }
+
+private:
+    const char *data_;
+    const char *end_;
+    const char *p_ = data_;
+    std::vector<Frame> stack_;
+    std::unique_ptr<Tag> root_;
+};
+
+
+}  // namespace nbt
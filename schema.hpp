@@ -0,0 +1,582 @@
+/**
+    Schema inference and specialized decoder generation
+    @file schema.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string_view>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Observed shape of one path of a corpus. Compound entries and list
+    elements ("[]") are children; types counts how often each TagType was
+    seen at the path and positionSum accumulates the index of the entry in
+    its compound, so keys can be put in their usual order.
+*/
+struct SchemaNode {
+    uint64_t count = 0;
+    double positionSum = 0;
+    std::map<TagType, uint64_t> types;
+    std::map<std::string, SchemaNode> children;
+
+    /*
+        Returns the most frequent type, TAG_END if none was seen
+    */
+    TagType type() const {
+        TagType best = TagType::TAG_END;
+        uint64_t seen = 0;
+        for (const auto &it : types) {
+            if (it.second > seen) {
+                best = it.first;
+                seen = it.second;
+            }
+        }
+        return best;
+    }
+
+    const SchemaNode *element() const {
+        auto it = children.find("[]");
+        return it == children.end() ? nullptr : &it->second;
+    }
+
+    /*
+        Returns the compound keys sorted by their mean position
+    */
+    std::vector<std::string> keys() const {
+        std::vector<std::pair<double, std::string>> order;
+        for (const auto &it : children) {
+            if (it.first != "[]") {
+                order.emplace_back(it.second.positionSum / it.second.count,
+                                   it.first);
+            }
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<std::string> out;
+        for (auto &it : order) {
+            out.push_back(std::move(it.second));
+        }
+        return out;
+    }
+};
+
+/*
+    Infers a schema from a corpus of documents. Documents are walked as raw
+    bytes rather than decoded, which keeps the order of compound entries
+    that TagCompound's map does not preserve.
+*/
+class SchemaInferrer {
+public:
+    /*
+        Adds a document held in memory to the schema
+    */
+    void observe(const char *data, size_t size) {
+        const char *end = data + size;
+        if (size < 3 || static_cast<TagType>(*data) != TagType::TAG_COMPOUND) {
+            throw std::runtime_error(
+                "SchemaInferrer: document should be a named compound");
+        }
+        const char *p = skipPayload(TagType::TAG_STRING, data + 1, end);
+        ++documents_;
+        ++root_.count;
+        ++root_.types[TagType::TAG_COMPOUND];
+        walk(TagType::TAG_COMPOUND, p, end, root_);
+    }
+
+    size_t documents() const {
+        return documents_;
+    }
+
+    const SchemaNode &root() const {
+        return root_;
+    }
+
+    /*
+        Writes one line per path: occurrences per parent occurrence (the
+        mean length for list elements), types and, for compounds, the
+        usual key order
+    */
+    void write(std::ostream &out) const {
+        writeNode(out, "", root_, root_.count);
+    }
+
+private:
+    const char *walk(TagType type, const char *p, const char *end,
+                     SchemaNode &node) {
+        if (type == TagType::TAG_COMPOUND) {
+            for (size_t index = 0;; ++index) {
+                if (p == end) {
+                    throw std::runtime_error(
+                        "SchemaInferrer: unexpected end of buffer");
+                }
+                auto entryType = static_cast<TagType>(*p++);
+                if (entryType == TagType::TAG_END) {
+                    return p;
+                }
+                auto nameEnd = skipPayload(TagType::TAG_STRING, p, end);
+                std::string name(p + 2, nameEnd);
+                auto &child = node.children[name];
+                ++child.count;
+                ++child.types[entryType];
+                child.positionSum += static_cast<double>(index);
+                p = walk(entryType, nameEnd, end, child);
+            }
+        }
+        if (type == TagType::TAG_LIST) {
+            if (end - p < 5) {
+                throw std::runtime_error(
+                    "SchemaInferrer: unexpected end of buffer");
+            }
+            auto elemType = static_cast<TagType>(*p);
+            auto length = readBuffer<int32_t>(p + 1);
+            p += 5;
+            if (length <= 0) {
+                return p;
+            }
+            auto &elem = node.children["[]"];
+            elem.count += static_cast<uint64_t>(length);
+            elem.types[elemType] += static_cast<uint64_t>(length);
+            for (int32_t i = 0; i < length; ++i) {
+                p = walk(elemType, p, end, elem);
+            }
+            return p;
+        }
+        return skipPayload(type, p, end);
+    }
+
+    static void writeNode(std::ostream &out, const std::string &path,
+                          const SchemaNode &node, uint64_t parentCount) {
+        out << (path.empty() ? "<root>" : path) << " "
+            << static_cast<double>(node.count) / parentCount;
+        for (const auto &it : node.types) {
+            out << " " << TAGTYPE_TO_NAME.at(it.first) << "x" << it.second;
+        }
+        auto keys = node.keys();
+        if (!keys.empty()) {
+            out << " {";
+            for (size_t i = 0; i < keys.size(); ++i) {
+                out << (i == 0 ? "" : ", ") << keys[i];
+            }
+            out << "}";
+        }
+        out << "\n";
+        for (const auto &it : node.children) {
+            auto childPath = it.first == "[]" ? path + "[]"
+                             : path.empty()   ? it.first
+                                              : path + "." + it.first;
+            writeNode(out, childPath, it.second, node.count);
+        }
+    }
+
+private:
+    SchemaNode root_;
+    size_t documents_ = 0;
+};
+
+/*
+    Runtime support of the code emitted by DecoderGenerator
+*/
+namespace generated {
+
+using Extra = std::unordered_map<std::string, std::unique_ptr<Tag>>;
+
+inline void need(const char *p, const char *end, size_t n) {
+    if (static_cast<size_t>(end - p) < n) {
+        throw std::runtime_error("generated: unexpected end of buffer");
+    }
+}
+
+template <typename T>
+T scalar(const char *&p, const char *end) {
+    need(p, end, sizeof(T));
+    auto val = readBuffer<T>(p);
+    p += sizeof(T);
+    return val;
+}
+
+template <>
+inline std::string scalar<std::string>(const char *&p, const char *end) {
+    auto len = scalar<uint16_t>(p, end);
+    need(p, end, len);
+    std::string val(p, len);
+    p += len;
+    return val;
+}
+
+template <typename T>
+std::vector<T> array(const char *&p, const char *end) {
+    auto len = static_cast<size_t>(std::max(scalar<int32_t>(p, end), 0));
+    need(p, end, len * sizeof(T));
+    std::vector<T> val(len);
+    for (auto &elem : val) {
+        elem = readBuffer<T>(p);
+        p += sizeof(T);
+    }
+    return val;
+}
+
+/*
+    Reads a list header if its elements have the expected type
+    @return false, consuming nothing, if the list holds another type
+*/
+inline bool listHeader(const char *&p, const char *end, TagType expected,
+                       size_t &length) {
+    need(p, end, 5);
+    auto elemType = static_cast<TagType>(*p);
+    auto len = readBuffer<int32_t>(p + 1);
+    if (len > 0 && elemType != expected) {
+        return false;
+    }
+    length = static_cast<size_t>(std::max(len, 0));
+    p += 5;
+    // Every element takes at least one byte
+    need(p, end, length);
+    return true;
+}
+
+/*
+    Returns the index of name in keys, trying hint first
+    @return count if name is not a known key
+*/
+inline size_t findKey(const std::string_view *keys, size_t count,
+                      size_t hint, std::string_view name) {
+    if (hint < count && keys[hint] == name) {
+        return hint;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (keys[i] == name) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/*
+    Decodes an unexpected entry generically into extra
+*/
+inline const char *fallback(const char *p, const char *end, TagType type,
+                            std::string_view name, Extra &extra) {
+    BufferStream stream(p, static_cast<size_t>(end - p));
+    std::string key(name);
+    auto tag = makeTag(type, key, stream);
+    extra[std::move(key)] = std::move(tag);
+    return p + stream.position();
+}
+
+}  // namespace generated
+
+/*
+    Emits C++ structs mirroring a schema and decoders specialized for it.
+    Each compound path becomes a struct with one std::optional field per
+    key of a supported dominant type, and a decode function that expects
+    keys in their usual order. Keys of other types, unknown keys and
+    nested lists land in the struct's extra map through the generic
+    decoder, so surprising documents still decode completely.
+*/
+class DecoderGenerator {
+public:
+    /*
+        @param schema the inferred schema
+        @param rootName name of the struct of the root compound
+        @param ns namespace of the generated code
+        @return a self-contained header including schema.hpp
+    */
+    static std::string generate(const SchemaNode &schema,
+                                const std::string &rootName = "Root",
+                                const std::string &ns = "schema") {
+        DecoderGenerator gen;
+        gen.collect(schema, identifier(rootName));
+
+        std::ostringstream out;
+        out << "// Generated by nbt::DecoderGenerator, do not edit\n\n"
+            << "#pragma once\n\n#include <optional>\n\n"
+            << "#include \"schema.hpp\"\n\n\nnamespace " << ns << " {\n\n\n";
+        for (const auto &s : gen.structs_) {
+            out << "struct " << s.name << ";\n";
+        }
+        out << "\n";
+        for (const auto &s : gen.structs_) {
+            out << "inline const char *decode(const char *p, const char *end, "
+                << s.name << " &out);\n";
+        }
+        out << "\n";
+        // Children are collected after their parent, define them first
+        for (auto it = gen.structs_.rbegin(); it != gen.structs_.rend();
+             ++it) {
+            gen.emitStruct(out, *it);
+        }
+        for (const auto &s : gen.structs_) {
+            gen.emitDecoder(out, s);
+        }
+        const auto &root = gen.structs_.front().name;
+        out << "/*\n    Decodes a document held in memory into a " << root
+            << "\n*/\n"
+            << "inline void readDocument(const char *data, size_t size, "
+            << root << " &out) {\n"
+            << "    const char *end = data + size;\n"
+            << "    nbt::generated::need(data, end, 1);\n"
+            << "    if (static_cast<nbt::TagType>(*data) != "
+               "nbt::TagType::TAG_COMPOUND) {\n"
+            << "        throw std::runtime_error(\n"
+            << "            \"readDocument: document should be a named "
+               "compound\");\n"
+            << "    }\n"
+            << "    const char *p = data + 1;\n"
+            << "    nbt::generated::scalar<std::string>(p, end);\n"
+            << "    decode(p, end, out);\n"
+            << "}\n\n\n}  // namespace " << ns << "\n";
+        return out.str();
+    }
+
+    /*
+        Returns a valid C++ identifier derived from a key
+    */
+    static std::string identifier(const std::string &key) {
+        // C++ keywords likely to show up as keys, and the extra member
+        static const std::set<std::string> reserved = {
+            "auto",   "bool",     "break",    "case",    "char",   "class",
+            "const",  "default",  "delete",   "do",      "double", "else",
+            "enum",   "extra",    "false",    "float",   "for",    "if",
+            "int",    "long",     "new",      "private", "public", "return",
+            "short",  "signed",   "static",   "struct",  "switch", "template",
+            "this",   "true",     "try",      "union",   "unsigned", "void",
+            "while",
+        };
+        std::string id;
+        for (auto c : key) {
+            id += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        }
+        if (id.empty() || std::isdigit(static_cast<unsigned char>(id[0]))) {
+            id = "_" + id;
+        }
+        if (reserved.count(id) != 0) {
+            id += "_";
+        }
+        return id;
+    }
+
+private:
+    struct Field {
+        std::string key;
+        std::string member;
+        TagType type;
+        // Element type of lists, TAG_END otherwise
+        TagType elemType;
+        // C++ type of the value, or of the list element
+        std::string cppType;
+    };
+
+    struct Struct {
+        std::string name;
+        std::vector<Field> fields;
+    };
+
+    static const char *scalarType(TagType type) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            return "int8_t";
+        case TagType::TAG_SHORT:
+            return "int16_t";
+        case TagType::TAG_INT:
+            return "int32_t";
+        case TagType::TAG_LONG:
+            return "int64_t";
+        case TagType::TAG_FLOAT:
+            return "float";
+        case TagType::TAG_DOUBLE:
+            return "double";
+        case TagType::TAG_STRING:
+            return "std::string";
+        default:
+            return nullptr;
+        }
+    }
+
+    static const char *arrayType(TagType type) {
+        switch (type) {
+        case TagType::TAG_BYTE_ARRAY:
+            return "int8_t";
+        case TagType::TAG_INT_ARRAY:
+            return "int32_t";
+        case TagType::TAG_LONG_ARRAY:
+            return "int64_t";
+        default:
+            return nullptr;
+        }
+    }
+
+    static std::string tagTypeName(TagType type) {
+        return "nbt::TagType::" + TAGTYPE_TO_NAME.at(type);
+    }
+
+    void collect(const SchemaNode &node, const std::string &name) {
+        const size_t index = structs_.size();
+        structs_.push_back(Struct{name, {}});
+        std::set<std::string> members;
+        for (const auto &key : node.keys()) {
+            const auto &child = node.children.at(key);
+            Field field{key, identifier(key), child.type(), TagType::TAG_END,
+                        ""};
+            while (members.count(field.member) != 0) {
+                field.member += "_";
+            }
+            if (scalarType(field.type) != nullptr) {
+                field.cppType = scalarType(field.type);
+            } else if (arrayType(field.type) != nullptr) {
+                field.cppType = arrayType(field.type);
+            } else if (field.type == TagType::TAG_COMPOUND) {
+                field.cppType = name + "_" + field.member;
+                collect(child, field.cppType);
+            } else if (field.type == TagType::TAG_LIST) {
+                auto elem = child.element();
+                field.elemType =
+                    elem == nullptr ? TagType::TAG_END : elem->type();
+                if (scalarType(field.elemType) != nullptr) {
+                    field.cppType = scalarType(field.elemType);
+                } else if (field.elemType == TagType::TAG_COMPOUND) {
+                    field.cppType = name + "_" + field.member;
+                    collect(*elem, field.cppType);
+                } else {
+                    continue;
+                }
+            } else {
+                continue;
+            }
+            members.insert(field.member);
+            structs_[index].fields.push_back(std::move(field));
+        }
+    }
+
+    static std::string memberType(const Field &field) {
+        if (arrayType(field.type) != nullptr ||
+            field.type == TagType::TAG_LIST) {
+            return "std::vector<" + field.cppType + ">";
+        }
+        return field.cppType;
+    }
+
+    void emitStruct(std::ostream &out, const Struct &s) const {
+        out << "struct " << s.name << " {\n";
+        for (const auto &field : s.fields) {
+            out << "    std::optional<" << memberType(field) << "> "
+                << field.member << ";\n";
+        }
+        out << "    nbt::generated::Extra extra;\n};\n\n";
+    }
+
+    static void emitRead(std::ostream &out, const Field &field) {
+        const std::string target = "out." + field.member;
+        if (field.type == TagType::TAG_COMPOUND) {
+            out << "            p = decode(p, end, " << target
+                << ".emplace());\n";
+        } else if (arrayType(field.type) != nullptr) {
+            out << "            " << target << " = nbt::generated::array<"
+                << field.cppType << ">(p, end);\n";
+        } else if (field.type == TagType::TAG_LIST) {
+            out << "            size_t n = 0;\n"
+                << "            if (!nbt::generated::listHeader(p, end, "
+                << tagTypeName(field.elemType) << ", n)) {\n"
+                << "                break;\n"
+                << "            }\n"
+                << "            auto &list = " << target << ".emplace(n);\n"
+                << "            for (auto &elem : list) {\n";
+            if (field.elemType == TagType::TAG_COMPOUND) {
+                out << "                p = decode(p, end, elem);\n";
+            } else {
+                out << "                elem = nbt::generated::scalar<"
+                    << field.cppType << ">(p, end);\n";
+            }
+            out << "            }\n";
+        } else {
+            out << "            " << target << " = nbt::generated::scalar<"
+                << field.cppType << ">(p, end);\n";
+        }
+    }
+
+    void emitDecoder(std::ostream &out, const Struct &s) const {
+        out << "inline const char *decode(const char *p, const char *end, "
+            << s.name << " &out) {\n";
+        if (!s.fields.empty()) {
+            out << "    static constexpr std::string_view KEYS[] = {\n";
+            for (const auto &field : s.fields) {
+                out << "        \"" << escape(field.key) << "\",\n";
+            }
+            out << "    };\n"
+                << "    constexpr size_t COUNT = " << s.fields.size()
+                << ";\n"
+                << "    size_t next = 0;\n";
+        }
+        out << "    while (true) {\n"
+            << "        auto type = static_cast<nbt::TagType>(\n"
+            << "            nbt::generated::scalar<uint8_t>(p, end));\n"
+            << "        if (type == nbt::TagType::TAG_END) {\n"
+            << "            return p;\n"
+            << "        }\n"
+            << "        auto len = nbt::generated::scalar<uint16_t>(p, end);\n"
+            << "        nbt::generated::need(p, end, len);\n"
+            << "        std::string_view name(p, len);\n"
+            << "        p += len;\n";
+        if (!s.fields.empty()) {
+            out << "        const size_t key = "
+                   "nbt::generated::findKey(KEYS, COUNT, next, name);\n"
+                << "        switch (key) {\n";
+            for (size_t i = 0; i < s.fields.size(); ++i) {
+                const auto &field = s.fields[i];
+                out << "        case " << i << ": {\n"
+                    << "            if (type != " << tagTypeName(field.type)
+                    << ") {\n"
+                    << "                break;\n"
+                    << "            }\n";
+                emitRead(out, field);
+                out << "            next = key + 1;\n"
+                    << "            continue;\n"
+                    << "        }\n";
+            }
+            out << "        default:\n"
+                << "            break;\n"
+                << "        }\n";
+        }
+        out << "        p = nbt::generated::fallback(p, end, type, name, "
+               "out.extra);\n"
+            << "    }\n"
+            << "}\n\n";
+    }
+
+    static std::string escape(const std::string &key) {
+        std::string out;
+        for (auto c : key) {
+            const auto byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (byte < 0x20 || byte >= 0x7f) {
+                // Three digit octal escapes never swallow a following digit
+                out += '\\';
+                out += static_cast<char>('0' + (byte >> 6));
+                out += static_cast<char>('0' + ((byte >> 3) & 7));
+                out += static_cast<char>('0' + (byte & 7));
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+private:
+    std::vector<Struct> structs_;
+};
+
+
+}  // namespace nbt
@@ -0,0 +1,26 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "schema.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "./schemagen [struct name] [namespace] [nbt files...]\n"
+                  << "Writes the inferred schema to stderr and the "
+                     "generated decoder to stdout\n";
+        return 1;
+    }
+
+    nbt::SchemaInferrer inferrer;
+    for (int i = 3; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+        inferrer.observe(data.data(), data.size());
+    }
+    inferrer.write(std::cerr);
+    std::cout << nbt::DecoderGenerator::generate(inferrer.root(), argv[1],
+                                                 argv[2]);
+    return 0;
+}
@@ -0,0 +1,543 @@
+/**
+    Sharded world scanning over sockets
+    @file shard.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+
+#include "control.hpp"
+#include "gather.hpp"
+#include "nbt.hpp"
+#include "region.hpp"
+#include "thread_pool.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Owning file descriptor of a socket, closed on destruction
+*/
+class Socket {
+public:
+    Socket() = default;
+
+    explicit Socket(int fd) : fd_(fd) {
+    }
+
+    Socket(Socket &&other) noexcept : fd_(other.fd_) {
+        other.fd_ = -1;
+    }
+
+    Socket &operator=(Socket &&other) noexcept {
+        if (this != &other) {
+            close();
+            fd_ = other.fd_;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
+
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+
+    ~Socket() {
+        close();
+    }
+
+    int fd() const {
+        return fd_;
+    }
+
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    /*
+        Returns the local port of a TCP socket, e.g. the one picked for a
+        socket listening on port 0, or 0 for other sockets
+    */
+    uint16_t port() const {
+        sockaddr_storage addr{};
+        socklen_t length = sizeof(addr);
+        if (::getsockname(fd_, reinterpret_cast<sockaddr *>(&addr),
+                          &length) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Socket: getsockname");
+        }
+        if (addr.ss_family == AF_INET) {
+            return ntohs(reinterpret_cast<sockaddr_in &>(addr).sin_port);
+        }
+        if (addr.ss_family == AF_INET6) {
+            return ntohs(reinterpret_cast<sockaddr_in6 &>(addr).sin6_port);
+        }
+        return 0;
+    }
+
+    /*
+        Returns the next incoming connection of a listening socket
+    */
+    Socket accept() const {
+        while (true) {
+            int fd = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                return Socket(fd);
+            }
+            if (errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(),
+                                        "Socket: accept");
+            }
+        }
+    }
+
+private:
+    int fd_ = -1;
+};
+
+inline sockaddr_un unixAddress(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::length_error("unixAddress: path too long");
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+/*
+    Returns a socket listening on a Unix domain path, replacing any stale
+    socket file
+*/
+inline Socket listenUnix(const std::string &path, int backlog = 64) {
+    auto addr = unixAddress(path);
+    Socket sock(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (sock.fd() < 0) {
+        throw std::system_error(errno, std::generic_category(), "listenUnix");
+    }
+    ::unlink(path.c_str());
+    if (::bind(sock.fd(), reinterpret_cast<sockaddr *>(&addr),
+               sizeof(addr)) != 0 ||
+        ::listen(sock.fd(), backlog) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "listenUnix: " + path);
+    }
+    return sock;
+}
+
+inline Socket connectUnix(const std::string &path) {
+    auto addr = unixAddress(path);
+    Socket sock(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (sock.fd() < 0 ||
+        ::connect(sock.fd(), reinterpret_cast<sockaddr *>(&addr),
+                  sizeof(addr)) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "connectUnix: " + path);
+    }
+    return sock;
+}
+
+/*
+    Returns a TCP socket listening on host:port, or connected to it.
+    An empty host listens on every interface.
+*/
+template <bool Listen>
+Socket openTcp(const std::string &host, uint16_t port, int backlog = 64) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = Listen ? AI_PASSIVE : 0;
+    addrinfo *list = nullptr;
+    const auto service = std::to_string(port);
+    int ret = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                            service.c_str(), &hints, &list);
+    if (ret != 0) {
+        throw std::runtime_error("openTcp: " + host + ": " +
+                                 ::gai_strerror(ret));
+    }
+    int err = 0;
+    for (auto ai = list; ai != nullptr; ai = ai->ai_next) {
+        Socket sock(::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                             ai->ai_protocol));
+        if (sock.fd() < 0) {
+            err = errno;
+            continue;
+        }
+        bool ok;
+        if (Listen) {
+            int one = 1;
+            ::setsockopt(sock.fd(), SOL_SOCKET, SO_REUSEADDR, &one,
+                         sizeof(one));
+            ok = ::bind(sock.fd(), ai->ai_addr, ai->ai_addrlen) == 0 &&
+                 ::listen(sock.fd(), backlog) == 0;
+        } else {
+            ok = ::connect(sock.fd(), ai->ai_addr, ai->ai_addrlen) == 0;
+        }
+        if (ok) {
+            ::freeaddrinfo(list);
+            return sock;
+        }
+        err = errno;
+    }
+    ::freeaddrinfo(list);
+    throw std::system_error(err, std::generic_category(),
+                            "openTcp: " + host + ":" + service);
+}
+
+inline Socket listenTcp(const std::string &host, uint16_t port) {
+    return openTcp<true>(host, port);
+}
+
+inline Socket connectTcp(const std::string &host, uint16_t port) {
+    return openTcp<false>(host, port);
+}
+
+/*
+    Sends one frame: the big endian u32 size of the document, then the
+    document itself
+*/
+inline void sendFrame(int sock, const Tag &doc) {
+    GatherEncoder enc;
+    enc.encode(doc);
+    char header[4];
+    const auto size = static_cast<uint32_t>(enc.size());
+    for (int i = 0; i < 4; ++i) {
+        header[i] = static_cast<char>(size >> (24 - 8 * i));
+    }
+    auto iov = enc.iovecs();
+    iov.insert(iov.begin(), iovec{header, sizeof(header)});
+    submitIovecs(std::move(iov), [sock](iovec *vec, int count) {
+        msghdr msg{};
+        msg.msg_iov = vec;
+        msg.msg_iovlen = count;
+        return ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+    });
+}
+
+/*
+    Reads exactly size bytes
+    @param control checked whenever a receive timeout set on the socket
+           expires, optional
+    @return false on end of stream before the first byte
+*/
+inline bool recvAll(int sock, char *data, size_t size,
+                    const ScanControl *control = nullptr) {
+    size_t got = 0;
+    while (got < size) {
+        auto n = ::recv(sock, data + got, size - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && control != nullptr &&
+            (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            control->check();
+            continue;
+        }
+        if (n < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "recvFrame");
+        }
+        if (n == 0) {
+            if (got == 0) {
+                return false;
+            }
+            throw std::runtime_error("recvFrame: truncated frame");
+        }
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/*
+    Receives one frame sent by sendFrame
+    @param sock the socket
+    @param maxSize frames announcing a larger document are rejected
+    @param control checked while waiting for the rest of a frame, see
+           recvAll
+    @return the root Tag, nullptr if the peer closed the connection
+*/
+inline std::unique_ptr<Tag> recvFrame(int sock, size_t maxSize = 1 << 30,
+                                      const ScanControl *control = nullptr) {
+    char header[4];
+    if (!recvAll(sock, header, sizeof(header), control)) {
+        return nullptr;
+    }
+    const size_t size = readBuffer<uint32_t>(header);
+    if (size > maxSize) {
+        throw std::length_error("recvFrame: frame too large");
+    }
+    std::string body(size, '\0');
+    if (size > 0 && !recvAll(sock, body.data(), size, control)) {
+        throw std::runtime_error("recvFrame: truncated frame");
+    }
+    BufferStream stream(body.data(), body.size());
+    return readDocument(stream);
+}
+
+/*
+    Returns the shard of a region file name. FNV-1a keeps the assignment
+    stable across processes and machines, unlike std::hash.
+*/
+inline size_t regionShard(const std::string &name, size_t shards) {
+    uint64_t hash = 14695981039346656037ull;
+    for (auto c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return static_cast<size_t>(hash % shards);
+}
+
+namespace shard {
+
+inline std::unique_ptr<Tag> message(
+    const std::string &kind,
+    std::unordered_map<std::string, std::unique_ptr<Tag>> fields = {}) {
+    fields["kind"] = std::make_unique<TagString>(std::nullopt, kind);
+    return std::make_unique<TagCompound>("", std::move(fields));
+}
+
+inline const Tag *field(const Tag &msg, const std::string &key,
+                        TagType type) {
+    if (msg.getTagType() != TagType::TAG_COMPOUND) {
+        return nullptr;
+    }
+    const auto &entries = static_cast<const TagCompound &>(msg).getValue();
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second->getTagType() != type) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+inline std::string kind(const Tag &msg) {
+    auto tag = field(msg, "kind", TagType::TAG_STRING);
+    if (tag == nullptr) {
+        throw std::runtime_error("shard: message without kind");
+    }
+    return static_cast<const TagString &>(*tag).getValue();
+}
+
+constexpr int POLL_MS = 100;
+
+/*
+    Makes blocking receives on sock fail with EAGAIN after ms, so that a
+    peer stalling in the middle of a frame cannot block forever
+*/
+inline void setReceiveTimeout(int sock, int ms) {
+    timeval timeout{ms / 1000, (ms % 1000) * 1000};
+    if (::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                     sizeof(timeout)) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "setReceiveTimeout");
+    }
+}
+
+/*
+    Waits until one of fds has an event, checking control every POLL_MS
+*/
+inline void wait(std::vector<pollfd> &fds, const ScanControl &control) {
+    while (true) {
+        control.check();
+        const int ret = ::poll(fds.data(), fds.size(), POLL_MS);
+        if (ret > 0) {
+            return;
+        }
+        if (ret < 0 && errno != EINTR) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "coordinateScan: poll");
+        }
+    }
+}
+
+}  // namespace shard
+
+/*
+    Worker side of a sharded scan. Receives a job (directory, shard,
+    shard count) from the coordinator, scans the regions of its shard on
+    the pool and streams one partial State per region back as soon as the
+    region is done, followed by a final "done" message.
+    @param conn the connection to the coordinator
+    @param pool the pool running one task per region
+    @param visit called as visit(State &, ChunkPos, const Tag &)
+    @param serialize converts a partial State into a Tag
+    @param priority the queue of the region tasks
+*/
+template <typename State, typename Visit, typename Serialize>
+void runShardWorker(const Socket &conn, ThreadPool &pool, Visit visit,
+                    Serialize serialize,
+                    Priority priority = Priority::BACKGROUND) {
+    auto job = recvFrame(conn.fd());
+    if (job == nullptr || shard::kind(*job) != "job") {
+        throw std::runtime_error("runShardWorker: expected a job");
+    }
+    auto dir = shard::field(*job, "dir", TagType::TAG_STRING);
+    auto index = shard::field(*job, "shard", TagType::TAG_INT);
+    auto count = shard::field(*job, "shards", TagType::TAG_INT);
+    if (dir == nullptr || index == nullptr || count == nullptr) {
+        throw std::runtime_error("runShardWorker: malformed job");
+    }
+    const auto shards =
+        static_cast<size_t>(static_cast<const TagInt &>(*count).getValue());
+    const auto self =
+        static_cast<size_t>(static_cast<const TagInt &>(*index).getValue());
+
+    std::mutex sendMutex;
+    std::vector<std::future<void>> futures;
+    std::string error;
+    try {
+        for (const auto &file : listRegionFiles(
+                 static_cast<const TagString &>(*dir).getValue())) {
+            auto name = std::filesystem::path(file).filename().string();
+            if (shards == 0 || regionShard(name, shards) != self) {
+                continue;
+            }
+            futures.push_back(pool.submit(
+                [&, file, name] {
+                    State partial{};
+                    RegionFile region(file);
+                    region.forEachChunk([&](ChunkPos pos, const Tag &chunk) {
+                        visit(partial, pos, chunk);
+                        pool.preempt();
+                    });
+                    std::unordered_map<std::string, std::unique_ptr<Tag>> f;
+                    f["region"] = std::make_unique<TagString>(std::nullopt,
+                                                              name);
+                    f["state"] = serialize(partial);
+                    auto msg = shard::message("partial", std::move(f));
+                    std::lock_guard<std::mutex> lock(sendMutex);
+                    sendFrame(conn.fd(), *msg);
+                },
+                priority));
+        }
+    } catch (const std::exception &e) {
+        error = e.what();
+    }
+    for (auto &fut : futures) {
+        try {
+            pool.wait(fut);
+        } catch (const std::exception &e) {
+            if (error.empty()) {
+                error = e.what();
+            }
+        }
+    }
+
+    if (error.empty()) {
+        sendFrame(conn.fd(), *shard::message("done"));
+        return;
+    }
+    std::unordered_map<std::string, std::unique_ptr<Tag>> f;
+    f["what"] = std::make_unique<TagString>(std::nullopt, error);
+    sendFrame(conn.fd(), *shard::message("error", std::move(f)));
+}
+
+/*
+    Coordinator side of a sharded scan. Accepts the given number of
+    workers on the listening socket, assigns each a shard of the region
+    files by name hash, and merges partial States as they stream in.
+    @param listener a socket from listenUnix or listenTcp
+    @param dir the region directory, as seen by the workers
+    @param workers number of worker connections to accept
+    @param merge called as merge(State &total, State &&partial)
+    @param deserialize converts a received Tag into a partial State
+    @param control checked while waiting for workers to connect or report,
+           and while a frame is only partly received, so a missing or
+           stuck worker ends the scan with Cancelled or DeadlineExceeded
+           instead of blocking forever
+    @return the merged State
+*/
+template <typename State, typename Merge, typename Deserialize>
+State coordinateScan(const Socket &listener, const std::string &dir,
+                     size_t workers, Merge merge, Deserialize deserialize,
+                     const ScanControl &control = {}) {
+    std::vector<Socket> conns;
+    std::vector<pollfd> listening{pollfd{listener.fd(), POLLIN, 0}};
+    for (size_t i = 0; i < workers; ++i) {
+        shard::wait(listening, control);
+        conns.push_back(listener.accept());
+        shard::setReceiveTimeout(conns.back().fd(), shard::POLL_MS);
+        std::unordered_map<std::string, std::unique_ptr<Tag>> f;
+        f["dir"] = std::make_unique<TagString>(std::nullopt, dir);
+        f["shard"] = std::make_unique<TagInt>(std::nullopt,
+                                              static_cast<int32_t>(i));
+        f["shards"] = std::make_unique<TagInt>(std::nullopt,
+                                               static_cast<int32_t>(workers));
+        sendFrame(conns.back().fd(), *shard::message("job", std::move(f)));
+    }
+
+    State total{};
+    std::string error;
+    std::vector<pollfd> fds;
+    for (const auto &conn : conns) {
+        fds.push_back(pollfd{conn.fd(), POLLIN, 0});
+    }
+    size_t open = fds.size();
+    while (open > 0) {
+        shard::wait(fds, control);
+        for (auto &p : fds) {
+            if (p.fd < 0 || p.revents == 0) {
+                continue;
+            }
+            std::unique_ptr<Tag> msg;
+            std::string kind;
+            try {
+                msg = recvFrame(p.fd, 1 << 30, &control);
+                kind = msg == nullptr ? "" : shard::kind(*msg);
+            } catch (const Cancelled &) {
+                throw;
+            } catch (const std::exception &e) {
+                kind = "error";
+                if (error.empty()) {
+                    error = e.what();
+                }
+            }
+            if (kind == "partial") {
+                const auto &entries =
+                    static_cast<const TagCompound &>(*msg).getValue();
+                auto state = entries.find("state");
+                if (state == entries.end()) {
+                    throw std::runtime_error(
+                        "coordinateScan: partial without state");
+                }
+                merge(total, deserialize(*state->second));
+                continue;
+            }
+            if (kind == "error") {
+                auto what = msg == nullptr ? nullptr
+                                           : shard::field(*msg, "what",
+                                                          TagType::TAG_STRING);
+                if (error.empty() && what != nullptr) {
+                    error = static_cast<const TagString &>(*what).getValue();
+                }
+            } else if (kind != "done" && error.empty()) {
+                error = "worker disconnected before finishing";
+            }
+            p.fd = -1;
+            --open;
+        }
+    }
+    if (!error.empty()) {
+        throw std::runtime_error("coordinateScan: " + error);
+    }
+    return total;
+}
+
+
+}  // namespace nbt
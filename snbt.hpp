@@ -0,0 +1,416 @@
+/**
+    SNBT Reader
+    @file snbt.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <limits>
+#include <string_view>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+namespace snbt {
+
+
+enum CharClass : uint8_t {
+    CHAR_SPACE = 1,
+    CHAR_UNQUOTED = 2,
+};
+
+constexpr std::array<uint8_t, 256> makeCharClassTable() {
+    std::array<uint8_t, 256> table{};
+    for (unsigned char c : {' ', '\t', '\n', '\r', '\v', '\f'}) {
+        table[c] = CHAR_SPACE;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] = CHAR_UNQUOTED;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] = CHAR_UNQUOTED;
+        table[c - 'a' + 'A'] = CHAR_UNQUOTED;
+    }
+    for (unsigned char c : {'_', '-', '.', '+'}) {
+        table[c] = CHAR_UNQUOTED;
+    }
+    return table;
+}
+
+constexpr auto CHAR_CLASS = makeCharClassTable();
+
+/*
+    Single pass SNBT parser producing the same Tag tree as readDocument.
+    Every character is consumed at most once; tokens are classified after
+    they are scanned, never by re-reading the input.
+*/
+class Parser {
+public:
+    static constexpr int MAX_DEPTH = 512;
+
+    explicit Parser(std::string_view text)
+        : cur_(text.data()),
+          begin_(text.data()),
+          end_(text.data() + text.size()) {
+    }
+
+    std::unique_ptr<Tag> parseRoot() {
+        auto root = parseValue(std::string());
+        skipSpace();
+        if (cur_ != end_) {
+            fail("trailing characters");
+        }
+        return root;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string &what) const {
+        throw std::runtime_error("readSNBT: " + what + " at offset " +
+                                 std::to_string(cur_ - begin_));
+    }
+
+    void skipSpace() {
+        while (cur_ != end_ &&
+               CHAR_CLASS[static_cast<uint8_t>(*cur_)] == CHAR_SPACE) {
+            ++cur_;
+        }
+    }
+
+    char peek() {
+        skipSpace();
+        if (cur_ == end_) {
+            fail("unexpected end of input");
+        }
+        return *cur_;
+    }
+
+    void expect(char c) {
+        if (peek() != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++cur_;
+    }
+
+    std::string_view scanUnquoted() {
+        auto start = cur_;
+        while (cur_ != end_ &&
+               CHAR_CLASS[static_cast<uint8_t>(*cur_)] == CHAR_UNQUOTED) {
+            ++cur_;
+        }
+        if (start == cur_) {
+            fail("expected value");
+        }
+        return std::string_view(start, cur_ - start);
+    }
+
+    std::string scanQuoted() {
+        const char quote = *cur_++;
+        std::string out;
+        auto run = cur_;
+        while (true) {
+            if (cur_ == end_) {
+                fail("unterminated string");
+            }
+            if (*cur_ == quote) {
+                out.append(run, cur_);
+                ++cur_;
+                return out;
+            }
+            if (*cur_ == '\\') {
+                out.append(run, cur_);
+                if (++cur_ == end_) {
+                    fail("unterminated string");
+                }
+                // Only the quote and the backslash itself can be escaped
+                if (*cur_ != quote && *cur_ != '\\') {
+                    fail("invalid escape sequence");
+                }
+                out.push_back(*cur_++);
+                run = cur_;
+                continue;
+            }
+            ++cur_;
+        }
+    }
+
+    std::string parseKey() {
+        auto c = peek();
+        if (c == '"' || c == '\'') {
+            return scanQuoted();
+        }
+        return std::string(scanUnquoted());
+    }
+
+    std::unique_ptr<Tag> parseValue(std::optional<std::string> name) {
+        switch (peek()) {
+        case '{':
+            return parseCompound(std::move(name));
+        case '[':
+            return parseBracket(std::move(name));
+        case '"':
+        case '\'':
+            return std::make_unique<TagString>(std::move(name), scanQuoted());
+        default:
+            return parseScalar(std::move(name), scanUnquoted());
+        }
+    }
+
+    std::unique_ptr<Tag> parseCompound(std::optional<std::string> name) {
+        DepthGuard guard(this);
+        ++cur_;
+        std::unordered_map<std::string, std::unique_ptr<Tag>> val;
+        if (peek() != '}') {
+            while (true) {
+                auto key = parseKey();
+                expect(':');
+                auto tag = parseValue(key);
+                if (!val.emplace(std::move(key), std::move(tag)).second) {
+                    fail("duplicate key");
+                }
+                if (peek() == ',') {
+                    ++cur_;
+                    continue;
+                }
+                break;
+            }
+        }
+        expect('}');
+        return std::make_unique<TagCompound>(std::move(name), std::move(val));
+    }
+
+    std::unique_ptr<Tag> parseBracket(std::optional<std::string> name) {
+        DepthGuard guard(this);
+        ++cur_;
+        skipSpace();
+        if (end_ - cur_ >= 2 && cur_[1] == ';') {
+            switch (cur_[0]) {
+            case 'B':
+                cur_ += 2;
+                return parseArray<TagByteArray, int8_t>(std::move(name), 'b');
+            case 'I':
+                cur_ += 2;
+                return parseArray<TagIntArray, int32_t>(std::move(name), 0);
+            case 'L':
+                cur_ += 2;
+                return parseArray<TagLongArray, int64_t>(std::move(name), 'l');
+            default:
+                fail("unknown array type");
+            }
+        }
+        return parseList(std::move(name));
+    }
+
+    std::unique_ptr<Tag> parseList(std::optional<std::string> name) {
+        auto elemType = TagType::TAG_END;
+        std::vector<std::unique_ptr<Tag>> val;
+        if (peek() != ']') {
+            while (true) {
+                auto tag = parseValue(std::nullopt);
+                if (val.empty()) {
+                    elemType = tag->getTagType();
+                } else if (tag->getTagType() != elemType) {
+                    fail("mixed element types in list");
+                }
+                val.push_back(std::move(tag));
+                if (peek() == ',') {
+                    ++cur_;
+                    continue;
+                }
+                break;
+            }
+        }
+        expect(']');
+        return std::make_unique<TagList>(std::move(name), elemType,
+                                         std::move(val));
+    }
+
+    template <typename ArrayTag, typename T>
+    std::unique_ptr<Tag> parseArray(std::optional<std::string> name,
+                                    char suffix) {
+        std::vector<T> val;
+        if (peek() != ']') {
+            while (true) {
+                skipSpace();
+                auto token = scanUnquoted();
+                if (suffix != 0 && (token.back() | 0x20) == suffix) {
+                    token.remove_suffix(1);
+                }
+                val.push_back(parseInteger<T>(token));
+                if (peek() == ',') {
+                    ++cur_;
+                    continue;
+                }
+                break;
+            }
+        }
+        expect(']');
+        return std::make_unique<ArrayTag>(std::move(name), std::move(val));
+    }
+
+    template <typename T>
+    T parseInteger(std::string_view token) {
+        T v = 0;
+        const auto ec = toInteger(token, v);
+        if (ec == std::errc::result_out_of_range) {
+            fail("integer out of range '" + std::string(token) + "'");
+        }
+        if (ec != std::errc()) {
+            fail("invalid integer '" + std::string(token) + "'");
+        }
+        return v;
+    }
+
+    /*
+        Parses a whole token as an integer of type T
+        @return std::errc::invalid_argument if the token is not an integer,
+                std::errc::result_out_of_range if it does not fit into T
+    */
+    template <typename T>
+    static std::errc toInteger(std::string_view token, T &out) {
+        if (!token.empty() && token.front() == '+') {
+            token.remove_prefix(1);
+        }
+        int64_t v = 0;
+        auto res =
+            std::from_chars(token.data(), token.data() + token.size(), v);
+        if (res.ptr != token.data() + token.size() ||
+            res.ec == std::errc::invalid_argument) {
+            return std::errc::invalid_argument;
+        }
+        if (res.ec != std::errc() || v < std::numeric_limits<T>::min() ||
+            v > std::numeric_limits<T>::max()) {
+            return std::errc::result_out_of_range;
+        }
+        out = static_cast<T>(v);
+        return std::errc();
+    }
+
+    template <typename T>
+    bool tryFloating(std::string_view token, T &out) {
+        if (!token.empty() && token.front() == '+') {
+            token.remove_prefix(1);
+        }
+        auto res =
+            std::from_chars(token.data(), token.data() + token.size(), out);
+        return res.ec == std::errc() &&
+               res.ptr == token.data() + token.size();
+    }
+
+    template <typename TagT, typename T>
+    std::unique_ptr<Tag> tryMake(std::optional<std::string> &name,
+                                 std::string_view token) {
+        T v = 0;
+        if constexpr (std::is_integral_v<T>) {
+            if (toInteger(token, v) != std::errc()) {
+                return nullptr;
+            }
+        } else {
+            if (!tryFloating(token, v)) {
+                return nullptr;
+            }
+        }
+        return std::make_unique<TagT>(std::move(name), v);
+    }
+
+    /*
+        Classify an unquoted token: number with optional suffix, boolean,
+        or a bare string. A number that does not fit its type is a string
+        too, as in the vanilla parser, e.g. 3000000000 or 300b.
+    */
+    std::unique_ptr<Tag> parseScalar(std::optional<std::string> name,
+                                     std::string_view token) {
+        std::unique_ptr<Tag> tag;
+        if (looksNumeric(token)) {
+            auto body = token.substr(0, token.size() - 1);
+            switch (token.back() | 0x20) {
+            case 'b':
+                tag = tryMake<TagByte, int8_t>(name, body);
+                break;
+            case 's':
+                tag = tryMake<TagShort, int16_t>(name, body);
+                break;
+            case 'l':
+                tag = tryMake<TagLong, int64_t>(name, body);
+                break;
+            case 'f':
+                tag = tryMake<TagFloat, float>(name, body);
+                break;
+            case 'd':
+                tag = tryMake<TagDouble, double>(name, body);
+                break;
+            default:
+                if (token.find_first_of(".eE") != std::string_view::npos) {
+                    tag = tryMake<TagDouble, double>(name, token);
+                } else {
+                    tag = tryMake<TagInt, int32_t>(name, token);
+                }
+                break;
+            }
+        } else if (token == "true" || token == "false") {
+            tag = std::make_unique<TagByte>(std::move(name), token == "true");
+        }
+
+        if (!tag) {
+            tag = std::make_unique<TagString>(std::move(name),
+                                              std::string(token));
+        }
+        return tag;
+    }
+
+    /*
+        Returns true if the token starts like a number, i.e. an optional
+        sign followed by a digit or a dot and a digit.
+    */
+    static bool looksNumeric(std::string_view token) {
+        size_t i = 0;
+        if (token[i] == '+' || token[i] == '-') {
+            ++i;
+        }
+        if (i < token.size() && token[i] == '.') {
+            ++i;
+        }
+        return i < token.size() && token[i] >= '0' && token[i] <= '9';
+    }
+
+    struct DepthGuard {
+        explicit DepthGuard(Parser *parser) : parser_(parser) {
+            if (++parser_->depth_ > MAX_DEPTH) {
+                parser_->fail("nesting too deep");
+            }
+        }
+
+        ~DepthGuard() {
+            --parser_->depth_;
+        }
+
+        Parser *parser_;
+    };
+
+private:
+    const char *cur_;
+    const char *begin_;
+    const char *end_;
+    int depth_ = 0;
+};
+
+
+}  // namespace snbt
+
+
+/*
+    Returns the root Tag parsed from SNBT text
+    @param text the SNBT text, e.g. {name:"Bananrama",pos:[1d,2d,3d]}
+    @return the unique pointer of Tag, named '' like a document root
+*/
+inline std::unique_ptr<Tag> readSNBT(std::string_view text) {
+    return snbt::Parser(text).parseRoot();
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,370 @@
+/**
+    Streaming NBT Reader
+    @file stream_reader.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Receiver of the events of StreamReader. Every event does nothing by
+    default. name is the key inside a compound, the document name for the
+    root, and empty for list elements.
+*/
+class StreamHandler {
+public:
+    virtual ~StreamHandler() = default;
+
+    virtual void beginCompound(const std::string &name) {
+        (void)name;
+    }
+
+    virtual void endCompound() {
+    }
+
+    virtual void beginList(const std::string &name, TagType elemType,
+                           int32_t length) {
+        (void)name;
+        (void)elemType;
+        (void)length;
+    }
+
+    virtual void endList() {
+    }
+
+    virtual void byteValue(const std::string &name, int8_t val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void shortValue(const std::string &name, int16_t val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void intValue(const std::string &name, int32_t val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void longValue(const std::string &name, int64_t val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void floatValue(const std::string &name, float val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void doubleValue(const std::string &name, double val) {
+        (void)name;
+        (void)val;
+    }
+
+    virtual void stringValue(const std::string &name,
+                             const std::string &val) {
+        (void)name;
+        (void)val;
+    }
+
+    /*
+        Begins a TAG_BYTE_ARRAY, TAG_INT_ARRAY or TAG_LONG_ARRAY, whose
+        elements follow as pieces
+    */
+    virtual void beginArray(const std::string &name, TagType arrayType,
+                            int32_t length) {
+        (void)name;
+        (void)arrayType;
+        (void)length;
+    }
+
+    /*
+        Receives the next elements of the current array, in host byte
+        order. The data is only valid during the call.
+    */
+    virtual void bytePiece(const int8_t *data, size_t count) {
+        (void)data;
+        (void)count;
+    }
+
+    virtual void intPiece(const int32_t *data, size_t count) {
+        (void)data;
+        (void)count;
+    }
+
+    virtual void longPiece(const int64_t *data, size_t count) {
+        (void)data;
+        (void)count;
+    }
+
+    virtual void endArray() {
+    }
+};
+
+/*
+    Event parser reading documents from an input stream as the bytes
+    arrive, without building Tags. Arrays are delivered in pieces of a
+    fixed number of elements, so memory stays bounded by the read buffer
+    and one piece whatever the size of the arrays. Nesting is kept on an
+    explicit stack.
+*/
+class StreamReader {
+public:
+    static constexpr size_t READ_SIZE = 64 << 10;
+    static constexpr size_t PIECE_SIZE = 64 << 10;
+
+    /*
+        @param in the stream of documents
+        @param pieceSize array elements per piece, the last piece of an
+               array may be shorter
+        @param readSize size of the read buffer, filled with whatever the
+               stream has at hand beyond the bytes needed
+    */
+    explicit StreamReader(std::istream &in, size_t pieceSize = PIECE_SIZE,
+                          size_t readSize = READ_SIZE)
+        : in_(in),
+          pieceSize_(std::max<size_t>(pieceSize, 1)),
+          readSize_(std::max<size_t>(readSize, 1)) {
+    }
+
+    StreamReader(const StreamReader &) = delete;
+    StreamReader &operator=(const StreamReader &) = delete;
+
+    /*
+        Reads the next document, calling handler for each of its events
+        @return false at the end of the stream, before any document
+        @throw UnexpectedEnd if the stream ends inside a document
+    */
+    bool read(StreamHandler &handler) {
+        if (!fill(1)) {
+            return false;
+        }
+        if (get<uint8_t>() != static_cast<uint8_t>(TagType::TAG_COMPOUND)) {
+            throw std::runtime_error(
+                "StreamReader: document should be a named compound");
+        }
+        payload(TagType::TAG_COMPOUND, getString(), handler);
+        while (!stack_.empty()) {
+            auto &top = stack_.back();
+            if (top.type == TagType::TAG_COMPOUND) {
+                const auto type = static_cast<TagType>(get<uint8_t>());
+                if (type == TagType::TAG_END) {
+                    stack_.pop_back();
+                    handler.endCompound();
+                    continue;
+                }
+                payload(type, getString(), handler);
+            } else {
+                if (top.remaining == 0) {
+                    stack_.pop_back();
+                    handler.endList();
+                    continue;
+                }
+                --top.remaining;
+                payload(top.elemType, empty_, handler);
+            }
+        }
+        return true;
+    }
+
+    /*
+        Returns the offset in the stream of the next byte to parse
+    */
+    size_t offset() const {
+        return base_ + pos_;
+    }
+
+private:
+    struct Frame {
+        TagType type;
+        TagType elemType;
+        size_t remaining;
+    };
+
+    /*
+        Makes sure n bytes are buffered
+        @return false if the stream ended first
+    */
+    bool fill(size_t n) {
+        if (end_ - pos_ >= n) {
+            return true;
+        }
+        if (pos_ != 0 && end_ != pos_) {
+            std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        }
+        end_ -= pos_;
+        base_ += pos_;
+        pos_ = 0;
+        buffer_.resize(std::max(n, readSize_));
+        // Blocks only for the bytes needed, so a pipe or socket is parsed
+        // as data arrives, then takes what is already buffered upstream
+        in_.read(buffer_.data() + end_, static_cast<std::streamsize>(n - end_));
+        end_ += static_cast<size_t>(in_.gcount());
+        if (in_.bad()) {
+            throw std::runtime_error("StreamReader: read error");
+        }
+        if (end_ < n) {
+            return false;
+        }
+        if (in_.rdbuf()->in_avail() > 0) {
+            end_ += static_cast<size_t>(in_.readsome(
+                buffer_.data() + end_,
+                static_cast<std::streamsize>(buffer_.size() - end_)));
+        }
+        return true;
+    }
+
+    void need(size_t n) {
+        if (!fill(n)) {
+            throw UnexpectedEnd("StreamReader: unexpected end of stream");
+        }
+    }
+
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        const T val = readBuffer<T>(buffer_.data() + pos_);
+        pos_ += sizeof(T);
+        return val;
+    }
+
+    std::string getString() {
+        const auto len = get<uint16_t>();
+        need(len);
+        std::string val(buffer_.data() + pos_, len);
+        pos_ += len;
+        return val;
+    }
+
+    size_t getLength() {
+        const auto len = get<int32_t>();
+        return len > 0 ? static_cast<size_t>(len) : 0;
+    }
+
+    /*
+        Parses the payload of a tag: scalars and arrays at once, compounds
+        and lists by pushing a frame
+    */
+    void payload(TagType type, const std::string &name,
+                 StreamHandler &handler) {
+        switch (type) {
+        case TagType::TAG_BYTE:
+            handler.byteValue(name, get<int8_t>());
+            return;
+        case TagType::TAG_SHORT:
+            handler.shortValue(name, get<int16_t>());
+            return;
+        case TagType::TAG_INT:
+            handler.intValue(name, get<int32_t>());
+            return;
+        case TagType::TAG_LONG:
+            handler.longValue(name, get<int64_t>());
+            return;
+        case TagType::TAG_FLOAT:
+            handler.floatValue(name, get<float>());
+            return;
+        case TagType::TAG_DOUBLE:
+            handler.doubleValue(name, get<double>());
+            return;
+        case TagType::TAG_STRING:
+            handler.stringValue(name, getString());
+            return;
+        case TagType::TAG_COMPOUND:
+            handler.beginCompound(name);
+            stack_.push_back({type, TagType::TAG_END, 0});
+            return;
+        case TagType::TAG_LIST: {
+            const auto elemType = static_cast<TagType>(get<uint8_t>());
+            const auto length = getLength();
+            handler.beginList(name, elemType, static_cast<int32_t>(length));
+            stack_.push_back({type, elemType, length});
+            return;
+        }
+        case TagType::TAG_BYTE_ARRAY:
+            array<int8_t>(name, type, handler);
+            return;
+        case TagType::TAG_INT_ARRAY:
+            array<int32_t>(name, type, handler);
+            return;
+        case TagType::TAG_LONG_ARRAY:
+            array<int64_t>(name, type, handler);
+            return;
+        default:
+            throw std::runtime_error("StreamReader: TagType " +
+                                     std::to_string(static_cast<int>(type)) +
+                                     " not found");
+        }
+    }
+
+    /*
+        Delivers an array piece by piece, converting each piece to host
+        byte order in a reused buffer
+    */
+    template <typename T>
+    void array(const std::string &name, TagType type,
+               StreamHandler &handler) {
+        size_t remaining = getLength();
+        handler.beginArray(name, type, static_cast<int32_t>(remaining));
+        while (remaining > 0) {
+            const size_t n = std::min(remaining, pieceSize_);
+            need(n * sizeof(T));
+            const char *p = buffer_.data() + pos_;
+            if constexpr (std::is_same_v<T, int8_t>) {
+                handler.bytePiece(reinterpret_cast<const int8_t *>(p), n);
+            } else {
+                auto &piece = pieceOf<T>();
+                piece.resize(n);
+                for (size_t i = 0; i < n; ++i) {
+                    piece[i] = readBuffer<T>(p + i * sizeof(T));
+                }
+                if constexpr (std::is_same_v<T, int32_t>) {
+                    handler.intPiece(piece.data(), n);
+                } else {
+                    handler.longPiece(piece.data(), n);
+                }
+            }
+            pos_ += n * sizeof(T);
+            remaining -= n;
+        }
+        handler.endArray();
+    }
+
+    template <typename T>
+    std::vector<T> &pieceOf() {
+        if constexpr (std::is_same_v<T, int32_t>) {
+            return ints_;
+        } else {
+            return longs_;
+        }
+    }
+
+private:
+    std::istream &in_;
+    size_t pieceSize_;
+    size_t readSize_;
+    std::vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    size_t base_ = 0;
+    std::vector<Frame> stack_;
+    std::vector<int32_t> ints_;
+    std::vector<int64_t> longs_;
+    const std::string empty_;
+};
+
+
+}  // namespace nbt
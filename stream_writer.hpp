@@ -0,0 +1,309 @@
+/**
+    Streaming NBT Writer
+    @file stream_writer.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Writes a document incrementally, e.g.
+
+        StreamWriter w(out);
+        w.beginCompound();
+        w.key("Entities");
+        w.beginList(TagType::TAG_COMPOUND);
+        for (...) { w.beginCompound(); w.key("id"); w.value(id); w.end(); }
+        w.end();
+        w.end();
+
+    Lists and arrays whose length is not given up front get a placeholder
+    length that is patched when the container ends: in place on a seekable
+    sink, otherwise inside a buffer which may grow up to window bytes and
+    is flushed once no length is pending.
+*/
+class StreamWriter {
+public:
+    explicit StreamWriter(std::ostream &out, size_t window = 1 << 20)
+        : out_(out), window_(window), seekable_(out.tellp() != -1) {
+    }
+
+    /*
+        Begins a compound; at the root this starts the document
+        @param name name of the root compound, ignored below the root
+    */
+    void beginCompound(const std::string &name = "") {
+        if (stack_.empty()) {
+            if (finished_) {
+                throw std::logic_error(
+                    "StreamWriter::beginCompound: document already ended");
+            }
+            putType(TagType::TAG_COMPOUND);
+            putString(name);
+        } else {
+            header(TagType::TAG_COMPOUND);
+        }
+        stack_.push_back({TagType::TAG_COMPOUND, TagType::TAG_END});
+    }
+
+    /*
+        Sets the name of the next value written into the current compound
+    */
+    void key(std::string name) {
+        if (stack_.empty() || stack_.back().type != TagType::TAG_COMPOUND) {
+            throw std::logic_error("StreamWriter::key: not in a compound");
+        }
+        key_ = std::move(name);
+    }
+
+    /*
+        Begins a list
+        @param elemType type of the elements
+        @param length number of elements if known, -1 to backpatch it
+    */
+    void beginList(TagType elemType, int32_t length = -1) {
+        header(TagType::TAG_LIST);
+        putType(elemType);
+        beginSized(TagType::TAG_LIST, elemType, length);
+    }
+
+    /*
+        Begins a TAG_BYTE_ARRAY, TAG_INT_ARRAY or TAG_LONG_ARRAY filled
+        element by element with value()
+        @param arrayType type of the array
+        @param length number of elements if known, -1 to backpatch it
+    */
+    void beginArray(TagType arrayType, int32_t length = -1) {
+        TagType elemType;
+        switch (arrayType) {
+        case TagType::TAG_BYTE_ARRAY:
+            elemType = TagType::TAG_BYTE;
+            break;
+        case TagType::TAG_INT_ARRAY:
+            elemType = TagType::TAG_INT;
+            break;
+        case TagType::TAG_LONG_ARRAY:
+            elemType = TagType::TAG_LONG;
+            break;
+        default:
+            throw std::invalid_argument(
+                "StreamWriter::beginArray: " + TAGTYPE_TO_NAME.at(arrayType) +
+                " is not an array type");
+        }
+        header(arrayType);
+        beginSized(arrayType, elemType, length);
+    }
+
+    /*
+        Writes a single value: a number or a string, or an element of the
+        current array
+    */
+    template <typename T>
+    void value(const T &val) {
+        constexpr TagType type = TagTypeOf<T>::value;
+        if (!stack_.empty() && isArray(stack_.back().type)) {
+            auto &top = stack_.back();
+            if (top.elemType != type) {
+                throw std::invalid_argument(
+                    "StreamWriter::value: " + TAGTYPE_TO_NAME.at(type) +
+                    " in " + TAGTYPE_TO_NAME.at(top.type));
+            }
+            ++top.count;
+        } else {
+            header(type);
+        }
+        if constexpr (std::is_same_v<T, std::string>) {
+            putString(val);
+        } else {
+            put<T>(val);
+        }
+    }
+
+    void value(const char *val) {
+        value(std::string(val));
+    }
+
+    template <typename T>
+    void value(const std::vector<T> &val) {
+        beginArray(TagTypeOf<std::vector<T>>::value,
+                   static_cast<int32_t>(val.size()));
+        for (const auto &elem : val) {
+            value(elem);
+        }
+        end();
+    }
+
+    /*
+        Ends the innermost compound, list or array
+    */
+    void end() {
+        if (stack_.empty()) {
+            throw std::logic_error("StreamWriter::end: nothing to end");
+        }
+        auto top = stack_.back();
+        stack_.pop_back();
+
+        if (top.type == TagType::TAG_COMPOUND) {
+            putType(TagType::TAG_END);
+        } else if (top.lengthPos < 0) {
+            if (top.declared != top.count) {
+                throw std::logic_error(
+                    "StreamWriter::end: " + TAGTYPE_TO_NAME.at(top.type) +
+                    " declared " + std::to_string(top.declared) +
+                    " elements but got " + std::to_string(top.count));
+            }
+        } else {
+            patchLength(top.lengthPos, top.count);
+        }
+
+        if (stack_.empty()) {
+            finished_ = true;
+            flush();
+        }
+    }
+
+    /*
+        Returns true once the root compound has ended
+    */
+    bool finished() const {
+        return finished_;
+    }
+
+private:
+    struct Frame {
+        TagType type;
+        TagType elemType;
+        int32_t count = 0;
+        int32_t declared = -1;
+        std::streamoff lengthPos = -1;
+    };
+
+    static bool isArray(TagType type) {
+        return type == TagType::TAG_BYTE_ARRAY ||
+               type == TagType::TAG_INT_ARRAY ||
+               type == TagType::TAG_LONG_ARRAY;
+    }
+
+    /*
+        Writes what precedes a payload in the current container: type and
+        name in a compound, nothing but a type check in a list
+    */
+    void header(TagType type) {
+        if (stack_.empty()) {
+            throw std::logic_error(
+                "StreamWriter: the document should be a compound");
+        }
+        auto &top = stack_.back();
+        if (top.type == TagType::TAG_COMPOUND) {
+            if (!key_.has_value()) {
+                throw std::logic_error("StreamWriter: " +
+                                       TAGTYPE_TO_NAME.at(type) +
+                                       " in a compound needs a key");
+            }
+            putType(type);
+            putString(key_.value());
+            key_.reset();
+        } else if (top.type == TagType::TAG_LIST && top.elemType == type) {
+            ++top.count;
+        } else {
+            throw std::invalid_argument(
+                "StreamWriter: " + TAGTYPE_TO_NAME.at(type) + " in " +
+                TAGTYPE_TO_NAME.at(top.type) + " of " +
+                TAGTYPE_TO_NAME.at(top.elemType));
+        }
+    }
+
+    void beginSized(TagType type, TagType elemType, int32_t length) {
+        Frame frame{type, elemType};
+        if (length >= 0) {
+            frame.declared = length;
+            put<int32_t>(length);
+        } else {
+            if (seekable_) {
+                flush();
+                frame.lengthPos = out_.tellp();
+            } else {
+                frame.lengthPos = static_cast<std::streamoff>(buffer_.size());
+                ++pending_;
+            }
+            put<int32_t>(0);
+        }
+        stack_.push_back(frame);
+    }
+
+    void patchLength(std::streamoff pos, int32_t count) {
+        int32_t tmp = endian::refineBigEndian<int32_t>(count);
+        auto bytes = reinterpret_cast<const char *>(&tmp);
+        if (seekable_) {
+            flush();
+            auto cur = out_.tellp();
+            out_.seekp(pos);
+            out_.write(bytes, sizeof(tmp));
+            out_.seekp(cur);
+        } else {
+            buffer_.replace(static_cast<size_t>(pos), sizeof(tmp), bytes,
+                            sizeof(tmp));
+            if (--pending_ == 0) {
+                flush();
+            }
+        }
+    }
+
+    void emit(const char *data, size_t len) {
+        buffer_.append(data, len);
+        if (pending_ == 0) {
+            if (buffer_.size() >= 4096) {
+                flush();
+            }
+        } else if (buffer_.size() > window_) {
+            throw std::length_error(
+                "StreamWriter: pending length exceeds the buffer window of "
+                "a non-seekable sink, pass the length to beginList");
+        }
+    }
+
+    void flush() {
+        if (pending_ == 0 && !buffer_.empty()) {
+            out_.write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+    }
+
+    template <typename T>
+    void put(const T &val) {
+        T tmp = endian::refineBigEndian<T>(val);
+        emit(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
+    }
+
+    void putString(const std::string &val) {
+        if (val.size() > UINT16_MAX) {
+            throw std::length_error(
+                "StreamWriter: string longer than 65535 bytes");
+        }
+        put<uint16_t>(static_cast<uint16_t>(val.size()));
+        emit(val.data(), val.size());
+    }
+
+    void putType(TagType val) {
+        put<uint8_t>(static_cast<uint8_t>(val));
+    }
+
+private:
+    std::ostream &out_;
+    const size_t window_;
+    const bool seekable_;
+    std::vector<Frame> stack_;
+    std::optional<std::string> key_;
+    std::string buffer_;
+    int pending_ = 0;
+    bool finished_ = false;
+};
+
+
+}  // namespace nbt
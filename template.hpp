@@ -0,0 +1,235 @@
+/**
+    Pre-serialized NBT templates
+    @file template.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unordered_set>
+
+#include "nbt.hpp"
+
+
+namespace nbt {
+
+
+/*
+    A document serialized once, with placeholder fields ("holes") that are
+    patched per instance. Fixed size holes are overwritten in place,
+    string holes are spliced in with a fixed-up length prefix.
+
+    Holes are addressed by path: compound keys and list indices joined by
+    '.', relative to the root compound, e.g. "Item.Count" or "Pos.0".
+*/
+class DocumentTemplate {
+public:
+    struct Hole {
+        std::string path;
+        TagType type;
+        size_t offset;
+        size_t size;
+    };
+
+    class Instance {
+    public:
+        explicit Instance(const DocumentTemplate &tpl)
+            : tpl_(&tpl), bytes_(tpl.bytes_), strings_(tpl.holes_.size()) {
+        }
+
+        /*
+            Patches a numeric hole
+            @param hole index of the hole
+            @param val the new value, its type should match the hole
+        */
+        template <typename T>
+        void set(size_t hole, T val) {
+            const auto &h = tpl_->checkHole(hole, TagTypeOf<T>::value);
+            T tmp = endian::refineBigEndian<T>(val);
+            std::memcpy(&bytes_[h.offset], &tmp, sizeof(tmp));
+        }
+
+        void set(size_t hole, std::string val) {
+            tpl_->checkHole(hole, TagType::TAG_STRING);
+            if (val.size() > UINT16_MAX) {
+                throw std::length_error(
+                    "DocumentTemplate::Instance::set: string longer than "
+                    "65535 bytes");
+            }
+            strings_[hole] = std::move(val);
+        }
+
+        void set(size_t hole, const char *val) {
+            set(hole, std::string(val));
+        }
+
+        /*
+            Appends the serialized document to out
+            @param out the output buffer
+        */
+        void writeTo(std::string &out) const {
+            size_t from = 0;
+            for (auto hole : tpl_->stringHoles_) {
+                if (!strings_[hole].has_value()) {
+                    continue;
+                }
+                const auto &h = tpl_->holes_[hole];
+                const auto &val = strings_[hole].value();
+                out.append(bytes_, from, h.offset - from);
+                auto len = endian::refineBigEndian<uint16_t>(
+                    static_cast<uint16_t>(val.size()));
+                out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+                out.append(val);
+                from = h.offset + h.size;
+            }
+            out.append(bytes_, from, std::string::npos);
+        }
+
+        std::string str() const {
+            std::string out;
+            writeTo(out);
+            return out;
+        }
+
+    private:
+        const DocumentTemplate *tpl_;
+        std::string bytes_;
+        std::vector<std::optional<std::string>> strings_;
+    };
+
+    /*
+        Serializes the document and records the holes
+        @param doc the root Tag
+        @param holes paths of the placeholder fields, a hole's index is its
+               position in this list; each path may be listed once
+    */
+    DocumentTemplate(const Tag &doc, const std::vector<std::string> &holes) {
+        std::unordered_set<std::string> seen;
+        for (const auto &path : holes) {
+            if (!seen.insert(path).second) {
+                throw std::invalid_argument("DocumentTemplate: hole '" +
+                                            path + "' listed twice");
+            }
+            holes_.push_back({path, TagType::TAG_END, 0, 0});
+        }
+
+        std::ostringstream out;
+        writeStream<TagType>(out, doc.getTagType());
+        writeStream<std::string>(out, doc.getName().value_or(""));
+        compile(out, doc, "");
+        bytes_ = out.str();
+
+        for (size_t i = 0; i < holes_.size(); ++i) {
+            if (holes_[i].type == TagType::TAG_END) {
+                throw std::invalid_argument(
+                    "DocumentTemplate: hole '" + holes_[i].path +
+                    "' not found");
+            }
+            if (holes_[i].type == TagType::TAG_STRING) {
+                stringHoles_.push_back(i);
+            }
+        }
+        std::sort(stringHoles_.begin(), stringHoles_.end(),
+                  [this](size_t a, size_t b) {
+                      return holes_[a].offset < holes_[b].offset;
+                  });
+    }
+
+    /*
+        Returns the index of the hole with given path
+    */
+    size_t hole(const std::string &path) const {
+        for (size_t i = 0; i < holes_.size(); ++i) {
+            if (holes_[i].path == path) {
+                return i;
+            }
+        }
+        throw std::out_of_range("DocumentTemplate::hole: '" + path +
+                                "' not found");
+    }
+
+    const auto &getHoles() const {
+        return holes_;
+    }
+
+    /*
+        Returns a fresh copy of the serialized document to be patched
+    */
+    Instance instantiate() const {
+        return Instance(*this);
+    }
+
+private:
+    const Hole &checkHole(size_t hole, TagType type) const {
+        const auto &h = holes_.at(hole);
+        if (h.type != type) {
+            throw std::invalid_argument("DocumentTemplate: hole '" + h.path +
+                                        "' is " + TAGTYPE_TO_NAME.at(h.type));
+        }
+        return h;
+    }
+
+    void compile(std::ostream &out, const Tag &tag, const std::string &path) {
+        for (auto &h : holes_) {
+            if (h.path != path || path.empty()) {
+                continue;
+            }
+            switch (tag.getTagType()) {
+            case TagType::TAG_BYTE:
+            case TagType::TAG_SHORT:
+            case TagType::TAG_INT:
+            case TagType::TAG_LONG:
+            case TagType::TAG_FLOAT:
+            case TagType::TAG_DOUBLE:
+            case TagType::TAG_STRING:
+                break;
+            default:
+                throw std::invalid_argument("DocumentTemplate: hole '" +
+                                            path + "' should be a number "
+                                                   "or a string");
+            }
+            h.type = tag.getTagType();
+            h.offset = static_cast<size_t>(out.tellp());
+            tag.encode(out);
+            h.size = static_cast<size_t>(out.tellp()) - h.offset;
+            return;
+        }
+
+        const auto prefix = path.empty() ? path : path + ".";
+        switch (tag.getTagType()) {
+        case TagType::TAG_COMPOUND:
+            for (const auto &it :
+                 static_cast<const TagCompound &>(tag).getValue()) {
+                writeStream<TagType>(out, it.second->getTagType());
+                writeStream<std::string>(out, it.first);
+                compile(out, *it.second, prefix + it.first);
+            }
+            writeStream<TagType>(out, TagType::TAG_END);
+            break;
+        case TagType::TAG_LIST: {
+            const auto &list = static_cast<const TagList &>(tag);
+            writeStream<TagType>(out, list.getElementType());
+            writeStream<int32_t>(out,
+                                 static_cast<int32_t>(list.getValue().size()));
+            for (size_t i = 0; i < list.getValue().size(); ++i) {
+                compile(out, *list.getValue()[i], prefix + std::to_string(i));
+            }
+            break;
+        }
+        default:
+            tag.encode(out);
+            break;
+        }
+    }
+
+private:
+    std::string bytes_;
+    std::vector<Hole> holes_;
+    std::vector<size_t> stringHoles_;
+};
+
+
+}  // namespace nbt
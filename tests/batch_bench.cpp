@@ -0,0 +1,96 @@
+/**
+    Throughput of batched decoding of small documents
+    @file batch_bench.cpp
+    @author Mudream
+*/
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+#include "batch.hpp"
+#include "stream_writer.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Returns an item stack like document
+*/
+std::string itemStack(int i) {
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("");
+    w.key("id");
+    w.value("minecraft:diamond_sword");
+    w.key("Count");
+    w.value(static_cast<int8_t>(1 + i % 64));
+    w.key("Slot");
+    w.value(static_cast<int8_t>(i % 36));
+    w.key("tag");
+    w.beginCompound();
+    w.key("Damage");
+    w.value(static_cast<int32_t>(i % 1561));
+    w.key("Enchantments");
+    w.beginList(TagType::TAG_COMPOUND);
+    for (int e = 0; e < 3; ++e) {
+        w.beginCompound();
+        w.key("id");
+        w.value("minecraft:sharpness");
+        w.key("lvl");
+        w.value(static_cast<int16_t>(e + 1));
+        w.end();
+    }
+    w.end();
+    w.end();
+    w.end();
+    return out.str();
+}
+
+template <typename Fn>
+double documentsPerSecond(size_t count, size_t rounds, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        fn();
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(count * rounds) / elapsed.count();
+}
+
+
+}  // namespace
+
+
+int main() {
+    constexpr size_t COUNT = 20000;
+    constexpr size_t ROUNDS = 10;
+    std::vector<std::string> docs;
+    std::vector<std::string_view> buffers;
+    for (size_t i = 0; i < COUNT; ++i) {
+        docs.push_back(itemStack(static_cast<int>(i)));
+    }
+    for (const auto &doc : docs) {
+        buffers.push_back(doc);
+    }
+
+    // Both keep every document alive until the batch is done
+    const double single = documentsPerSecond(COUNT, ROUNDS, [&] {
+        std::vector<std::unique_ptr<Tag>> out;
+        for (auto buffer : buffers) {
+            BufferStream stream(buffer.data(), buffer.size());
+            out.push_back(readDocument(stream));
+        }
+    });
+    ThreadPool pool;
+    const double batched = documentsPerSecond(
+        COUNT, ROUNDS, [&] { readDocuments(buffers, pool); });
+    std::cout << "readDocument per buffer: " << static_cast<uint64_t>(single)
+              << " docs/s" << std::endl;
+    std::cout << "readDocuments on " << pool.size()
+              << " threads: " << static_cast<uint64_t>(batched) << " docs/s"
+              << std::endl;
+}
@@ -0,0 +1,512 @@
+/**
+    Round trip of a small Bedrock LevelDB fixture
+    @file bedrock_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <atomic>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include <zlib.h>
+
+#include "bedrock.hpp"
+
+using namespace nbt;
+using namespace nbt::leveldb;
+
+
+namespace {
+
+
+struct Entry {
+    std::string key;
+    uint64_t sequence;
+    ValueType type;
+    std::string value;
+};
+
+void putVarint(std::string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+template <typename T>
+void putLittle(std::string &out, T v) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out += static_cast<char>((static_cast<uint64_t>(v) >> (8 * i)) & 0xff);
+    }
+}
+
+void putSlice(std::string &out, std::string_view v) {
+    putVarint(out, v.size());
+    out.append(v);
+}
+
+/*
+    Returns a little endian compound {id: string, v: int, arr: int[2],
+    l: short list, d: double}
+*/
+std::string littleNbt(const std::string &id, int32_t v) {
+    std::string s;
+    auto name = [&](char type, std::string_view key) {
+        s += type;
+        putLittle<uint16_t>(s, static_cast<uint16_t>(key.size()));
+        s += key;
+    };
+    name(10, "");
+    name(8, "id");
+    putLittle<uint16_t>(s, static_cast<uint16_t>(id.size()));
+    s += id;
+    name(3, "v");
+    putLittle<int32_t>(s, v);
+    name(11, "arr");
+    putLittle<int32_t>(s, 2);
+    putLittle<int32_t>(s, v);
+    putLittle<int32_t>(s, -v);
+    name(9, "l");
+    s += static_cast<char>(2);
+    putLittle<int32_t>(s, 2);
+    putLittle<int16_t>(s, 7);
+    putLittle<int16_t>(s, -7);
+    name(6, "d");
+    const double d = 1.5;
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    putLittle<uint64_t>(s, bits);
+    s += '\0';
+    return s;
+}
+
+std::string chunkKey(int32_t x, int32_t z, int32_t dimension, uint8_t tag) {
+    std::string key;
+    putLittle(key, x);
+    putLittle(key, z);
+    if (dimension != 0) {
+        putLittle(key, dimension);
+    }
+    key += static_cast<char>(tag);
+    return key;
+}
+
+/*
+    Returns records framed in 32 KiB log blocks
+*/
+std::string logRecords(const std::vector<std::string> &records) {
+    std::string out;
+    for (const auto &record : records) {
+        size_t pos = 0;
+        bool first = true;
+        do {
+            size_t left = 32768 - out.size() % 32768;
+            if (left < 7) {
+                out.append(left, '\0');
+                left = 32768;
+            }
+            const size_t n = std::min(record.size() - pos, left - 7);
+            const bool last = pos + n == record.size();
+            const char type = first && last ? 1 : first ? 2 : last ? 4 : 3;
+            std::string body(1, type);
+            body.append(record, pos, n);
+            putLittle<uint32_t>(out, maskedCrc(crc32c(body.data(),
+                                                      body.size())));
+            putLittle<uint16_t>(out, static_cast<uint16_t>(n));
+            out += body;
+            pos += n;
+            first = false;
+        } while (pos < record.size());
+    }
+    return out;
+}
+
+std::string writeBatch(uint64_t sequence, const std::vector<Entry> &entries) {
+    std::string out;
+    putLittle<uint64_t>(out, sequence);
+    putLittle<uint32_t>(out, static_cast<uint32_t>(entries.size()));
+    for (const auto &e : entries) {
+        out += static_cast<char>(e.type);
+        putSlice(out, e.key);
+        if (e.type == ValueType::VALUE) {
+            putSlice(out, e.value);
+        }
+    }
+    return out;
+}
+
+std::string rawDeflate(const std::string &in) {
+    z_stream zs{};
+    deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    std::string out(compressBound(in.size()) + 64, '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+/*
+    Returns Snappy data made only of literals
+*/
+std::string snappyLiterals(const std::string &in) {
+    std::string out;
+    putVarint(out, in.size());
+    for (size_t pos = 0; pos < in.size(); pos += 60) {
+        const size_t n = std::min<size_t>(in.size() - pos, 60);
+        out += static_cast<char>((n - 1) << 2);
+        out.append(in, pos, n);
+    }
+    return out;
+}
+
+std::string block(
+    const std::vector<std::pair<std::string, std::string>> &entries) {
+    std::string out, prev;
+    for (const auto &e : entries) {
+        size_t shared = 0;
+        while (shared < prev.size() && shared < e.first.size() &&
+               prev[shared] == e.first[shared]) {
+            ++shared;
+        }
+        putVarint(out, shared);
+        putVarint(out, e.first.size() - shared);
+        putVarint(out, e.second.size());
+        out.append(e.first, shared);
+        out += e.second;
+        prev = e.first;
+    }
+    putLittle<uint32_t>(out, 0);
+    putLittle<uint32_t>(out, 1);
+    return out;
+}
+
+std::string appendBlock(std::string &file, const std::string &raw,
+                        BlockCompression compression) {
+    const std::string data = compression == BlockCompression::NONE ? raw
+                             : compression == BlockCompression::ZLIB_RAW
+                                 ? rawDeflate(raw)
+                                 : snappyLiterals(raw);
+    const size_t offset = file.size();
+    file += data;
+    file += static_cast<char>(compression);
+    putLittle<uint32_t>(file, maskedCrc(crc32c(file.data() + offset,
+                                               data.size() + 1)));
+    std::string handle;
+    putVarint(handle, offset);
+    putVarint(handle, data.size());
+    return handle;
+}
+
+/*
+    Returns a table of sorted entries, perBlock entries per data block
+*/
+std::string table(const std::vector<Entry> &entries,
+                  BlockCompression compression, size_t perBlock) {
+    std::string file;
+    std::vector<std::pair<std::string, std::string>> index;
+    for (size_t i = 0; i < entries.size(); i += perBlock) {
+        std::vector<std::pair<std::string, std::string>> data;
+        for (size_t j = i; j < std::min(entries.size(), i + perBlock); ++j) {
+            std::string key = entries[j].key;
+            putLittle<uint64_t>(key, (entries[j].sequence << 8) |
+                                         static_cast<uint64_t>(
+                                             entries[j].type));
+            data.push_back({key, entries[j].value});
+        }
+        index.push_back(
+            {data.back().first, appendBlock(file, block(data), compression)});
+    }
+    std::string footer = appendBlock(file, block({}), BlockCompression::NONE);
+    footer += appendBlock(file, block(index), compression);
+    footer.resize(40, '\0');
+    putLittle<uint64_t>(footer, Table::MAGIC);
+    return file + footer;
+}
+
+void write(const std::filesystem::path &path, const std::string &data) {
+    std::ofstream(path, std::ios::binary) << data;
+}
+
+/*
+    Returns a table whose index points at one data block holding raw
+    @param handle replaces the handle of the data block if not empty
+*/
+std::string rawTable(const std::string &raw, const std::string &handle = "") {
+    std::string file;
+    auto data = appendBlock(file, raw, BlockCompression::NONE);
+    std::string footer = appendBlock(file, block({}), BlockCompression::NONE);
+    footer += appendBlock(
+        file, block({{"k", handle.empty() ? data : handle}}),
+        BlockCompression::NONE);
+    footer.resize(40, '\0');
+    putLittle<uint64_t>(footer, Table::MAGIC);
+    return file + footer;
+}
+
+/*
+    Returns true if reading the table throws a runtime_error
+*/
+bool rejected(const std::filesystem::path &path, const std::string &data) {
+    write(path, data);
+    try {
+        Table(path.string()).forEach(
+            [](std::string_view, uint64_t, ValueType, std::string_view) {});
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+void testLittleEndian() {
+    const auto a = littleNbt("minecraft:chest", 42);
+    const auto both = a + littleNbt("b", 1);
+    auto docs = readLittleEndianDocuments(both.data(), both.size());
+    assert(docs.size() == 2);
+    const auto &c = dynamic_cast<TagCompound &>(*docs[0]).getValue();
+    assert(dynamic_cast<TagInt &>(*c.at("v")).getValue() == 42);
+    assert(dynamic_cast<TagString &>(*c.at("id")).getValue() ==
+           "minecraft:chest");
+    assert(dynamic_cast<TagIntArray &>(*c.at("arr")).getValue()[1] == -42);
+    assert(dynamic_cast<TagDouble &>(*c.at("d")).getValue() == 1.5);
+    const auto &l = dynamic_cast<TagList &>(*c.at("l")).getValue();
+    assert(dynamic_cast<TagShort &>(*l[1]).getValue() == -7);
+    bool threw = false;
+    try {
+        littleToBigEndian(a.data(), a.size() - 3);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void testKeys() {
+    const auto k = decodeBedrockKey(chunkKey(-3, 5, 1, 0x31));
+    assert(k.chunk && k.x == -3 && k.z == 5 && k.dimension == 1);
+    assert(k.tag == BedrockTag::BLOCK_ENTITY && k.isNbt());
+    auto subChunk = chunkKey(2, 2, 0, 0x2f);
+    subChunk += static_cast<char>(-4);
+    const auto s = decodeBedrockKey(subChunk);
+    assert(s.chunk && s.subChunk == -4 && !s.isNbt());
+    assert(!decodeBedrockKey("~local_player").chunk);
+    assert(decodeBedrockKey("~local_player").isNbt());
+    assert(!decodeBedrockKey("LevelChunkMetaDataDictionary").isNbt());
+    assert(!decodeBedrockKey("abcdefghi").chunk);
+}
+
+void testSnappy() {
+    std::string s;
+    putVarint(s, 12);
+    s += static_cast<char>(3 << 2);
+    s += "abcd";
+    // Copy of 8 bytes from 4 back, overlapping its own output
+    s += static_cast<char>(((8 - 1) << 2) | 2);
+    putLittle<uint16_t>(s, 4);
+    assert(snappyUncompress(s.data(), s.size()) == "abcdabcdabcd");
+}
+
+void testVersions() {
+    Database::Versions a, b;
+    a.add("k1", {5, 0, false});
+    a.add("k1", {3, 1, false});
+    b.add("k1", {9, 2, true});
+    b.add(std::string(100000, 'x'), {1, 2, false});
+    a.merge(std::move(b));
+    assert(a.size() == 2);
+    assert(a.find("k1")->sequence == 9 && a.find("k1")->deleted);
+    assert(a.find(std::string(100000, 'x'))->source == 2);
+    assert(a.find("k2") == nullptr);
+}
+
+void testWorld(const std::filesystem::path &root) {
+    const auto dir = root / "db";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(dir);
+    auto byKey = [](const Entry &a, const Entry &b) { return a.key < b.key; };
+
+    std::vector<Entry> older, newer;
+    for (int x = 0; x < 40; ++x) {
+        older.push_back({chunkKey(x, 0, 0, 0x31), 10u + x, ValueType::VALUE,
+                         littleNbt("old", x)});
+    }
+    older.push_back(
+        {"~local_player", 5, ValueType::VALUE, littleNbt("player", 7)});
+    // Truncated compound, reported and skipped by scan
+    older.push_back({chunkKey(50, 0, 0, 0x31), 9, ValueType::VALUE,
+                     std::string("\x0a\x05\x00", 3)});
+    std::sort(older.begin(), older.end(), byKey);
+    for (int x = 0; x < 10; ++x) {
+        newer.push_back({chunkKey(x, 0, 0, 0x31), 100u + x, ValueType::VALUE,
+                         littleNbt("new", x)});
+    }
+    newer.push_back({chunkKey(11, 0, 0, 0x31), 150, ValueType::DELETION, ""});
+    newer.push_back({chunkKey(1, 1, 0, 0x2c), 151, ValueType::VALUE, "\x28"});
+    std::sort(newer.begin(), newer.end(), byKey);
+    write(dir / "000005.ldb", table(older, BlockCompression::ZLIB_RAW, 7));
+    write(dir / "000006.ldb", table(newer, BlockCompression::SNAPPY, 3));
+
+    // Overwrite chunk 20, delete chunk 21, then a value spanning log blocks
+    std::string big;
+    for (int i = 0; i < 3000; ++i) {
+        big += littleNbt("big", i);
+    }
+    const auto log = logRecords(
+        {writeBatch(200, {{chunkKey(20, 0, 0, 0x31), 0, ValueType::VALUE,
+                           littleNbt("log", 20)},
+                          {chunkKey(21, 0, 0, 0x31), 0, ValueType::DELETION,
+                           ""}}),
+         writeBatch(300, {{chunkKey(30, 0, 0, 0x32), 0, ValueType::VALUE,
+                           big}})});
+    write(dir / "000007.log", log + std::string("\x01\x02\x03", 3));
+
+    // Tables 4, 5 and 6 added, log 7 current, table 4 deleted again
+    std::string edit;
+    putVarint(edit, 1);
+    putSlice(edit, "leveldb.BytewiseComparator");
+    putVarint(edit, 2);
+    putVarint(edit, 7);
+    for (int number : {4, 5, 6}) {
+        putVarint(edit, 7);
+        putVarint(edit, 0);
+        putVarint(edit, number);
+        putVarint(edit, 100);
+        putSlice(edit, "a");
+        putSlice(edit, "z");
+    }
+    std::string removal;
+    putVarint(removal, 6);
+    putVarint(removal, 0);
+    putVarint(removal, 4);
+    write(dir / "MANIFEST-000002", logRecords({edit, removal}));
+    write(dir / "CURRENT", "MANIFEST-000002\n");
+    write(dir / "000003.log", "stale log");
+
+    BedrockWorld world(root.string());
+    assert(world.database().sources().size() == 3);
+    std::map<std::string, std::string> live;
+    world.forEachRecord([&](const BedrockKey &k, std::string_view v) {
+        live[std::string(k.name)] = std::string(v);
+    });
+    // 40 chunks less 11 and 21, chunk 50, the player, version and entity
+    assert(live.size() == 38 + 1 + 1 + 1 + 1);
+
+    struct State {
+        std::map<int32_t, std::string> ids;
+        size_t docs = 0;
+        size_t players = 0;
+    };
+    ThreadPool pool(4);
+    std::atomic<int> failed{0};
+    auto state = world.scan<State>(
+        pool,
+        [](State &s, const BedrockKey &k, const Tag &tag) {
+            const auto &c = dynamic_cast<const TagCompound &>(tag);
+            ++s.docs;
+            if (!k.chunk) {
+                ++s.players;
+            } else if (k.tag == BedrockTag::BLOCK_ENTITY) {
+                s.ids[k.x] =
+                    dynamic_cast<const TagString &>(*c.getValue().at("id"))
+                        .getValue();
+            }
+        },
+        [](State &total, State &&partial) {
+            total.ids.merge(partial.ids);
+            total.docs += partial.docs;
+            total.players += partial.players;
+        },
+        Priority::BACKGROUND,
+        [&](const BedrockKey &k, const std::exception &) {
+            assert(k.x == 50);
+            ++failed;
+        });
+    assert(failed == 1);
+    assert(state.players == 1);
+    assert(state.ids.size() == 38);
+    assert(state.ids[0] == "new" && state.ids[9] == "new");
+    assert(state.ids[10] == "old" && state.ids[20] == "log");
+    assert(!state.ids.count(11) && !state.ids.count(21));
+    assert(state.docs == 38 + 1 + 3000);
+
+    // Without CURRENT every table and log of the directory is read
+    std::filesystem::remove(dir / "CURRENT");
+    std::filesystem::remove(dir / "000003.log");
+    assert(BedrockWorld(dir.string()).database().sources().size() == 3);
+    std::filesystem::remove_all(root);
+}
+
+void testCorruptTables(const std::filesystem::path &root) {
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    const auto path = root / "000001.ldb";
+    std::vector<Entry> entries;
+    for (int x = 0; x < 20; ++x) {
+        entries.push_back({chunkKey(x, 0, 0, 0x31), 1u + x, ValueType::VALUE,
+                           littleNbt("t", x)});
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.key < b.key; });
+    const auto good = table(entries, BlockCompression::NONE, 4);
+    assert(!rejected(path, good));
+
+    // Cut anywhere, a table fails cleanly instead of reading past its end
+    for (size_t cut = 0; cut < good.size(); cut += 7) {
+        assert(rejected(path, good.substr(0, cut)));
+    }
+
+    // Handles whose size would wrap around when added to
+    constexpr uint64_t MAX = UINT64_MAX;
+    for (uint64_t size : {MAX, MAX - 4, MAX - 5, MAX >> 1}) {
+        std::string handle;
+        putVarint(handle, 0);
+        putVarint(handle, size);
+        assert(rejected(path, rawTable(block({{"a", "b"}}), handle)));
+        std::string patched;
+        putVarint(patched, 0);
+        putVarint(patched, 0);
+        patched += handle;
+        patched.resize(40, '\0');
+        putLittle<uint64_t>(patched, Table::MAGIC);
+        assert(rejected(path, good.substr(0, good.size() - 48) + patched));
+    }
+
+    // Entries whose key or value length would wrap around
+    for (auto lengths : {std::pair<uint64_t, uint64_t>{MAX, 2},
+                         {2, MAX},
+                         {4, MAX - 3},
+                         {MAX >> 1, MAX >> 1}}) {
+        std::string raw;
+        putVarint(raw, 0);
+        putVarint(raw, lengths.first);
+        putVarint(raw, lengths.second);
+        raw += "abcdefgh";
+        putLittle<uint32_t>(raw, 0);
+        putLittle<uint32_t>(raw, 1);
+        assert(rejected(path, rawTable(raw)));
+    }
+    std::filesystem::remove_all(root);
+}
+
+
+}  // namespace
+
+
+int main() {
+    testLittleEndian();
+    testKeys();
+    testSnappy();
+    testVersions();
+    testWorld(std::filesystem::temp_directory_path() / "nbt_bedrock_test");
+    testCorruptTables(std::filesystem::temp_directory_path() /
+                      "nbt_bedrock_corrupt");
+    std::cout << "bedrock_test: ok" << std::endl;
+}
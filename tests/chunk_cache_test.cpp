@@ -0,0 +1,221 @@
+/**
+    Two-tier document cache, single and multi threaded
+    @file chunk_cache_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+#include "chunk_cache.hpp"
+#include "snbt.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+using Cache = ChunkCache<int>;
+
+/*
+    Returns a chunk-like document, its arrays compressible but distinct
+    per key
+*/
+std::unique_ptr<Tag> chunk(int key) {
+    std::string text = "{xPos:" + std::to_string(key) +
+                       ",Status:\"minecraft:full\",Heightmap:[L;";
+    for (int i = 0; i < 256; ++i) {
+        text += (i == 0 ? "" : ",") + std::to_string(key * 1000 + i % 16);
+    }
+    text += "],Biomes:[I;";
+    for (int i = 0; i < 256; ++i) {
+        text += (i == 0 ? "" : ",") + std::to_string(i / 64);
+    }
+    return readSNBT(text + "]}");
+}
+
+std::string encode(const Tag &doc) {
+    std::ostringstream out;
+    writeDocument(out, doc);
+    return out.str();
+}
+
+template <typename TagT>
+auto valueOf(const Tag &doc, const std::string &key) {
+    const auto &value = dynamic_cast<const TagCompound &>(doc).getValue();
+    return dynamic_cast<const TagT &>(*value.at(key)).getValue();
+}
+
+/*
+    Returns whether doc is the chunk of key. Compounds are compared by
+    value, their encoding order changes across a decode.
+*/
+bool holds(const Cache::Document &doc, int key) {
+    const auto expected = chunk(key);
+    return doc && valueOf<TagInt>(*doc, "xPos") == key &&
+           valueOf<TagString>(*doc, "Status") == "minecraft:full" &&
+           valueOf<TagLongArray>(*doc, "Heightmap") ==
+               valueOf<TagLongArray>(*expected, "Heightmap") &&
+           valueOf<TagIntArray>(*doc, "Biomes") ==
+               valueOf<TagIntArray>(*expected, "Biomes");
+}
+
+const size_t CHUNK_SIZE = decodedSize(*chunk(0));
+
+void testTiers() {
+    // Room for two decoded chunks
+    Cache cache(CHUNK_SIZE * 5 / 2, 1 << 20);
+    for (int key = 0; key < 3; ++key) {
+        cache.put(key, chunk(key));
+    }
+    auto stats = cache.stats();
+    assert(stats.hot.entries == 2 && stats.cold.entries == 1);
+    assert(stats.hot.bytes == 2 * CHUNK_SIZE);
+    assert(stats.demotions == 1);
+    // The cold tier holds compressed bytes, smaller than the document
+    assert(stats.cold.bytes < encode(*chunk(0)).size());
+
+    assert(holds(cache.get(2), 2));
+    assert(holds(cache.get(1), 1));
+    stats = cache.stats();
+    assert(stats.hot.hits == 2 && stats.hot.misses == 0);
+
+    // A cold hit promotes key 0 and demotes the least recent, key 2
+    assert(holds(cache.get(0), 0));
+    stats = cache.stats();
+    assert(stats.hot.hits == 2 && stats.hot.misses == 1);
+    assert(stats.cold.hits == 1 && stats.cold.misses == 0);
+    assert(stats.promotions == 1 && stats.demotions == 2);
+    assert(stats.hot.entries == 2 && stats.cold.entries == 1);
+
+    // Key 2 went down and comes back up intact
+    assert(holds(cache.get(2), 2));
+    assert(holds(cache.get(1), 1));
+    stats = cache.stats();
+    assert(stats.promotions == 3 && stats.demotions == 4);
+    assert(stats.hot.hits == 2 && stats.cold.hits == 3);
+
+    assert(cache.get(7) == nullptr);
+    stats = cache.stats();
+    assert(stats.hot.misses == 4 && stats.cold.misses == 1);
+
+    // A replaced key drops its cold bytes
+    cache.put(0, chunk(5));
+    assert(holds(cache.get(0), 5));
+    cache.erase(0);
+    assert(cache.get(0) == nullptr);
+}
+
+void testColdBudget() {
+    const auto coldSize = lz4Compress(encode(*chunk(0)).data(),
+                                      encode(*chunk(0)).size())
+                              .size();
+    // One decoded chunk, and about two compressed ones
+    Cache cache(CHUNK_SIZE, coldSize * 5 / 2);
+    for (int key = 0; key < 5; ++key) {
+        cache.put(key, chunk(key));
+    }
+    auto stats = cache.stats();
+    assert(stats.hot.entries == 1 && stats.cold.entries == 2);
+    assert(stats.demotions == 4 && stats.evictions == 2);
+    assert(stats.cold.bytes <= stats.cold.budget);
+    assert(cache.get(0) == nullptr && cache.get(1) == nullptr);
+    assert(holds(cache.get(2), 2));
+
+    // Shrinking everything leaves the hot tier empty
+    cache.shrink(1.0);
+    stats = cache.stats();
+    assert(stats.hot.entries == 0 && stats.hot.bytes == 0);
+    cache.setBudgets(0, 0);
+    stats = cache.stats();
+    assert(stats.cold.entries == 0 && stats.cold.bytes == 0);
+    assert(cache.get(2) == nullptr);
+}
+
+void testPutEncoded() {
+    Cache cache(1 << 20, 1 << 20);
+    const auto bytes = encode(*chunk(3));
+    cache.putEncoded(3, bytes);
+    auto stats = cache.stats();
+    assert(stats.hot.entries == 0 && stats.cold.entries == 1);
+    assert(stats.cold.bytes < bytes.size());
+
+    const auto doc = cache.get(3);
+    assert(holds(doc, 3));
+    stats = cache.stats();
+    assert(stats.cold.hits == 1 && stats.promotions == 1);
+    assert(stats.hot.entries == 1 && stats.cold.entries == 0);
+    assert(stats.hot.bytes == decodedSize(*doc));
+
+    // Encoded bytes replace a decoded entry
+    cache.putEncoded(3, encode(*chunk(4)));
+    assert(holds(cache.get(3), 4));
+
+    int loads = 0;
+    auto load = [&] {
+        ++loads;
+        return chunk(9);
+    };
+    assert(holds(cache.getOrLoad(9, load), 9));
+    assert(holds(cache.getOrLoad(9, load), 9));
+    assert(loads == 1);
+}
+
+void testConcurrent() {
+    constexpr int KEYS = 24;
+    std::vector<std::string> bytes;
+    for (int key = 0; key < KEYS; ++key) {
+        bytes.push_back(encode(*chunk(key)));
+    }
+    Cache cache(CHUNK_SIZE * 6, bytes[0].size() * 2);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 600; ++i) {
+                const int key = (i * 7 + t * 5) % KEYS;
+                if (i % 5 == 0) {
+                    cache.put(key, chunk(key));
+                } else if (i % 11 == 0) {
+                    cache.putEncoded(key, bytes[key]);
+                } else if (i % 37 == 0) {
+                    cache.shrink(0.5);
+                } else if (i % 53 == 0) {
+                    cache.erase(key);
+                } else if (auto doc = cache.get(key)) {
+                    assert(holds(doc, key));
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    const auto stats = cache.stats();
+    assert(stats.hot.bytes <= stats.hot.budget);
+    assert(stats.cold.bytes <= stats.cold.budget);
+    // Promotions below may push entries out, never add any
+    size_t found = 0;
+    for (int key = 0; key < KEYS; ++key) {
+        if (auto doc = cache.get(key)) {
+            assert(holds(doc, key));
+            ++found;
+        }
+    }
+    assert(found > 0 && found <= stats.hot.entries + stats.cold.entries);
+}
+
+
+}  // namespace
+
+
+int main() {
+    testTiers();
+    testColdBudget();
+    testPutEncoded();
+    testConcurrent();
+    std::cout << "chunk_cache_test: ok" << std::endl;
+}
@@ -0,0 +1,186 @@
+/**
+    Round trips and rejections of dictionary coded compact NBT
+    @file compact_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#include "compact.hpp"
+#include "stream_writer.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Returns a chunk like document with every tag type
+*/
+std::string chunk(int seed) {
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("");
+    w.key("DataVersion");
+    w.value(static_cast<int32_t>(3465));
+    w.key("xPos");
+    w.value(static_cast<int32_t>(seed));
+    w.key("LastUpdate");
+    w.value(static_cast<int64_t>(-123456789012LL * seed));
+    w.key("Status");
+    w.value("minecraft:full");
+    w.key("Pos");
+    w.beginList(TagType::TAG_DOUBLE);
+    w.value(0.5 * seed);
+    w.value(-64.0);
+    w.end();
+    w.key("Rotation");
+    w.beginList(TagType::TAG_FLOAT);
+    w.value(1.25f);
+    w.end();
+    w.key("sections");
+    w.beginList(TagType::TAG_COMPOUND);
+    for (int s = -4; s < 4; ++s) {
+        w.beginCompound();
+        w.key("Y");
+        w.value(static_cast<int8_t>(s));
+        w.key("Light");
+        w.value(static_cast<int16_t>(s * 1000));
+        w.key("palette");
+        w.beginList(TagType::TAG_STRING);
+        w.value("minecraft:air");
+        w.value("minecraft:stone");
+        w.end();
+        w.key("data");
+        w.value(std::vector<int64_t>(16, 0x0102030405060708LL * s));
+        w.key("BlockLight");
+        w.value(std::vector<int8_t>(32, static_cast<int8_t>(s)));
+        w.key("heights");
+        w.value(std::vector<int32_t>(8, -s * 70000));
+        w.key("custom_" + std::to_string(s));
+        w.beginCompound();
+        w.end();
+        w.end();
+    }
+    w.end();
+    w.key("empty");
+    w.beginList(TagType::TAG_END);
+    w.end();
+    w.end();
+    return out.str();
+}
+
+template <typename Fn>
+bool throws(Fn fn) {
+    try {
+        fn();
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+KeyDictionary dictionaryOf(const std::vector<std::string> &docs) {
+    KeyCounter counter;
+    for (const auto &doc : docs) {
+        counter.observe(doc.data(), doc.size());
+    }
+    return KeyDictionary().extend(counter.top(64));
+}
+
+void testRoundTrip() {
+    const std::vector<std::string> docs = {chunk(1), chunk(2), chunk(3)};
+    const auto dict = dictionaryOf(docs);
+    CompactEncoder encoder(dict);
+    CompactDecoder decoder(dict);
+    for (const auto &doc : docs) {
+        const auto compact = encoder.encode(doc.data(), doc.size());
+        assert(compact::isCompact(compact.data(), compact.size()));
+        assert(compact.size() < doc.size());
+        assert(decoder.toNbt(compact.data(), compact.size()) == doc);
+
+        // Through Tags, both ways
+        BufferStream stream(doc.data(), doc.size());
+        const auto tag = readDocument(stream);
+        const auto fromTag = encoder.encode(*tag);
+        assert(decoder.toNbt(fromTag.data(), fromTag.size()).size() ==
+               doc.size());
+        std::ostringstream again;
+        writeDocument(again, *decoder.read(compact.data(), compact.size()));
+        assert(again.str().size() == doc.size());
+    }
+}
+
+void testOlderVersion() {
+    const auto doc = chunk(4);
+    const auto v1 = dictionaryOf({doc});
+    // Keys only get appended, so v1 ids keep their meaning in v2
+    const auto v2 = v1.extend({"brand_new", "brand_new", "palette"});
+    assert(v1.version() == 1 && v2.version() == 2);
+    assert(v1.find("palette") >= 0 && v1.find("brand_new") < 0);
+    assert(v2.size() == v1.size() + 1);
+    assert(v2.find("palette") == v1.find("palette"));
+
+    const auto old = CompactEncoder(v1).encode(doc.data(), doc.size());
+    assert(CompactDecoder(v2).toNbt(old.data(), old.size()) == doc);
+
+    std::ostringstream saved;
+    writeDocument(saved, *v2.toTag());
+    std::istringstream in(saved.str());
+    const auto loaded = KeyDictionary::fromTag(*readDocument(in));
+    assert(loaded.version() == 2 && loaded.size() == v2.size());
+    assert(CompactDecoder(loaded).toNbt(old.data(), old.size()) == doc);
+
+    // A document of a newer version needs the newer dictionary
+    const auto newer = CompactEncoder(v2).encode(doc.data(), doc.size());
+    assert(throws(
+        [&] { CompactDecoder(v1).read(newer.data(), newer.size()); }));
+}
+
+void testUnknownKey() {
+    const auto v1 = KeyDictionary().extend({"a", "b"});
+    const auto v2 = v1.extend({"c"});
+    // Compound named by id 2, which only exists from version 2 on
+    std::string doc(1, compact::MAGIC);
+    compact::putVarint(doc, 1);
+    doc += static_cast<char>(TagType::TAG_COMPOUND);
+    compact::putVarint(doc, 2 << 1);
+    doc += static_cast<char>(TagType::TAG_END);
+    assert(throws([&] { CompactDecoder(v2).read(doc.data(), doc.size()); }));
+    assert(throws([&] { CompactDecoder(v2).toNbt(doc.data(), doc.size()); }));
+    // The same bytes are fine once they claim version 2
+    doc[1] = 2;
+    assert(*CompactDecoder(v2).read(doc.data(), doc.size())->getName() ==
+           "c");
+}
+
+void testTruncated() {
+    const auto doc = chunk(5);
+    const auto dict = dictionaryOf({doc});
+    const auto compact = CompactEncoder(dict).encode(doc.data(), doc.size());
+    CompactDecoder decoder(dict);
+    for (size_t cut = 0; cut < compact.size(); ++cut) {
+        assert(throws([&] { decoder.read(compact.data(), cut); }));
+        assert(throws([&] { decoder.toNbt(compact.data(), cut); }));
+    }
+    assert(throws([&] {
+        CompactEncoder(dict).encode(doc.data(), doc.size() - 1);
+    }));
+}
+
+
+}  // namespace
+
+
+int main() {
+    testRoundTrip();
+    testOlderVersion();
+    testUnknownKey();
+    testTruncated();
+    std::cout << "compact_test: ok" << std::endl;
+}
@@ -0,0 +1,128 @@
+/**
+    Scatter-gather encoding, copied and referenced array payloads
+    @file gather_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#include "gather.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+std::string flatten(const GatherEncoder &enc) {
+    std::string out;
+    for (const auto &iov : enc.iovecs()) {
+        out.append(static_cast<const char *>(iov.iov_base), iov.iov_len);
+    }
+    assert(out.size() == enc.size());
+    return out;
+}
+
+/*
+    Returns whether some iovec starts at data
+*/
+bool referenced(const GatherEncoder &enc, const void *data) {
+    for (const auto &iov : enc.iovecs()) {
+        if (iov.iov_base == data) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Document {
+    std::unique_ptr<TagCompound> root;
+    const TagByteArray *bytes;
+    const TagIntArray *ints;
+    const TagLongArray *longs;
+    const TagIntArray *small;
+};
+
+Document document() {
+    std::vector<int32_t> ints(3000);
+    std::vector<int64_t> longs(2000);
+    for (size_t i = 0; i < ints.size(); ++i) {
+        ints[i] = static_cast<int32_t>(i * 70001);
+    }
+    for (size_t i = 0; i < longs.size(); ++i) {
+        longs[i] = static_cast<int64_t>(i) * -0x0102030405LL;
+    }
+    auto bytes = std::make_unique<TagByteArray>(
+        "bytes", std::vector<int8_t>(5000, 7));
+    auto intTag = std::make_unique<TagIntArray>("ints", std::move(ints));
+    auto longTag = std::make_unique<TagLongArray>("longs", std::move(longs));
+    auto small = std::make_unique<TagIntArray>(
+        "small", std::vector<int32_t>{1, -2, 3});
+    Document doc{nullptr, bytes.get(), intTag.get(), longTag.get(),
+                 small.get()};
+    std::unordered_map<std::string, std::unique_ptr<Tag>> val;
+    val["bytes"] = std::move(bytes);
+    val["ints"] = std::move(intTag);
+    val["longs"] = std::move(longTag);
+    val["small"] = std::move(small);
+    val["name"] = std::make_unique<TagString>("name", "gathered");
+    doc.root = std::make_unique<TagCompound>("", std::move(val));
+    return doc;
+}
+
+std::string encoded(const Tag &doc) {
+    std::ostringstream out;
+    writeDocument(out, doc);
+    return out.str();
+}
+
+void testCopied() {
+    const auto doc = document();
+    GatherEncoder enc;
+    enc.encode(*doc.root);
+    assert(flatten(enc) == encoded(*doc.root));
+    // Byte arrays are always referenced, int and long arrays only where
+    // memory is big endian already
+    assert(referenced(enc, doc.bytes->getValue().data()));
+    const bool inPlace = !endian::isHostLittleEndian();
+    assert(referenced(enc, doc.ints->getValue().data()) == inPlace);
+    assert(referenced(enc, doc.longs->getValue().data()) == inPlace);
+}
+
+void testRegistered() {
+    const auto doc = document();
+    const auto ints = toBigEndian(doc.ints->getValue());
+    const auto longs = toBigEndian(doc.longs->getValue());
+    const auto small = toBigEndian(doc.small->getValue());
+    GatherEncoder enc;
+    enc.setBigEndian(*doc.ints, ints.data());
+    enc.setBigEndian(*doc.longs, longs.data());
+    enc.setBigEndian(*doc.small, small.data());
+    for (int round = 0; round < 2; ++round) {
+        enc.encode(*doc.root);
+        assert(flatten(enc) == encoded(*doc.root));
+        assert(referenced(enc, ints.data()));
+        assert(referenced(enc, longs.data()));
+        // Below the inline limit registered payloads are copied too
+        assert(!referenced(enc, small.data()));
+    }
+
+    enc.forgetBigEndian();
+    enc.encode(*doc.root);
+    assert(flatten(enc) == encoded(*doc.root));
+    assert(!referenced(enc, ints.data()));
+}
+
+
+}  // namespace
+
+
+int main() {
+    testCopied();
+    testRegistered();
+    std::cout << "gather_test: ok" << std::endl;
+}
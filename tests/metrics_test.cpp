@@ -0,0 +1,180 @@
+/**
+    Prometheus exposition of the metrics registry, rendered and served
+    @file metrics_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+#include "metrics.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+bool contains(const std::string &text, const std::string &line) {
+    return text.find(line + "\n") != std::string::npos;
+}
+
+void testRender() {
+    MetricsRegistry registry;
+    auto &reads = registry.counter("nbt_reads_total", "Reads done");
+    reads.add();
+    reads.add(4);
+    // Registering again returns the same counter
+    registry.counter("nbt_reads_total", "Reads done").add();
+    registry.counter("nbt_errors_total", "Errors", {{"kind", "crc"}}).add(2);
+    registry.counter("nbt_errors_total", "Errors", {{"kind", "zlib"}});
+    auto &depth = registry.gauge("nbt_queue_depth", "Queued tasks");
+    depth.set(10);
+    depth.add(-2.5);
+    registry.gauge("nbt_label_escapes", "Line one\nback\\slash",
+                   {{"path", "C:\\world \"a\"\nb"}})
+        .set(1);
+    registry.callback("nbt_callback", "Read on scrape", MetricType::GAUGE,
+                      [] { return 0.25; });
+    auto &latency = registry.histogram("nbt_latency_seconds", "Latency",
+                                       {0.1, 1, 10}, {{"tier", "hot"}});
+    for (double v : {0.05, 0.1, 0.5, 2.0, 20.0, 30.0}) {
+        latency.observe(v);
+    }
+
+    const auto text = registry.render();
+    assert(contains(text, "# HELP nbt_reads_total Reads done"));
+    assert(contains(text, "# TYPE nbt_reads_total counter"));
+    assert(contains(text, "nbt_reads_total 6"));
+    assert(contains(text, "nbt_errors_total{kind=\"crc\"} 2"));
+    assert(contains(text, "nbt_errors_total{kind=\"zlib\"} 0"));
+    assert(contains(text, "# TYPE nbt_queue_depth gauge"));
+    assert(contains(text, "nbt_queue_depth 7.5"));
+    assert(contains(text, "nbt_callback 0.25"));
+
+    // Help escapes backslash and newline, label values quotes too
+    assert(contains(text, "# HELP nbt_label_escapes Line one\\nback\\\\slash"));
+    assert(contains(text,
+                    "nbt_label_escapes{path=\"C:\\\\world \\\"a\\\"\\nb\"} 1"));
+
+    // Buckets are cumulative, le bounds inclusive
+    assert(contains(text, "# TYPE nbt_latency_seconds histogram"));
+    const std::string bucket = "nbt_latency_seconds_bucket{tier=\"hot\",le=";
+    assert(contains(text, bucket + "\"0.1\"} 2"));
+    assert(contains(text, bucket + "\"1\"} 3"));
+    assert(contains(text, bucket + "\"10\"} 4"));
+    assert(contains(text, bucket + "\"+Inf\"} 6"));
+    assert(contains(text, "nbt_latency_seconds_sum{tier=\"hot\"} 52.65"));
+    assert(contains(text, "nbt_latency_seconds_count{tier=\"hot\"} 6"));
+}
+
+void testRejected() {
+    MetricsRegistry registry;
+    registry.counter("nbt_x", "x");
+    bool threw = false;
+    try {
+        registry.gauge("nbt_x", "x");
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    for (const auto &name : {"", "1abc", "a-b"}) {
+        threw = false;
+        try {
+            registry.counter(name, "x");
+        } catch (const std::invalid_argument &) {
+            threw = true;
+        }
+        assert(threw);
+    }
+}
+
+void testConcurrent() {
+    MetricsRegistry registry;
+    auto &counter = registry.counter("nbt_ops_total", "Ops");
+    auto &histogram = registry.histogram("nbt_op_seconds", "Op", {1, 2});
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 10000; ++i) {
+                counter.add();
+                histogram.observe(i % 3);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    assert(counter.value() == 40000);
+    const auto counts = histogram.counts();
+    assert(counts.size() == 3);
+    assert(counts[0] + counts[1] + counts[2] == 40000);
+    assert(histogram.sum() == 4 * (3333.0 * 1 + 3333.0 * 2));
+}
+
+/*
+    Returns the whole response to a GET of path on the loopback port
+*/
+std::string get(uint16_t port, const std::string &path) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(fd >= 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                     sizeof(addr)) == 0);
+    const auto request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    assert(::send(fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+           static_cast<ssize_t>(request.size()));
+    std::string response;
+    char buffer[4096];
+    ssize_t got;
+    while ((got = ::recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, static_cast<size_t>(got));
+    }
+    ::close(fd);
+    return response;
+}
+
+void testServer() {
+    MetricsRegistry registry;
+    auto &counter = registry.counter("nbt_served_total", "Served");
+    MetricsServer server(registry);
+    assert(server.port() != 0);
+
+    counter.add(3);
+    auto response = get(server.port(), "/metrics");
+    assert(response.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    const auto body = response.substr(response.find("\r\n\r\n") + 4);
+    assert(body == registry.render());
+    assert(response.find("Content-Length: " + std::to_string(body.size())) !=
+           std::string::npos);
+    assert(contains(body, "nbt_served_total 3"));
+
+    // Every scrape renders the current values
+    counter.add();
+    assert(contains(get(server.port(), "/"), "nbt_served_total 4"));
+    response = get(server.port(), "/other");
+    assert(response.compare(0, 22, "HTTP/1.1 404 Not Found") == 0);
+}
+
+
+}  // namespace
+
+
+int main() {
+    testRender();
+    testRejected();
+    testConcurrent();
+    testServer();
+    std::cout << "metrics_test: ok" << std::endl;
+}
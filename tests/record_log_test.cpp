@@ -0,0 +1,162 @@
+/**
+    Recovery of a record log after a crash
+    @file record_log_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "record_log.hpp"
+#include "stream_writer.hpp"
+
+using namespace nbt;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+
+/*
+    Returns a small document holding its sequence number
+*/
+std::string record(uint64_t seq) {
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("");
+    w.key("seq");
+    w.value(static_cast<int64_t>(seq));
+    w.key("name");
+    w.value("record_" + std::to_string(seq % 7));
+    w.end();
+    return out.str();
+}
+
+/*
+    Returns the number of records replayed, checking each of them
+*/
+uint64_t replayAll(const std::string &dir) {
+    uint64_t next = 0;
+    RecordLogReader(dir).replay(0, [&](uint64_t seq, std::string_view doc) {
+        assert(seq == next && doc == record(seq));
+        ++next;
+    });
+    return next;
+}
+
+std::string fresh(const std::string &name) {
+    const auto dir = (fs::temp_directory_path() / name).string();
+    fs::remove_all(dir);
+    return dir;
+}
+
+RecordLogOptions smallBlocks() {
+    RecordLogOptions options;
+    options.blockSize = 256;
+    options.segmentSize = 4 << 10;
+    return options;
+}
+
+void fill(const std::string &dir, uint64_t from, uint64_t to) {
+    RecordLog log(dir, smallBlocks());
+    assert(log.nextSequence() == from);
+    for (uint64_t seq = from; seq < to; ++seq) {
+        assert(log.append(record(seq)) == seq);
+    }
+    log.sync();
+}
+
+void testTornTail() {
+    const auto dir = fresh("record_log_test_torn");
+    fill(dir, 0, 500);
+    assert(RecordLogReader(dir).segments().size() > 1);
+
+    // A crash in the middle of the last block
+    const auto last = RecordLogReader(dir).segments().back();
+    const auto size = fs::file_size(last);
+    fs::resize_file(last, size - 10);
+    const auto intact = replayAll(dir);
+    assert(intact < 500);
+    {
+        LogSegment segment(last);
+        assert(segment.validSize() < size - 10);
+        assert(segment.nextSequence() == intact);
+    }
+
+    // Reopening cuts the torn block and continues after the intact ones
+    fill(dir, intact, intact + 100);
+    assert(LogSegment(last).validSize() == fs::file_size(last));
+    assert(replayAll(dir) == intact + 100);
+}
+
+void testCorruptTail() {
+    const auto dir = fresh("record_log_test_corrupt");
+    RecordLogOptions options = smallBlocks();
+    options.compression = RecordCompression::NONE;
+    {
+        RecordLog log(dir, options);
+        for (uint64_t seq = 0; seq < 20; ++seq) {
+            log.append(record(seq));
+        }
+    }
+    // The last block is whole and indexed, but fails its checksum
+    const auto segment = RecordLogReader(dir).segments().back();
+    const auto index = LogSegment(segment).index();
+    assert(index.size() > 1);
+    {
+        std::fstream file(segment,
+                          std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(fs::file_size(segment) - 1));
+        file.put('\x7f');
+    }
+    assert(LogSegment(segment).index().size() == index.size() - 1);
+    assert(replayAll(dir) == index.back().firstSequence);
+
+    fill(dir, index.back().firstSequence, 30);
+    assert(replayAll(dir) == 30);
+}
+
+void testIndexRebuild() {
+    const auto dir = fresh("record_log_test_index");
+    fill(dir, 0, 300);
+    const auto segments = RecordLogReader(dir).segments();
+    const auto last = segments.back();
+    const auto expected = LogSegment(last).index();
+    assert(expected.size() > 1);
+
+    // Lost index: the blocks are found by walking the segment
+    fs::remove(record_log::indexPath(last));
+    assert(LogSegment(last).index().size() == expected.size());
+    assert(replayAll(dir) == 300);
+
+    // Stale index listing only the first block
+    fs::resize_file(record_log::indexPath(segments.front()),
+                    record_log::INDEX_ENTRY);
+    assert(replayAll(dir) == 300);
+
+    // Reopening writes the index of the last segment back in full
+    fill(dir, 300, 300);
+    assert(fs::file_size(record_log::indexPath(last)) ==
+           expected.size() * record_log::INDEX_ENTRY);
+    const auto rebuilt = LogSegment(last).index();
+    for (size_t i = 0; i < expected.size(); ++i) {
+        assert(rebuilt[i].firstSequence == expected[i].firstSequence);
+        assert(rebuilt[i].offset == expected[i].offset);
+    }
+    assert(!fs::exists(record_log::indexPath(last) + ".tmp"));
+}
+
+
+}  // namespace
+
+
+int main() {
+    testTornTail();
+    testCorruptTail();
+    testIndexRebuild();
+    std::cout << "record_log_test: ok" << std::endl;
+}
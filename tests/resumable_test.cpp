@@ -0,0 +1,228 @@
+/**
+    Time sliced decoding against readDocument
+    @file resumable_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#include "resumable.hpp"
+#include "stream_writer.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Returns a region-like document: nested lists and compounds, and arrays
+    several pieces long
+*/
+std::string document() {
+    constexpr size_t LARGE = ResumableDecoder::ARRAY_PIECE * 5 / 2;
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("root");
+    w.key("DataVersion");
+    w.value(static_cast<int32_t>(3465));
+    w.key("chunks");
+    w.beginList(TagType::TAG_COMPOUND);
+    for (int c = 0; c < 3; ++c) {
+        w.beginCompound();
+        w.key("xPos");
+        w.value(static_cast<int32_t>(c));
+        w.key("LastUpdate");
+        w.value(static_cast<int64_t>(-123456789012LL * c));
+        w.key("Pos");
+        w.beginList(TagType::TAG_DOUBLE);
+        w.value(0.5 * c);
+        w.value(-64.0);
+        w.end();
+        w.key("sections");
+        w.beginList(TagType::TAG_LIST);
+        for (int s = 0; s < 2; ++s) {
+            w.beginList(TagType::TAG_COMPOUND);
+            w.beginCompound();
+            w.key("Y");
+            w.value(static_cast<int8_t>(s));
+            w.key("palette");
+            w.beginList(TagType::TAG_STRING);
+            w.value("minecraft:air");
+            w.value("minecraft:stone");
+            w.end();
+            w.key("data");
+            std::vector<int64_t> data(LARGE);
+            for (size_t i = 0; i < data.size(); ++i) {
+                data[i] = static_cast<int64_t>(i) * 0x0102030405LL - c;
+            }
+            w.value(data);
+            w.end();
+            w.end();
+        }
+        w.end();
+        w.key("heights");
+        std::vector<int32_t> heights(LARGE + 1);
+        for (size_t i = 0; i < heights.size(); ++i) {
+            heights[i] = static_cast<int32_t>(i * 70001) - c;
+        }
+        w.value(heights);
+        w.key("light");
+        w.value(std::vector<int8_t>(LARGE * 3, static_cast<int8_t>(-c)));
+        w.key("empty");
+        w.beginList(TagType::TAG_END);
+        w.end();
+        w.key("nested");
+        w.beginCompound();
+        w.key("deeper");
+        w.beginCompound();
+        w.key("name");
+        w.value("chunk " + std::to_string(c));
+        w.key("weight");
+        w.value(0.25f * c);
+        w.key("count");
+        w.value(static_cast<int16_t>(-c));
+        w.end();
+        w.end();
+        w.end();
+    }
+    w.end();
+    w.end();
+    return out.str();
+}
+
+std::string payload(const Tag &tag) {
+    std::ostringstream out;
+    tag.encode(out);
+    return out.str();
+}
+
+/*
+    Returns whether two trees hold the same tags. Compounds are compared
+    by key, their iteration order is not part of the document.
+*/
+bool same(const Tag &a, const Tag &b) {
+    if (a.getTagType() != b.getTagType() || a.getName() != b.getName()) {
+        return false;
+    }
+    if (a.getTagType() == TagType::TAG_COMPOUND) {
+        const auto &x = static_cast<const TagCompound &>(a).getValue();
+        const auto &y = static_cast<const TagCompound &>(b).getValue();
+        if (x.size() != y.size()) {
+            return false;
+        }
+        for (const auto &it : x) {
+            auto other = y.find(it.first);
+            if (other == y.end() || !same(*it.second, *other->second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (a.getTagType() == TagType::TAG_LIST) {
+        const auto &listA = static_cast<const TagList &>(a);
+        const auto &listB = static_cast<const TagList &>(b);
+        const auto &x = listA.getValue();
+        const auto &y = listB.getValue();
+        if (listA.getElementType() != listB.getElementType() ||
+            x.size() != y.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < x.size(); ++i) {
+            if (!same(*x[i], *y[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return payload(a) == payload(b);
+}
+
+std::unique_ptr<Tag> reference(const std::string &bytes) {
+    BufferStream stream(bytes.data(), bytes.size());
+    return readDocument(stream);
+}
+
+void testUnitBudget() {
+    const auto bytes = document();
+    const auto expected = reference(bytes);
+    ResumableDecoder decoder(bytes);
+    bool threw = false;
+    try {
+        decoder.result();
+    } catch (const std::logic_error &) {
+        threw = true;
+    }
+    assert(threw);
+
+    size_t calls = 0;
+    size_t deepest = 0;
+    size_t last = 0;
+    while (decoder.step(size_t(1))) {
+        ++calls;
+        deepest = std::max(deepest, decoder.depth());
+        // One unit never reads more than one piece of a long array
+        assert(decoder.position() >= last);
+        assert(decoder.position() - last <=
+               ResumableDecoder::ARRAY_PIECE * 8 + 64);
+        last = decoder.position();
+    }
+    assert(decoder.done());
+    assert(decoder.position() == bytes.size());
+    // Every large array took several calls
+    assert(calls > bytes.size() / (ResumableDecoder::ARRAY_PIECE * 8));
+    assert(deepest >= 5);
+
+    const auto doc = decoder.result();
+    assert(same(*doc, *expected));
+}
+
+void testTimeBudget() {
+    const auto bytes = document();
+    ResumableDecoder decoder(bytes);
+    size_t calls = 0;
+    while (decoder.step(std::chrono::microseconds(20))) {
+        ++calls;
+    }
+    assert(calls > 0);
+    assert(same(*decoder.result(), *reference(bytes)));
+
+    // Whatever is left can be decoded at once
+    ResumableDecoder rest(bytes);
+    rest.step(size_t(40));
+    assert(!rest.done());
+    assert(same(*rest.finish(), *reference(bytes)));
+}
+
+void testTruncated() {
+    const auto bytes = document();
+    const size_t cuts[] = {0, 1, 7, 40, bytes.size() / 3, bytes.size() / 2,
+                           bytes.size() - 1};
+    for (size_t cut : cuts) {
+        const std::string_view prefix(bytes.data(), cut);
+        bool threw = false;
+        try {
+            ResumableDecoder decoder(prefix);
+            while (decoder.step(size_t(3))) {
+            }
+        } catch (const UnexpectedEnd &) {
+            threw = true;
+        }
+        assert(threw);
+    }
+}
+
+
+}  // namespace
+
+
+int main() {
+    testUnitBudget();
+    testTimeBudget();
+    testTruncated();
+    std::cout << "resumable_test: ok" << std::endl;
+}
@@ -0,0 +1,135 @@
+/**
+    Sharded scans over TCP, with missing workers
+    @file shard_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+#include "shard.hpp"
+
+using namespace nbt;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+
+std::unique_ptr<Tag> serialize(const long &count) {
+    return std::make_unique<TagLong>(std::nullopt, count);
+}
+
+long deserialize(const Tag &tag) {
+    return static_cast<const TagLong &>(tag).getValue();
+}
+
+void merge(long &total, long &&partial) {
+    total += partial;
+}
+
+void worker(uint16_t port) {
+    ThreadPool pool(1);
+    auto conn = connectTcp("127.0.0.1", port);
+    runShardWorker<long>(
+        conn, pool, [](long &count, ChunkPos, const Tag &) { ++count; },
+        serialize);
+}
+
+std::string emptyRegionDir() {
+    const auto dir = (fs::temp_directory_path() / "shard_test").string();
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+void testEphemeralPort() {
+    auto listener = listenTcp("127.0.0.1", 0);
+    const auto port = listener.port();
+    assert(port != 0);
+    std::thread a(worker, port);
+    std::thread b(worker, port);
+    const auto total = coordinateScan<long>(listener, emptyRegionDir(), 2,
+                                            merge, deserialize);
+    a.join();
+    b.join();
+    assert(total == 0);
+}
+
+void testMissingWorker() {
+    auto listener = listenTcp("127.0.0.1", 0);
+    // The coordinator may give up before this worker is done sending
+    std::thread a([port = listener.port()] {
+        try {
+            worker(port);
+        } catch (const std::system_error &) {
+        }
+    });
+    ScanControl control;
+    control.deadline =
+        ScanControl::Clock::now() + std::chrono::milliseconds(300);
+    bool expired = false;
+    try {
+        coordinateScan<long>(listener, emptyRegionDir(), 2, merge,
+                             deserialize, control);
+    } catch (const DeadlineExceeded &) {
+        expired = true;
+    }
+    assert(expired);
+    a.join();
+
+    CancellationToken token;
+    token.cancel();
+    control = ScanControl{};
+    control.token = &token;
+    bool cancelled = false;
+    try {
+        coordinateScan<long>(listener, emptyRegionDir(), 1, merge,
+                             deserialize, control);
+    } catch (const Cancelled &) {
+        cancelled = true;
+    }
+    assert(cancelled);
+}
+
+void testStalledWorker() {
+    auto listener = listenTcp("127.0.0.1", 0);
+    // Announces a 100 byte frame, sends 2 bytes of it and stalls until
+    // the coordinator hangs up
+    std::thread stalled([port = listener.port()] {
+        auto conn = connectTcp("127.0.0.1", port);
+        assert(recvFrame(conn.fd()) != nullptr);
+        const char partial[] = {0, 0, 0, 100, 10, 0};
+        assert(::send(conn.fd(), partial, sizeof(partial), MSG_NOSIGNAL) ==
+               static_cast<ssize_t>(sizeof(partial)));
+        char byte;
+        while (::recv(conn.fd(), &byte, 1, 0) > 0) {
+        }
+    });
+    ScanControl control;
+    control.deadline =
+        ScanControl::Clock::now() + std::chrono::milliseconds(300);
+    bool expired = false;
+    try {
+        coordinateScan<long>(listener, emptyRegionDir(), 1, merge,
+                             deserialize, control);
+    } catch (const DeadlineExceeded &) {
+        expired = true;
+    }
+    assert(expired);
+    stalled.join();
+}
+
+
+}  // namespace
+
+
+int main() {
+    testEphemeralPort();
+    testMissingWorker();
+    testStalledWorker();
+    std::cout << "shard_test: ok" << std::endl;
+}
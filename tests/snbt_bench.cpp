@@ -0,0 +1,76 @@
+/**
+    Throughput of SNBT parsing, next to decoding the same document
+    @file snbt_bench.cpp
+    @author Mudream
+*/
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+#include "snbt.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Returns the SNBT of a list of entities, as in a structure file
+*/
+std::string entities(int count) {
+    std::ostringstream out;
+    out << "{DataVersion:3465,entities:[";
+    for (int i = 0; i < count; ++i) {
+        out << (i == 0 ? "" : ",") << "{id:\"minecraft:villager\","
+            << "Pos:[" << i * 0.5 << "d," << 64.0 + i % 7 << "d,"
+            << -i * 0.25 << "d],Rotation:[" << i % 360 << ".5f,0.0f],"
+            << "Health:20.0f,OnGround:1b,Air:300s,UUID:[I;" << i << ","
+            << -i << "," << i * 31 << ",7],"
+            << "CustomName:'{\"text\":\"Villager " << i << "\"}',"
+            << "VillagerData:{level:" << i % 5 << ",profession:"
+            << "\"minecraft:farmer\",type:\"minecraft:plains\"},"
+            << "Offers:{Recipes:[{buy:{id:\"minecraft:wheat\",Count:20b},"
+            << "sell:{id:\"minecraft:emerald\",Count:1b},maxUses:16,"
+            << "xp:2,priceMultiplier:0.05f}]},"
+            << "LastRestock:" << 1000000000000LL + i << "L}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+template <typename Fn>
+double megabytesPerSecond(size_t bytes, size_t rounds, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        fn();
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(bytes * rounds) / elapsed.count() / 1e6;
+}
+
+
+}  // namespace
+
+
+int main() {
+    constexpr size_t ROUNDS = 20;
+    const auto text = entities(10000);
+    std::ostringstream encoded;
+    writeDocument(encoded, *readSNBT(text));
+    const auto binary = encoded.str();
+
+    const double snbt = megabytesPerSecond(
+        text.size(), ROUNDS, [&] { readSNBT(text); });
+    const double nbt = megabytesPerSecond(binary.size(), ROUNDS, [&] {
+        BufferStream stream(binary.data(), binary.size());
+        readDocument(stream);
+    });
+    std::cout << "readSNBT: " << static_cast<uint64_t>(snbt) << " MB/s of "
+              << text.size() / 1000 << " kB text" << std::endl;
+    std::cout << "readDocument: " << static_cast<uint64_t>(nbt)
+              << " MB/s of the same document, " << binary.size() / 1000
+              << " kB" << std::endl;
+}
@@ -0,0 +1,139 @@
+/**
+    SNBT parsing at run time and at compile time
+    @file snbt_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#include "literal.hpp"
+#include "snbt.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+template <typename Fn>
+bool throws(Fn fn) {
+    try {
+        fn();
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+const Tag &field(const Tag &doc, const std::string &key) {
+    return *dynamic_cast<const TagCompound &>(doc).getValue().at(key);
+}
+
+std::string stringOf(const Tag &tag) {
+    return dynamic_cast<const TagString &>(tag).getValue();
+}
+
+void testTypes() {
+    const auto doc = readSNBT(
+        R"({b:1b, s:-3s, i:42, l:9000000000L, f:1.5f, d:2.25, e:1e3,
+            yes:true, word:1a2b, ba:[B;1b,-3b], ia:[I;1,2], la:[L;5l,6]})");
+    assert(field(*doc, "b").getTagType() == TagType::TAG_BYTE);
+    assert(field(*doc, "s").getTagType() == TagType::TAG_SHORT);
+    assert(field(*doc, "i").getTagType() == TagType::TAG_INT);
+    assert(field(*doc, "l").getTagType() == TagType::TAG_LONG);
+    assert(field(*doc, "f").getTagType() == TagType::TAG_FLOAT);
+    assert(field(*doc, "d").getTagType() == TagType::TAG_DOUBLE);
+    assert(field(*doc, "e").getTagType() == TagType::TAG_DOUBLE);
+    assert(field(*doc, "yes").getTagType() == TagType::TAG_BYTE);
+    assert(stringOf(field(*doc, "word")) == "1a2b");
+    assert(field(*doc, "la").getTagType() == TagType::TAG_LONG_ARRAY);
+}
+
+void testOutOfRange() {
+    // Like the vanilla parser, a number that does not fit is a string
+    const auto doc = readSNBT(
+        R"({max:2147483647, over:2147483648, under:-2147483649,
+            huge:99999999999999999999, byte:300b, short:40000s,
+            long:9223372036854775808L, double:1e999})");
+    assert(dynamic_cast<const TagInt &>(field(*doc, "max")).getValue() ==
+           2147483647);
+    assert(stringOf(field(*doc, "over")) == "2147483648");
+    assert(stringOf(field(*doc, "under")) == "-2147483649");
+    assert(stringOf(field(*doc, "huge")) == "99999999999999999999");
+    assert(stringOf(field(*doc, "byte")) == "300b");
+    assert(stringOf(field(*doc, "short")) == "40000s");
+    assert(stringOf(field(*doc, "long")) == "9223372036854775808L");
+    assert(stringOf(field(*doc, "double")) == "1e999");
+
+    // Array elements have no string to fall back to
+    assert(throws([] { readSNBT("{a:[B;300b]}"); }));
+    assert(throws([] { readSNBT("{a:[I;2147483648]}"); }));
+    assert(throws([] { readSNBT("{a:[L;1x]}"); }));
+}
+
+void testEscapes() {
+    const auto doc = readSNBT(R"({a:"q\"b\\s", b:'it\'s', "c\\":1})");
+    assert(stringOf(field(*doc, "a")) == "q\"b\\s");
+    assert(stringOf(field(*doc, "b")) == "it's");
+    assert(field(*doc, "c\\").getTagType() == TagType::TAG_INT);
+
+    assert(throws([] { readSNBT(R"({a:"line\nbreak"})"); }));
+    assert(throws([] { readSNBT(R"({a:"\'"})"); }));
+    assert(throws([] { readSNBT(R"({a:'\"'})"); }));
+    assert(throws([] { readSNBT(R"({a:"end\)"); }));
+}
+
+std::string payloadOf(const Tag &tag) {
+    std::ostringstream out;
+    tag.encode(out);
+    return out.str();
+}
+
+// Parsed at compile time by NBT_LITERAL and at run time by readSNBT
+constexpr char LITERAL_SOURCE[] =
+    R"({i:7, over:2147483648, byte:300b, f:1e99f, d:1e999, x:1e5, y:-2.5,
+        fmax:3.4028235e38f, fover:3.4028236e38f, fmin:-3.4028235e38f,
+        dmax:1.7976931348623157e308, dover:1.8e308, tiny:1e-45f,
+        s:"a\\b\"c"})";
+
+void testLiteral() {
+    // NBT_LITERAL must read every token the way readSNBT does
+    constexpr auto lit = NBT_LITERAL(LITERAL_SOURCE);
+    const auto view = lit.view();
+    std::istringstream in(std::string(view.data(), view.size()));
+    const auto compiled = readDocument(in);
+    const auto parsed = readSNBT(LITERAL_SOURCE);
+    const auto &entries =
+        dynamic_cast<const TagCompound &>(*parsed).getValue();
+    assert(entries.size() ==
+           dynamic_cast<const TagCompound &>(*compiled).getValue().size());
+    for (const auto &[key, tag] : entries) {
+        assert(field(*compiled, key).getTagType() == tag->getTagType());
+        assert(payloadOf(field(*compiled, key)) == payloadOf(*tag));
+    }
+    assert(field(*parsed, "fmax").getTagType() == TagType::TAG_FLOAT);
+    assert(dynamic_cast<const TagFloat &>(field(*parsed, "fmax"))
+               .getValue() == std::numeric_limits<float>::max());
+    assert(dynamic_cast<const TagDouble &>(field(*parsed, "dmax"))
+               .getValue() == std::numeric_limits<double>::max());
+    assert(stringOf(field(*compiled, "over")) == "2147483648");
+    assert(stringOf(field(*compiled, "fover")) == "3.4028236e38f");
+    assert(stringOf(field(*compiled, "dover")) == "1.8e308");
+    assert(stringOf(field(*compiled, "s")) == "a\\b\"c");
+}
+
+
+}  // namespace
+
+
+int main() {
+    testTypes();
+    testOutOfRange();
+    testEscapes();
+    testLiteral();
+    std::cout << "snbt_test: ok" << std::endl;
+}
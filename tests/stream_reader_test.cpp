@@ -0,0 +1,318 @@
+/**
+    Event parsing of document streams in small pieces and reads
+    @file stream_reader_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#include "stream_reader.hpp"
+#include "stream_writer.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Stream buffer handing out at most a few bytes per refill, as a socket
+    does when data trickles in
+*/
+class TrickleBuffer : public std::streambuf {
+public:
+    TrickleBuffer(const std::string &data, size_t step)
+        : data_(data), step_(step) {
+        setg(data_.data(), data_.data(), data_.data());
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() == data_.data() + data_.size()) {
+            return traits_type::eof();
+        }
+        const size_t left = data_.data() + data_.size() - gptr();
+        setg(data_.data(), gptr(), gptr() + std::min(left, step_));
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::string data_;
+    size_t step_;
+};
+
+/*
+    Writes the events as text, array elements included but not how they
+    were split, and keeps the sizes of the pieces apart
+*/
+class Recorder : public StreamHandler {
+public:
+    std::ostringstream trace;
+    std::vector<size_t> pieces;
+
+    void beginCompound(const std::string &name) override {
+        trace << "{" << name << "\n";
+    }
+
+    void endCompound() override {
+        trace << "}\n";
+    }
+
+    void beginList(const std::string &name, TagType elemType,
+                   int32_t length) override {
+        trace << "[" << name << " " << static_cast<int>(elemType) << " "
+              << length << "\n";
+    }
+
+    void endList() override {
+        trace << "]\n";
+    }
+
+    void byteValue(const std::string &name, int8_t val) override {
+        trace << name << " b " << static_cast<int>(val) << "\n";
+    }
+
+    void shortValue(const std::string &name, int16_t val) override {
+        trace << name << " s " << val << "\n";
+    }
+
+    void intValue(const std::string &name, int32_t val) override {
+        trace << name << " i " << val << "\n";
+    }
+
+    void longValue(const std::string &name, int64_t val) override {
+        trace << name << " l " << val << "\n";
+    }
+
+    void floatValue(const std::string &name, float val) override {
+        trace << name << " f " << val << "\n";
+    }
+
+    void doubleValue(const std::string &name, double val) override {
+        trace << name << " d " << val << "\n";
+    }
+
+    void stringValue(const std::string &name,
+                     const std::string &val) override {
+        trace << name << " t " << val << "\n";
+    }
+
+    void beginArray(const std::string &name, TagType arrayType,
+                    int32_t length) override {
+        trace << "<" << name << " " << static_cast<int>(arrayType) << " "
+              << length << "\n";
+    }
+
+    void bytePiece(const int8_t *data, size_t count) override {
+        piece(data, count);
+    }
+
+    void intPiece(const int32_t *data, size_t count) override {
+        piece(data, count);
+    }
+
+    void longPiece(const int64_t *data, size_t count) override {
+        piece(data, count);
+    }
+
+    void endArray() override {
+        trace << "\n>\n";
+    }
+
+private:
+    template <typename T>
+    void piece(const T *data, size_t count) {
+        pieces.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            trace << static_cast<int64_t>(data[i]) << " ";
+        }
+    }
+};
+
+constexpr size_t LONGS = 1000;
+constexpr size_t INTS = 777;
+constexpr size_t BYTES = 3001;
+
+std::string document(int seed) {
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("doc " + std::to_string(seed));
+    w.key("seed");
+    w.value(static_cast<int32_t>(seed));
+    w.key("name");
+    w.value("minecraft:overworld");
+    w.key("scalars");
+    w.beginCompound();
+    w.key("b");
+    w.value(static_cast<int8_t>(-seed));
+    w.key("s");
+    w.value(static_cast<int16_t>(300 * seed));
+    w.key("l");
+    w.value(static_cast<int64_t>(-123456789012LL * seed));
+    w.key("f");
+    w.value(0.5f * seed);
+    w.key("d");
+    w.value(-0.25 * seed);
+    w.end();
+    w.key("sections");
+    w.beginList(TagType::TAG_COMPOUND);
+    for (int s = 0; s < 2; ++s) {
+        w.beginCompound();
+        std::vector<int64_t> longs(LONGS);
+        for (size_t i = 0; i < LONGS; ++i) {
+            longs[i] = static_cast<int64_t>(i) * 0x0102030405LL - seed - s;
+        }
+        w.key("data");
+        w.value(longs);
+        std::vector<int32_t> ints(INTS);
+        for (size_t i = 0; i < INTS; ++i) {
+            ints[i] = static_cast<int32_t>(i * 70001) - seed;
+        }
+        w.key("heights");
+        w.value(ints);
+        w.key("light");
+        w.value(std::vector<int8_t>(BYTES, static_cast<int8_t>(s - seed)));
+        w.end();
+    }
+    w.end();
+    w.key("nested");
+    w.beginList(TagType::TAG_LIST);
+    w.beginList(TagType::TAG_INT);
+    w.value(static_cast<int32_t>(1));
+    w.value(static_cast<int32_t>(2));
+    w.end();
+    w.beginList(TagType::TAG_END);
+    w.end();
+    w.end();
+    w.end();
+    return out.str();
+}
+
+struct Parsed {
+    std::string trace;
+    std::vector<size_t> pieces;
+    std::vector<size_t> offsets;
+};
+
+/*
+    Parses every document of the stream
+*/
+Parsed parse(std::istream &in, size_t pieceSize, size_t readSize) {
+    StreamReader reader(in, pieceSize, readSize);
+    Recorder recorder;
+    Parsed parsed;
+    while (reader.read(recorder)) {
+        parsed.offsets.push_back(reader.offset());
+    }
+    parsed.offsets.push_back(reader.offset());
+    parsed.trace = recorder.trace.str();
+    parsed.pieces = std::move(recorder.pieces);
+    return parsed;
+}
+
+void testSplits() {
+    const auto doc = document(1);
+    std::istringstream whole(doc);
+    const auto expected = parse(whole, StreamReader::PIECE_SIZE,
+                                StreamReader::READ_SIZE);
+    // Two sections with three arrays each, every array in one piece
+    assert(expected.pieces.size() == 6);
+    assert(expected.offsets == std::vector<size_t>({doc.size(),
+                                                    doc.size()}));
+
+    const std::pair<size_t, size_t> sizes[] = {
+        {1, 1}, {7, 5}, {64, 100}, {333, 2048}, {LONGS, 3}, {5000, 17}};
+    for (const auto &[pieceSize, readSize] : sizes) {
+        for (size_t step : {size_t(1), size_t(13), size_t(4096)}) {
+            TrickleBuffer buffer(doc, step);
+            std::istream in(&buffer);
+            const auto parsed = parse(in, pieceSize, readSize);
+            assert(parsed.trace == expected.trace);
+            assert(parsed.offsets == expected.offsets);
+
+            // Full pieces, then the rest of each array
+            size_t count = 0;
+            for (size_t length : {LONGS, INTS, BYTES, LONGS, INTS, BYTES}) {
+                for (size_t left = length; left > 0;) {
+                    const size_t n = std::min(left, pieceSize);
+                    assert(parsed.pieces.at(count++) == n);
+                    left -= n;
+                }
+            }
+            assert(count == parsed.pieces.size());
+        }
+    }
+}
+
+void testSeveralDocuments() {
+    const std::string docs[] = {document(1), document(2), document(3)};
+    std::string stream;
+    std::string trace;
+    std::vector<size_t> offsets;
+    for (const auto &doc : docs) {
+        stream += doc;
+        offsets.push_back(stream.size());
+        std::istringstream in(doc);
+        trace += parse(in, 64, 64).trace;
+    }
+    offsets.push_back(stream.size());
+
+    TrickleBuffer buffer(stream, 100);
+    std::istream in(&buffer);
+    const auto parsed = parse(in, 64, 256);
+    assert(parsed.trace == trace);
+    assert(parsed.offsets == offsets);
+    assert(parsed.trace.find("{doc 2\n") != std::string::npos);
+
+    std::istringstream empty("");
+    assert(parse(empty, 64, 64).offsets == std::vector<size_t>({0}));
+}
+
+void testTruncated() {
+    const auto doc = document(4);
+    const auto second = doc + doc;
+    // Within the header, a scalar, the first long array, the byte array
+    // and the last byte, then half way into a second document
+    const auto firstArray = doc.find("data") + 8;
+    const size_t cuts[] = {1,
+                           5,
+                           doc.find("seed") + 5,
+                           firstArray + 1,
+                           firstArray + LONGS * 4,
+                           doc.find("light") + 9 + BYTES / 2,
+                           doc.size() - 1,
+                           doc.size() + 3,
+                           doc.size() + doc.size() / 2};
+    for (size_t cut : cuts) {
+        for (size_t readSize : {size_t(1), size_t(100), size_t(1 << 16)}) {
+            TrickleBuffer buffer(second.substr(0, cut), 97);
+            std::istream in(&buffer);
+            StreamReader reader(in, 50, readSize);
+            Recorder recorder;
+            bool threw = false;
+            try {
+                while (reader.read(recorder)) {
+                    assert(reader.offset() == doc.size());
+                }
+            } catch (const UnexpectedEnd &) {
+                threw = true;
+            }
+            assert(threw);
+        }
+    }
+}
+
+
+}  // namespace
+
+
+int main() {
+    testSplits();
+    testSeveralDocuments();
+    testTruncated();
+    std::cout << "stream_reader_test: ok" << std::endl;
+}
@@ -0,0 +1,129 @@
+/**
+    Patching pre-serialized documents
+    @file template_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+
+#include "snbt.hpp"
+#include "template.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+const Tag &at(const Tag &tag, const std::string &key) {
+    return *dynamic_cast<const TagCompound &>(tag).getValue().at(key);
+}
+
+const Tag &at(const Tag &tag, size_t index) {
+    return *dynamic_cast<const TagList &>(tag).getValue().at(index);
+}
+
+template <typename TagT>
+auto valueOf(const Tag &tag) {
+    return dynamic_cast<const TagT &>(tag).getValue();
+}
+
+std::unique_ptr<Tag> decode(const std::string &bytes) {
+    BufferStream stream(bytes.data(), bytes.size());
+    auto doc = readDocument(stream);
+    assert(stream.position() == bytes.size());
+    return doc;
+}
+
+const auto SOURCE = R"({
+    Item: {id: "minecraft:diamond_sword", Count: 1b, Damage: 3s},
+    Pos: [1.5d, 64.0d, -2.5d],
+    Tick: 100L,
+    Health: 20.0f,
+    CustomName: "Steve",
+    Tags: ["a", "b"],
+    Score: 7
+})";
+
+void testPatch() {
+    const auto doc = readSNBT(SOURCE);
+    DocumentTemplate tpl(*doc, {"Item.Count", "Item.Damage", "Pos.1", "Tick",
+                                "Health", "Score", "CustomName", "Tags.1",
+                                "Item.id"});
+    assert(tpl.getHoles().size() == 9);
+
+    // Unpatched, the template is the document itself
+    const auto same = decode(tpl.instantiate().str());
+    assert(valueOf<TagString>(at(*same, "CustomName")) == "Steve");
+    assert(valueOf<TagInt>(at(*same, "Score")) == 7);
+
+    for (const std::string name : {"", "Alexandra the Great", "Al"}) {
+        auto inst = tpl.instantiate();
+        inst.set(tpl.hole("Item.Count"), static_cast<int8_t>(64));
+        inst.set(tpl.hole("Item.Damage"), static_cast<int16_t>(-300));
+        inst.set(tpl.hole("Pos.1"), 70.25);
+        inst.set(tpl.hole("Tick"), static_cast<int64_t>(1) << 40);
+        inst.set(tpl.hole("Health"), 0.5f);
+        inst.set(tpl.hole("Score"), static_cast<int32_t>(-123456));
+        inst.set(tpl.hole("CustomName"), name);
+        inst.set(tpl.hole("Tags.1"), std::string(300, 'x'));
+        inst.set(tpl.hole("Item.id"), "minecraft:stick");
+
+        const auto out = decode(inst.str());
+        const auto &item = at(*out, "Item");
+        assert(valueOf<TagByte>(at(item, "Count")) == 64);
+        assert(valueOf<TagShort>(at(item, "Damage")) == -300);
+        assert(valueOf<TagString>(at(item, "id")) == "minecraft:stick");
+        assert(valueOf<TagDouble>(at(at(*out, "Pos"), 0)) == 1.5);
+        assert(valueOf<TagDouble>(at(at(*out, "Pos"), 1)) == 70.25);
+        assert(valueOf<TagDouble>(at(at(*out, "Pos"), 2)) == -2.5);
+        assert(valueOf<TagLong>(at(*out, "Tick")) == int64_t(1) << 40);
+        assert(valueOf<TagFloat>(at(*out, "Health")) == 0.5f);
+        assert(valueOf<TagInt>(at(*out, "Score")) == -123456);
+        assert(valueOf<TagString>(at(*out, "CustomName")) == name);
+        assert(valueOf<TagString>(at(at(*out, "Tags"), 0)) == "a");
+        assert(valueOf<TagString>(at(at(*out, "Tags"), 1)) ==
+               std::string(300, 'x'));
+    }
+}
+
+template <typename Fn>
+bool rejects(Fn fn) {
+    try {
+        fn();
+    } catch (const std::logic_error &) {
+        return true;
+    }
+    return false;
+}
+
+void testRejected() {
+    const auto doc = readSNBT(SOURCE);
+    assert(rejects([&] { DocumentTemplate(*doc, {"Score", "Score"}); }));
+    assert(rejects([&] { DocumentTemplate(*doc, {"Item.Missing"}); }));
+    assert(rejects([&] { DocumentTemplate(*doc, {"Pos.3"}); }));
+    assert(rejects([&] { DocumentTemplate(*doc, {"Item"}); }));
+
+    DocumentTemplate tpl(*doc, {"Score", "CustomName"});
+    auto inst = tpl.instantiate();
+    assert(rejects([&] { inst.set(tpl.hole("Score"), 1.0); }));
+    assert(rejects([&] { inst.set(tpl.hole("Score"), "seven"); }));
+    assert(rejects([&] { inst.set(tpl.hole("CustomName"), 1); }));
+    assert(rejects([&] { inst.set(2, 1); }));
+    assert(rejects([&] { tpl.hole("Tick"); }));
+    assert(rejects(
+        [&] { inst.set(tpl.hole("CustomName"), std::string(70000, 'x')); }));
+}
+
+
+}  // namespace
+
+
+int main() {
+    testPatch();
+    testRejected();
+    std::cout << "template_test: ok" << std::endl;
+}
@@ -0,0 +1,104 @@
+/**
+    Token buckets and adaptive back-off of I/O limits
+    @file throttle_test.cpp
+    @author Mudream
+*/
+
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+
+#include "throttle.hpp"
+
+using namespace nbt;
+using namespace std::chrono_literals;
+
+
+namespace {
+
+
+void testTokenBucket() {
+    TokenBucket bucket(100, 50);
+    const auto start = TokenBucket::Clock::now();
+    assert(bucket.take(50, start) == TokenBucket::Clock::duration::zero());
+    // In debt by 25 tokens, a quarter second at 100 per second
+    const auto delay = bucket.take(25, start);
+    assert(delay > 240ms && delay < 260ms);
+    assert(bucket.take(1, start + 1s) == TokenBucket::Clock::duration::zero());
+
+    TokenBucket unlimited;
+    assert(unlimited.take(1e12) == TokenBucket::Clock::duration::zero());
+}
+
+void testConfiguredBackOff() {
+    IoLimiter limiter(1000, 10);
+    limiter.setAdaptive(true, 1ms);
+    limiter.record(50ms);
+    assert(limiter.scale() == 0.9);
+    assert(limiter.bytesPerSecond() == 900 && limiter.iops() == 9);
+    for (int i = 0; i < 100; ++i) {
+        limiter.record(50ms);
+    }
+    assert(limiter.scale() == IoLimiter::MIN_SCALE);
+
+    // The average falls under the target, then the limits climb back
+    for (int i = 0; i < 200; ++i) {
+        limiter.record(0ms);
+    }
+    assert(limiter.scale() == 1);
+    assert(limiter.bytesPerSecond() == 1000 && limiter.iops() == 10);
+
+    limiter.record(50ms);
+    limiter.setAdaptive(false);
+    assert(limiter.bytesPerSecond() == 1000 && limiter.iops() == 10);
+}
+
+void testUnlimitedBackOff() {
+    IoLimiter limiter;
+    limiter.setAdaptive(true, 1ms);
+    // Without reads there is no throughput to start from
+    limiter.record(50ms);
+    assert(limiter.bytesPerSecond() == 0 && limiter.iops() == 0);
+
+    limiter.setAdaptive(true, 1ms);
+    for (int i = 0; i < 100; ++i) {
+        limiter.acquire(1 << 20);
+    }
+    assert(limiter.bytesPerSecond() == 0 && limiter.iops() == 0);
+    limiter.record(50ms);
+    const double bytes = limiter.bytesPerSecond();
+    const double ops = limiter.iops();
+    assert(bytes > 0 && ops > 0);
+    // Every read was 1 MiB
+    assert(bytes / ops > 0.99 * (1 << 20) && bytes / ops < 1.01 * (1 << 20));
+
+    // Further back-off scales the seeded rate instead of seeding again
+    limiter.record(50ms);
+    assert(limiter.bytesPerSecond() < bytes);
+    assert(limiter.bytesPerSecond() > 0.89 * bytes);
+
+    // Fully recovered, the limits are lifted
+    for (int i = 0; i < 200; ++i) {
+        limiter.record(0ms);
+    }
+    assert(limiter.scale() == 1);
+    assert(limiter.bytesPerSecond() == 0 && limiter.iops() == 0);
+
+    // A configured limit keeps priority over the seeded one
+    limiter.record(50ms);
+    limiter.setIops(20);
+    assert(limiter.iops() == 20 * limiter.scale());
+    assert(limiter.bytesPerSecond() > 0);
+}
+
+
+}  // namespace
+
+
+int main() {
+    testTokenBucket();
+    testConfiguredBackOff();
+    testUnlimitedBackOff();
+    std::cout << "throttle_test: ok" << std::endl;
+}
@@ -0,0 +1,116 @@
+/**
+    Throughput of large document decoding on pinned and unpinned pools,
+    from buffers with and without huge pages
+    @file topology_bench.cpp
+    @author Mudream
+*/
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "stream_writer.hpp"
+#include "thread_pool.hpp"
+#include "topology.hpp"
+
+using namespace nbt;
+
+
+namespace {
+
+
+/*
+    Returns a region sized document of chunk sections, mostly long arrays
+    as in block states and heightmaps
+*/
+std::string largeDocument() {
+    std::ostringstream out;
+    StreamWriter w(out);
+    w.beginCompound("");
+    w.key("chunks");
+    w.beginList(TagType::TAG_COMPOUND);
+    for (int c = 0; c < 64; ++c) {
+        w.beginCompound();
+        w.key("xPos");
+        w.value(static_cast<int32_t>(c));
+        w.key("Status");
+        w.value("minecraft:full");
+        w.key("sections");
+        w.beginList(TagType::TAG_COMPOUND);
+        for (int s = -4; s < 20; ++s) {
+            w.beginCompound();
+            w.key("Y");
+            w.value(static_cast<int8_t>(s));
+            w.key("palette");
+            w.beginList(TagType::TAG_STRING);
+            w.value("minecraft:stone");
+            w.value("minecraft:deepslate");
+            w.end();
+            w.key("data");
+            w.value(std::vector<int64_t>(256, 0x0102030405060708LL * s));
+            w.key("SkyLight");
+            w.value(std::vector<int8_t>(2048, static_cast<int8_t>(s)));
+            w.end();
+        }
+        w.end();
+        w.end();
+    }
+    w.end();
+    w.end();
+    return out.str();
+}
+
+/*
+    Decodes count copies of doc on the pool, each from a fresh buffer
+    written by the worker decoding it, as a read would
+*/
+double megabytesPerSecond(ThreadPool &pool, const std::string &doc,
+                          size_t count, HugePages pages) {
+    const auto start = std::chrono::steady_clock::now();
+    parallelFor(pool, count, count, [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            PageBuffer buffer(doc.size(), pages);
+            std::memcpy(buffer.data(), doc.data(), doc.size());
+            BufferStream stream(buffer.data(), doc.size());
+            readDocument(stream);
+        }
+    });
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(doc.size() * count) / elapsed.count() / 1e6;
+}
+
+
+}  // namespace
+
+
+int main() {
+    const auto doc = largeDocument();
+    const auto nodes = readTopology();
+    size_t cpus = 0;
+    for (const auto &node : nodes) {
+        cpus += node.cpus.size();
+    }
+    const size_t count = 8 * cpus;
+    std::cout << nodes.size() << " nodes, " << cpus << " cpus, "
+              << doc.size() / 1000 << " kB document" << std::endl;
+
+    ThreadPool unpinned(cpus);
+    ThreadPool pinned(nodes);
+    const std::pair<const char *, ThreadPool *> pools[] = {
+        {"unpinned", &unpinned}, {"pinned", &pinned}};
+    const std::pair<const char *, HugePages> modes[] = {
+        {"regular pages", HugePages::NONE},
+        {"transparent huge pages", HugePages::TRANSPARENT},
+        {"explicit huge pages", HugePages::EXPLICIT}};
+    for (const auto &[poolName, pool] : pools) {
+        // Warms up the workers and the allocator
+        megabytesPerSecond(*pool, doc, cpus, HugePages::NONE);
+        for (const auto &[modeName, pages] : modes) {
+            const double rate = megabytesPerSecond(*pool, doc, count, pages);
+            std::cout << poolName << ", " << modeName << ": "
+                      << static_cast<uint64_t>(rate) << " MB/s" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,357 @@
+/**
+    Thread pool
+    @file thread_pool.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "topology.hpp"
+
+
+namespace nbt {
+
+
+/*
+    Scheduling class of a task. Interactive work (player facing chunk
+    loads) always runs before background work (backups, scans).
+*/
+enum class Priority : uint8_t { INTERACTIVE, BACKGROUND };
+
+constexpr size_t PRIORITY_COUNT = 2;
+
+/*
+    Fixed size pool of worker threads with one FIFO queue per Priority.
+    Each class can be capped to a number of concurrently running tasks,
+    and background tasks can let queued interactive tasks run on their
+    thread at chunk boundaries through preempt().
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        if (threads == 0) {
+            threads = 1;
+        }
+        caps_.fill(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    /*
+        Starts workers pinned to the cpus of their NUMA node, so the
+        buffers they first touch are allocated on that node
+        @param nodes the topology, usually readTopology()
+        @param perNode workers per node, 0 for one per cpu of the node
+    */
+    explicit ThreadPool(const std::vector<NumaNode> &nodes,
+                        size_t perNode = 0) {
+        size_t threads = 0;
+        for (const auto &node : nodes) {
+            threads += perNode != 0 ? perNode : node.cpus.size();
+        }
+        caps_.fill(std::max<size_t>(1, threads));
+        for (const auto &node : nodes) {
+            const size_t count = perNode != 0 ? perNode : node.cpus.size();
+            for (size_t i = 0; i < count; ++i) {
+                workers_.emplace_back([this, node] {
+                    pinThread(node.cpus);
+                    currentNodeSlot() = node.id;
+                    run();
+                });
+            }
+        }
+        if (workers_.empty()) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /*
+        Runs the remaining tasks, then joins the workers
+    */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return workers_.size();
+    }
+
+    /*
+        Queues a task with the priority of the calling task, or
+        INTERACTIVE when called from outside the pool
+        @param f the callable to run on a worker
+        @return the future of the result of f
+    */
+    template <typename F>
+    auto submit(F &&f) -> std::future<std::invoke_result_t<F>> {
+        return submit(std::forward<F>(f), currentPriority());
+    }
+
+    /*
+        Queues a task
+        @param f the callable to run on a worker
+        @param priority the queue of the task
+        @return the future of the result of f
+    */
+    template <typename F>
+    auto submit(F &&f, Priority priority)
+        -> std::future<std::invoke_result_t<F>> {
+        using R = std::invoke_result_t<F>;
+        auto task =
+            std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto fut = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queues_[index(priority)].emplace_back([task] { (*task)(); });
+        }
+        cv_.notify_one();
+        return fut;
+    }
+
+    /*
+        Waits for a future of this pool. Inside a worker, queued tasks are
+        run meanwhile so that nested waits cannot deadlock the pool; the
+        waiting worker already holds its slot, so caps do not apply here.
+        @param fut the future to wait for
+        @return the result of the future
+    */
+    template <typename R>
+    R wait(std::future<R> &fut) {
+        while (worker() && fut.wait_for(std::chrono::seconds(0)) !=
+               std::future_status::ready) {
+            if (!runOne(PRIORITY_COUNT, false)) {
+                fut.wait();
+                break;
+            }
+        }
+        return fut.get();
+    }
+
+    /*
+        Limits the number of tasks of a class running at the same time
+        @param priority the class
+        @param cap at least 1, at most size() is effective
+    */
+    void setConcurrencyCap(Priority priority, size_t cap) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            caps_[index(priority)] = std::max<size_t>(1, cap);
+        }
+        cv_.notify_all();
+    }
+
+    /*
+        Enables preempt(); when disabled it never runs anything
+    */
+    void setPreemption(bool enabled) {
+        preemption_ = enabled;
+    }
+
+    /*
+        Called by a running task at a safe point such as a chunk boundary.
+        If the task is less urgent than queued work, runs that work on the
+        current thread before returning.
+        @return true if any task was run
+    */
+    bool preempt() {
+        if (!preemption_ || currentPriority() == Priority::INTERACTIVE) {
+            return false;
+        }
+        bool ran = false;
+        while (runOne(index(currentPriority()), true)) {
+            ran = true;
+        }
+        return ran;
+    }
+
+    /*
+        Returns the number of queued, not yet running tasks of a class
+    */
+    size_t queueDepth(Priority priority) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queues_[index(priority)].size();
+    }
+
+    /*
+        Returns the priority of the task running on the calling thread
+    */
+    static Priority currentPriority() {
+        return current();
+    }
+
+    /*
+        Returns the NUMA node the calling worker is pinned to, -1 outside
+        a pinned pool
+    */
+    static int currentNode() {
+        return currentNodeSlot();
+    }
+
+private:
+    static constexpr size_t index(Priority priority) {
+        return static_cast<size_t>(priority);
+    }
+
+    static Priority &current() {
+        thread_local Priority priority = Priority::INTERACTIVE;
+        return priority;
+    }
+
+    static int &currentNodeSlot() {
+        thread_local int node = -1;
+        return node;
+    }
+
+    static bool &worker() {
+        thread_local bool inPool = false;
+        return inPool;
+    }
+
+    /*
+        Pops the most urgent runnable task of a class below limit.
+        Requires mutex_ to be held.
+    */
+    bool pop(size_t limit, bool capped, std::function<void()> &task,
+             size_t &cls) {
+        for (cls = 0; cls < limit; ++cls) {
+            if (!queues_[cls].empty() &&
+                (!capped || running_[cls] < caps_[cls])) {
+                task = std::move(queues_[cls].front());
+                queues_[cls].pop_front();
+                ++running_[cls];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(std::function<void()> &task, size_t cls) {
+        auto saved = current();
+        current() = static_cast<Priority>(cls);
+        task();
+        current() = saved;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --running_[cls];
+        }
+        cv_.notify_all();
+    }
+
+    bool runOne(size_t limit, bool capped) {
+        std::function<void()> task;
+        size_t cls = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pop(limit, capped, task, cls)) {
+                return false;
+            }
+        }
+        execute(task, cls);
+        return true;
+    }
+
+    void run() {
+        worker() = true;
+        while (true) {
+            std::function<void()> task;
+            size_t cls = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] {
+                    return pop(PRIORITY_COUNT, true, task, cls) ||
+                           (stop_ && idle());
+                });
+                if (!task) {
+                    return;
+                }
+            }
+            execute(task, cls);
+        }
+    }
+
+    bool idle() const {
+        for (const auto &queue : queues_) {
+            if (!queue.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::array<std::deque<std::function<void()>>, PRIORITY_COUNT> queues_;
+    std::array<size_t, PRIORITY_COUNT> running_{};
+    std::array<size_t, PRIORITY_COUNT> caps_{};
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> preemption_{true};
+    bool stop_ = false;
+};
+
+/*
+    Splits [0, n) into ranges and runs fn(lo, hi) on the pool for each,
+    rethrowing the first failure once every range has finished
+    @param pool the pool running the ranges
+    @param n number of items
+    @param tasks number of ranges, at most n
+    @param fn the callable invoked with each range
+    @param priority the queue of the ranges, by default the priority of the
+           calling task
+*/
+template <typename Fn>
+void parallelFor(ThreadPool &pool, size_t n, size_t tasks, Fn fn,
+                 Priority priority = ThreadPool::currentPriority()) {
+    tasks = std::min(n, std::max<size_t>(1, tasks));
+    std::vector<std::future<void>> futures;
+    futures.reserve(tasks);
+    for (size_t t = 0; t < tasks; ++t) {
+        const size_t lo = n * t / tasks;
+        const size_t hi = n * (t + 1) / tasks;
+        futures.push_back(
+            pool.submit([&fn, lo, hi] { fn(lo, hi); }, priority));
+    }
+
+    std::exception_ptr error;
+    for (auto &fut : futures) {
+        try {
+            pool.wait(fut);
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+}  // namespace nbt
@@ -0,0 +1,270 @@
+/**
+    I/O rate limiting
+    @file throttle.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+
+namespace nbt {
+
+
+/*
+    Token bucket refilled at a fixed rate up to a burst size. Takes are
+    reservations: a take larger than the available tokens leaves the
+    bucket in debt and returns how long the caller has to wait, so one
+    oversized read is delayed instead of blocked forever.
+    A rate of 0 means unlimited.
+*/
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TokenBucket(double rate = 0, double burst = 0) {
+        setRate(rate, burst);
+    }
+
+    /*
+        @param rate tokens per second, 0 for unlimited
+        @param burst bucket size, defaults to one second worth of tokens
+    */
+    void setRate(double rate, double burst = 0) {
+        refill(Clock::now());
+        const bool wasUnlimited = rate_ <= 0;
+        rate_ = std::max(0.0, rate);
+        burst_ = burst > 0 ? burst : rate_;
+        tokens_ = wasUnlimited ? burst_ : std::min(tokens_, burst_);
+    }
+
+    double rate() const {
+        return rate_;
+    }
+
+    /*
+        Returns the delay after which n tokens are paid for
+    */
+    Clock::duration take(double n, Clock::time_point now = Clock::now()) {
+        if (rate_ <= 0) {
+            return Clock::duration::zero();
+        }
+        refill(now);
+        tokens_ -= n;
+        if (tokens_ >= 0) {
+            return Clock::duration::zero();
+        }
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(-tokens_ / rate_));
+    }
+
+private:
+    void refill(Clock::time_point now) {
+        if (rate_ > 0) {
+            std::chrono::duration<double> elapsed = now - last_;
+            tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+        }
+        last_ = now;
+    }
+
+private:
+    double rate_ = 0;
+    double burst_ = 0;
+    double tokens_ = 0;
+    Clock::time_point last_ = Clock::now();
+};
+
+/*
+    Limits the bytes per second and reads per second of background I/O.
+    Limits can be changed at runtime from any thread. In adaptive mode the
+    observed read latency is tracked as a moving average; while it stays
+    above the target both limits are scaled down multiplicatively, and
+    they recover additively once latency is back under the target. An
+    unlimited limit has nothing to scale, so on the first back-off it is
+    replaced by the throughput observed over the last second, and becomes
+    unlimited again once fully recovered.
+*/
+class IoLimiter {
+public:
+    using Clock = TokenBucket::Clock;
+
+    static constexpr double MIN_SCALE = 0.05;
+
+    /*
+        @param bytesPerSecond read bandwidth, 0 for unlimited
+        @param iops reads per second, 0 for unlimited
+    */
+    explicit IoLimiter(double bytesPerSecond = 0, double iops = 0)
+        : bytesPerSecond_(bytesPerSecond), iops_(iops) {
+        apply();
+    }
+
+    void setBytesPerSecond(double bytesPerSecond) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bytesPerSecond_ = bytesPerSecond;
+        apply();
+    }
+
+    void setIops(double iops) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        iops_ = iops;
+        apply();
+    }
+
+    /*
+        Enables latency based back-off of the configured limits, or of the
+        observed throughput where a limit is unlimited
+        @param enabled false restores the configured limits
+        @param target read latency above which the limits are lowered
+    */
+    void setAdaptive(bool enabled, Clock::duration target =
+                                       std::chrono::milliseconds(20)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        adaptive_ = enabled;
+        target_ = target;
+        scale_ = 1;
+        seededBytes_ = seededOps_ = 0;
+        apply();
+    }
+
+    /*
+        Returns the factor currently applied to the configured limits
+    */
+    double scale() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return scale_;
+    }
+
+    /*
+        Returns the bytes per second currently enforced, 0 for unlimited
+    */
+    double bytesPerSecond() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_.rate();
+    }
+
+    /*
+        Returns the reads per second currently enforced, 0 for unlimited
+    */
+    double iops() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ops_.rate();
+    }
+
+    /*
+        Blocks until one read of the given size is allowed
+    */
+    void acquire(size_t bytes) {
+        Clock::duration delay;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto now = Clock::now();
+            observe(static_cast<double>(bytes), now);
+            delay = std::max(bytes_.take(static_cast<double>(bytes), now),
+                             ops_.take(1, now));
+        }
+        if (delay > Clock::duration::zero()) {
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+    /*
+        Reports the latency of a completed read, used by the adaptive mode
+    */
+    void record(Clock::duration latency) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!adaptive_) {
+            return;
+        }
+        std::chrono::duration<double> sample = latency;
+        average_ = average_ == 0
+                       ? sample.count()
+                       : average_ + ALPHA * (sample.count() - average_);
+        std::chrono::duration<double> target = target_;
+        if (average_ > target.count()) {
+            seed(Clock::now());
+            scale_ = std::max(MIN_SCALE, scale_ * 0.9);
+        } else {
+            scale_ = std::min(1.0, scale_ + 0.01);
+            if (scale_ == 1.0) {
+                seededBytes_ = seededOps_ = 0;
+            }
+        }
+        apply();
+    }
+
+private:
+    static constexpr double ALPHA = 0.2;
+
+    /*
+        Requires mutex_ to be held, except from the constructor
+    */
+    void apply() {
+        const double bytes =
+            bytesPerSecond_ > 0 ? bytesPerSecond_ : seededBytes_;
+        const double ops = iops_ > 0 ? iops_ : seededOps_;
+        bytes_.setRate(bytes * scale_);
+        ops_.setRate(ops * scale_);
+    }
+
+    /*
+        Counts a read in the throughput window, closed every second
+    */
+    void observe(double bytes, Clock::time_point now) {
+        windowBytes_ += bytes;
+        ++windowOps_;
+        const std::chrono::duration<double> elapsed = now - windowStart_;
+        if (elapsed.count() >= 1) {
+            observedBytes_ = windowBytes_ / elapsed.count();
+            observedOps_ = windowOps_ / elapsed.count();
+            windowBytes_ = windowOps_ = 0;
+            windowStart_ = now;
+        }
+    }
+
+    /*
+        Gives unlimited limits the throughput of the last closed window, or
+        of the open one if none closed yet, at the current scale
+    */
+    void seed(Clock::time_point now) {
+        const std::chrono::duration<double> elapsed = now - windowStart_;
+        const auto rate = [&elapsed](double observed, double window) {
+            if (observed > 0) {
+                return observed;
+            }
+            return elapsed.count() > 0 ? window / elapsed.count() : 0.0;
+        };
+        if (bytesPerSecond_ <= 0 && seededBytes_ <= 0) {
+            seededBytes_ = rate(observedBytes_, windowBytes_) / scale_;
+        }
+        if (iops_ <= 0 && seededOps_ <= 0) {
+            seededOps_ = rate(observedOps_, windowOps_) / scale_;
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    TokenBucket bytes_;
+    TokenBucket ops_;
+    double bytesPerSecond_;
+    double iops_;
+    bool adaptive_ = false;
+    Clock::duration target_ = std::chrono::milliseconds(20);
+    double scale_ = 1;
+    double average_ = 0;
+    // Stand-ins for unlimited limits while backing off, 0 if none
+    double seededBytes_ = 0;
+    double seededOps_ = 0;
+    Clock::time_point windowStart_ = Clock::now();
+    double windowBytes_ = 0;
+    double windowOps_ = 0;
+    double observedBytes_ = 0;
+    double observedOps_ = 0;
+};
+
+
+}  // namespace nbt
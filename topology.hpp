@@ -0,0 +1,276 @@
+/**
+    NUMA topology, thread pinning and page backed buffers
+    @file topology.hpp
+    @author Mudream
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace nbt {
+
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+/*
+    Returns the cpus of a sysfs cpu list such as "0-3,8-11"
+*/
+inline std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        auto end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const auto range = list.substr(pos, end - pos);
+        const auto dash = range.find('-');
+        try {
+            const int lo = std::stoi(range.substr(0, dash));
+            const int hi = dash == std::string::npos
+                               ? lo
+                               : std::stoi(range.substr(dash + 1));
+            for (int cpu = lo; cpu <= hi; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::logic_error &) {
+            // Blank entries (trailing newline, empty node) carry no cpu
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+/*
+    Returns the NUMA nodes with at least one cpu, read from sysfs. Without
+    NUMA support one node holding every cpu is returned.
+    @param root the sysfs node directory
+*/
+inline std::vector<NumaNode> readTopology(
+    const std::string &root = "/sys/devices/system/node") {
+    std::vector<NumaNode> nodes;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(root, ec), end;
+         !ec && it != end; it.increment(ec)) {
+        const auto name = it->path().filename().string();
+        if (name.compare(0, 4, "node") != 0 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos ||
+            name.size() == 4) {
+            continue;
+        }
+        std::ifstream file(it->path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        auto cpus = parseCpuList(list);
+        if (!cpus.empty()) {
+            nodes.push_back(NumaNode{std::stoi(name.substr(4)), cpus});
+        }
+    }
+    if (nodes.empty()) {
+        NumaNode all{0, {}};
+        const auto count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < count; ++cpu) {
+            all.cpus.push_back(static_cast<int>(cpu));
+        }
+        nodes.push_back(std::move(all));
+    }
+    std::sort(nodes.begin(), nodes.end(),
+              [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+}
+
+/*
+    Restricts the calling thread to a set of cpus
+    @return false if the affinity could not be set
+*/
+inline bool pinThread(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+enum class HugePages : uint8_t {
+    // Regular pages
+    NONE,
+    // Regular mapping advised with MADV_HUGEPAGE
+    TRANSPARENT,
+    // MAP_HUGETLB from the reserved pool, TRANSPARENT if none is left
+    EXPLICIT,
+};
+
+/*
+    Anonymous mmap backed buffer. Pages are only placed on first touch,
+    so a buffer filled by a pinned thread lives on that thread's node.
+*/
+class PageBuffer {
+public:
+    static constexpr size_t HUGE_PAGE = 2 << 20;
+
+    PageBuffer() = default;
+
+    explicit PageBuffer(size_t size, HugePages pages = HugePages::NONE) {
+        allocate(size, pages);
+    }
+
+    PageBuffer(PageBuffer &&other) noexcept
+        : data_(other.data_), capacity_(other.capacity_) {
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+
+    PageBuffer &operator=(PageBuffer &&other) noexcept {
+        if (this != &other) {
+            release();
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+            other.data_ = nullptr;
+            other.capacity_ = 0;
+        }
+        return *this;
+    }
+
+    PageBuffer(const PageBuffer &) = delete;
+    PageBuffer &operator=(const PageBuffer &) = delete;
+
+    ~PageBuffer() {
+        release();
+    }
+
+    char *data() const {
+        return data_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    /*
+        Returns the bytes mapped by every live PageBuffer
+    */
+    static std::atomic<size_t> &mappedBytes() {
+        static std::atomic<size_t> bytes{0};
+        return bytes;
+    }
+
+    /*
+        Makes room for size bytes, dropping the previous content
+    */
+    void reserve(size_t size, HugePages pages = HugePages::NONE) {
+        if (size > capacity_) {
+            release();
+            allocate(size, pages);
+        }
+    }
+
+private:
+    void allocate(size_t size, HugePages pages) {
+        const size_t page = pages == HugePages::NONE ? 4096 : HUGE_PAGE;
+        const size_t length = (std::max<size_t>(size, 1) + page - 1) / page *
+                              page;
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (pages == HugePages::EXPLICIT) {
+            p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (p == MAP_FAILED) {
+            p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+#ifdef MADV_HUGEPAGE
+            if (pages != HugePages::NONE) {
+                ::madvise(p, length, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        data_ = static_cast<char *>(p);
+        capacity_ = length;
+        mappedBytes().fetch_add(length, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (data_ != nullptr) {
+            ::munmap(data_, capacity_);
+            mappedBytes().fetch_sub(capacity_, std::memory_order_relaxed);
+            data_ = nullptr;
+            capacity_ = 0;
+        }
+    }
+
+private:
+    char *data_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+/*
+    Returns the huge page policy of scratch buffers
+*/
+inline std::atomic<HugePages> &scratchHugePages() {
+    static std::atomic<HugePages> pages{HugePages::NONE};
+    return pages;
+}
+
+/*
+    Returns the trim generation of scratch buffers
+*/
+inline std::atomic<uint64_t> &scratchTrims() {
+    static std::atomic<uint64_t> trims{0};
+    return trims;
+}
+
+/*
+    Asks every thread to give back the part of its scratch buffer beyond
+    what it next requests. Buffers are owned by their thread, so each one
+    is trimmed on the thread's next call to scratchBuffer.
+*/
+inline void trimScratchBuffers() {
+    scratchTrims().fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+    Returns a buffer of at least size bytes owned by the calling thread and
+    reused across calls. On a pinned worker it stays on the worker's node.
+*/
+inline PageBuffer &scratchBuffer(size_t size) {
+    thread_local PageBuffer buffer;
+    thread_local uint64_t trimmed = 0;
+    const auto pages = scratchHugePages().load(std::memory_order_relaxed);
+    const auto trims = scratchTrims().load(std::memory_order_relaxed);
+    if (trims != trimmed) {
+        trimmed = trims;
+        if (buffer.capacity() > std::max<size_t>(size, PageBuffer::HUGE_PAGE)) {
+            buffer = PageBuffer();
+        }
+    }
+    buffer.reserve(size, pages);
+    return buffer;
+}
+
+
+}  // namespace nbt